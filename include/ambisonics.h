@@ -15,12 +15,18 @@
 #define SAL_HOA_H
 
 
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include "microphone.h"
 #include "point.h"
 #include "decoder.h"
 #include "microphonearray.h"
 #include "salconstants.h"
 #include "iirfilter.h"
+#include "firfilter.h"
+#include "binauralmic.h"
 
 namespace sal {
 
@@ -47,7 +53,10 @@ public:
                 HoaOrdering ordering = HoaOrdering::Acn) :
           Microphone(position, orientation),
           order_(order), normalisation_convention_(normalisation),
-          ordering_convention_(ordering) {}
+          ordering_convention_(ordering),
+          full_order_distance_(0.0), min_order_(0),
+          gains_(HoaBuffer::GetNumChannels(order)),
+          output_pointers_(HoaBuffer::GetNumChannels(order)) {}
   
   bool IsCoincident() const noexcept { return true; }
   
@@ -57,7 +66,61 @@ public:
   
   static std::vector<mcl::Real> HorizontalEncoding(Int order, Angle theta);
   
+  /**
+   Limits the order of the wave `wave_id` to `order` (<= `order()`), e.g.
+   according to its priority. The components above `order` are not
+   written. When the order of a wave changes, the components in between are
+   faded in or out across the next block. This is only supported with
+   `N3d` and `Sn3d` normalisation, and takes precedence over
+   `SetLevelOfDetail`.
+   */
+  void SetWaveOrder(const Int wave_id, const Int order) noexcept;
+  
+  /** Removes the limit set with `SetWaveOrder`. */
+  void ClearWaveOrder(const Int wave_id) noexcept;
+  
+  /**
+   Chooses the order of each wave from its distance from the microphone:
+   waves up to `full_order_distance` are encoded at full order, and the
+   order decreases by one each time the distance doubles, down to
+   `min_order`. A `full_order_distance` of zero disables this.
+   */
+  void SetLevelOfDetail(const Length full_order_distance,
+                        const Int min_order = 1) noexcept;
+  
+  /**
+   Returns the order chosen by `SetLevelOfDetail` for a wave at distance
+   `distance`.
+   */
+  static Int GetLevelOfDetailOrder(const Int order, const Int min_order,
+                                   const Length full_order_distance,
+                                   const Length distance) noexcept;
+  
+  Int order() const noexcept { return order_; }
+  
+  /** Resets the fading between levels of detail. */
+  virtual void Reset() noexcept { current_orders_.clear(); }
+  
+  /**
+   Writes into `output` the (`order`+1)^2 real spherical harmonics in the
+   direction of `point` (which does not need to be normalised), in ACN
+   ordering and with `N3d` or `Sn3d` normalisation. The associated Legendre
+   functions and the sines and cosines of the multiples of the azimuth are
+   obtained by recursion (without calling trigonometric functions), so that
+   each coefficient costs a constant number of operations.
+   */
+  static void GetSphericalHarmonics(const Int order, const mcl::Point& point,
+                                    const HoaNormalisation normalisation,
+                                    Sample* output) noexcept;
+  
   static bool Test();
+  
+  /**
+   Prints the time it takes to encode sources with `AmbisonicsMic` and with
+   `FixedOrderAmbisonicsMic`, at orders 1, 3 and 5.
+   */
+  static bool SimulationTime();
+  
   virtual void AddPlaneWaveRelative(const Sample* input_data,
                                     const Int num_samples,
                                     const mcl::Point& point,
@@ -67,11 +130,210 @@ public:
   
 private:
   
+  /** Returns the order at which the wave `wave_id` is encoded */
+  Int GetWaveOrder(const Int wave_id, const Length distance) const noexcept;
+  
   const Int order_;
   HoaNormalisation normalisation_convention_;
   HoaOrdering ordering_convention_;
+  
+  /** Level of detail */
+  std::map<Int, Int> wave_orders_;
+  Length full_order_distance_;
+  Int min_order_;
+  /** Order of the waves encoded at less than full order in the last block */
+  std::map<Int, Int> current_orders_;
+  
+  /** Preallocated for performance (one element per ACN index) */
+  std::vector<Sample> gains_;
+  std::vector<Sample*> output_pointers_;
+};
+
+
+/**
+ Adds `gains[acn_id]*input_data` to the channels of `output_buffer` with
+ ACN index from `Begin` to `End` (excluded), using the channel map of
+ `FixedOrderHoaBuffer<Order, Ordering>`. The channels are processed four at
+ a time (each input sample is loaded once for four channels) and the
+ recursion over the blocks is resolved at compile time, so that the whole
+ loop over the channels is unrolled.
+ */
+template<Int Order, HoaOrdering Ordering, Int Begin, Int End,
+         Int Count = ((End-Begin) >= 4) ? 4 : (((End-Begin) > 0) ? 1 : 0)>
+struct FixedOrderHoaKernel {
+  static inline void MultiplyAdd(const Sample* input_data,
+                                 const Int num_samples,
+                                 const Sample* gains,
+                                 Buffer& output_buffer) noexcept {
+    typedef FixedOrderHoaBuffer<Order, Ordering> HoaBufferType;
+    Sample* output_0 = output_buffer.GetWritePointer(
+        HoaBufferType::GetChannelIdFromAcn(Begin));
+    Sample* output_1 = output_buffer.GetWritePointer(
+        HoaBufferType::GetChannelIdFromAcn(Begin+1));
+    Sample* output_2 = output_buffer.GetWritePointer(
+        HoaBufferType::GetChannelIdFromAcn(Begin+2));
+    Sample* output_3 = output_buffer.GetWritePointer(
+        HoaBufferType::GetChannelIdFromAcn(Begin+3));
+    const Sample gain_0 = gains[Begin];
+    const Sample gain_1 = gains[Begin+1];
+    const Sample gain_2 = gains[Begin+2];
+    const Sample gain_3 = gains[Begin+3];
+    for (Int i=0; i<num_samples; ++i) {
+      const Sample input_sample = input_data[i];
+      output_0[i] += gain_0*input_sample;
+      output_1[i] += gain_1*input_sample;
+      output_2[i] += gain_2*input_sample;
+      output_3[i] += gain_3*input_sample;
+    }
+    FixedOrderHoaKernel<Order, Ordering, Begin+4, End>::
+        MultiplyAdd(input_data, num_samples, gains, output_buffer);
+  }
 };
 
+template<Int Order, HoaOrdering Ordering, Int Begin, Int End>
+struct FixedOrderHoaKernel<Order, Ordering, Begin, End, 1> {
+  static inline void MultiplyAdd(const Sample* input_data,
+                                 const Int num_samples,
+                                 const Sample* gains,
+                                 Buffer& output_buffer) noexcept {
+    Sample* output = output_buffer.GetWritePointer(
+        FixedOrderHoaBuffer<Order, Ordering>::GetChannelIdFromAcn(Begin));
+    const Sample gain = gains[Begin];
+    for (Int i=0; i<num_samples; ++i) { output[i] += gain*input_data[i]; }
+    FixedOrderHoaKernel<Order, Ordering, Begin+1, End>::
+        MultiplyAdd(input_data, num_samples, gains, output_buffer);
+  }
+};
+
+template<Int Order, HoaOrdering Ordering, Int End>
+struct FixedOrderHoaKernel<Order, Ordering, End, End, 0> {
+  static inline void MultiplyAdd(const Sample*, const Int, const Sample*,
+                                 Buffer&) noexcept {}
+};
+
+
+/**
+ Ambisonics microphone with order and channel ordering fixed at compile
+ time, for the common case where these are known in advance (e.g. first,
+ third or fifth order). It gives the same output as `AmbisonicsMic` with
+ `N3d` or `Sn3d` normalisation, but the gains live on the stack, the
+ channel map is resolved by the compiler and the gain loops are unrolled.
+ */
+template<Int Order, HoaOrdering Ordering = HoaOrdering::Acn>
+class FixedOrderAmbisonicsMic : public Microphone {
+public:
+  static_assert(Order > 0, "The Ambisonics order has to be positive");
+  
+  FixedOrderAmbisonicsMic(const mcl::Point& position,
+                          mcl::Quaternion orientation,
+                          HoaNormalisation normalisation = HoaNormalisation::N3d) :
+          Microphone(position, orientation), normalisation_(normalisation) {
+    ASSERT(normalisation == N3d || normalisation == Sn3d);
+  }
+  
+  bool IsCoincident() const noexcept { return true; }
+  
+  Int num_channels() const noexcept { return kNumChannels; }
+  
+  virtual void AddPlaneWaveRelative(const Sample* input_data,
+                                    const Int num_samples,
+                                    const mcl::Point& point,
+                                    const Int wave_id,
+                                    Buffer& output_buffer) noexcept {
+    Sample gains[kNumChannels];
+    AmbisonicsMic::GetSphericalHarmonics(Order, point, normalisation_, gains);
+    FixedOrderHoaKernel<Order, Ordering, 0, kNumChannels>::
+        MultiplyAdd(input_data, num_samples, gains, output_buffer);
+  }
+  
+private:
+  static constexpr Int kNumChannels =
+      FixedOrderHoaBuffer<Order, Ordering>::kNumChannels;
+  
+  HoaNormalisation normalisation_;
+};
+  
+template<Int Order, HoaOrdering Ordering>
+constexpr Int FixedOrderAmbisonicsMic<Order, Ordering>::kNumChannels;
+
+  
+/**
+ Encodes many sources at once into a HOA buffer, with the same gains as
+ `AmbisonicsMic` with `N3d` or `Sn3d` normalisation. Instead of one pass
+ over the output per source, the gains of all sources are kept in a
+ (`order`+1)^2 x `num_sources` matrix, and the output is computed as a
+ matrix product with the block of input signals, one tile of samples at a
+ time, so that each output channel is written once per block and the
+ tile of inputs stays in cache.
+ 
+ When the direction of a source changes, its gains are ramped linearly
+ across the next block, reaching the new values at its end.
+ */
+class AmbisonicsBatchEncoder {
+public:
+  AmbisonicsBatchEncoder(const Int order, const Int num_sources,
+                         const HoaNormalisation normalisation = N3d,
+                         const HoaOrdering ordering = HoaOrdering::Acn);
+  
+  Int num_sources() const noexcept { return num_sources_; }
+  
+  Int num_channels() const noexcept { return num_channels_; }
+  
+  /**
+   Sets the direction of source `source_id`, in the reference system of the
+   encoder (e.g. as returned by `Microphone::GetRelativePoint`). The first
+   time it is called for a source, the gains are not ramped.
+   */
+  void SetSourceDirection(const Int source_id,
+                          const mcl::Point& direction) noexcept;
+  
+  /**
+   Adds to `output_buffer` the encoding of `input_buffer`, which has one
+   channel per source.
+   */
+  void Encode(const Buffer& input_buffer, Buffer& output_buffer) noexcept;
+  
+  static bool Test();
+  
+  /**
+   Prints the throughput (in source-channels per second) of this encoder and
+   of one `AmbisonicsMic::AddPlaneWave` call per source.
+   */
+  static bool SimulationTime();
+  
+private:
+  /**
+   Channels processed together, sharing each load of an input sample (the
+   kernel in `Encode` is written out for four channels)
+   */
+  static const Int kChannelBlock = 4;
+  
+  /** Samples processed together, sized to keep the inputs in cache */
+  static const Int kTileLength = 64;
+  
+  Int order_;
+  Int num_sources_;
+  Int num_channels_;
+  /** Number of channels rounded up to a multiple of kChannelBlock */
+  Int num_padded_channels_;
+  HoaNormalisation normalisation_;
+  
+  /** Output channel of each ACN index */
+  std::vector<Int> channel_ids_;
+  
+  /**
+   Gain matrices, with element (acn_id, source_id) at
+   acn_id*num_sources_+source_id. The padding rows are zero.
+   */
+  std::vector<Sample> current_gains_;
+  std::vector<Sample> target_gains_;
+  std::vector<bool> initialised_;
+  
+  /** Preallocated for performance */
+  std::vector<Sample> steps_;
+  std::vector<Sample> harmonics_;
+};
+  
   
 /** 
  Implements horizontal higher order ambisonics with regular loudspeakers
@@ -109,6 +371,16 @@ public:
                       Buffer& output_buffer);
   
   
+  /**
+   Produces the high-pass and low-pass crossover filter with cutoff
+   frequency Fc and sampling frequency Fs as descibed by A. Heller et al.,
+   "Is My Decoder Ambisonic?", in AES 125th Convention.
+   */
+  static mcl::IirFilter CrossoverFilterLow(const Time cut_off_frequency,
+                                           const Time sampling_frequency);
+  static mcl::IirFilter CrossoverFilterHigh(const Time cut_off_frequency,
+                                            const Time sampling_frequency);
+  
   static bool Test();
 
   virtual ~AmbisonicsHorizDec() {}
@@ -134,8 +406,15 @@ private:
     return (Sample) cos(((Angle) index)*PI/(2.0*((Angle) order)+2.0));
   }
   
-  std::vector<Sample> GetFrame(const Int order, const Int sample_id,
-                               const Buffer& buffer);
+  /**
+   Writes into `output_data` the product of the row of a decoding matrix
+   `matrix_row` (one element per component) and the components in
+   `component_data`.
+   */
+  static void MultiplyRow(const Sample* matrix_row,
+                          const std::vector<const Sample*>& component_data,
+                          const Int num_samples,
+                          Sample* output_data) noexcept;
   
   /**
    Produces the near field correction
@@ -153,16 +432,6 @@ private:
                                   const Length sound_speed);
 
   
-  /**
-   Produces the high-pass and low-pass crossover filter with cutoff
-   frequency Fc and sampling frequency Fs as descibed by A. Heller et al.,
-   "Is My Decoder Ambisonic?", in AES 125th Convention.
-   */
-  static mcl::IirFilter CrossoverFilterLow(const Time cut_off_frequency,
-                                           const Time sampling_frequency);
-  static mcl::IirFilter CrossoverFilterHigh(const Time cut_off_frequency,
-                                            const Time sampling_frequency);
-  
   std::vector<Angle> loudspeaker_angles_;
   Int num_loudspeakers_;
   bool near_field_correction_;
@@ -185,6 +454,294 @@ private:
   mcl::Matrix<Sample> max_energy_matrix_;
   
   Time sampling_frequency_;
+  
+  /** Input channels of the 2*order+1 components, in the order (0,0),
+   (1,1), (1,-1), (2,2), (2,-2)... of the decoding matrices */
+  std::vector<Int> channel_ids_;
+  
+  /** Rows (one per loudspeaker) of the mode-matching matrix, and of its
+   product with the maximum energy matrix, stored contiguously */
+  std::vector<Sample> low_decoding_rows_;
+  std::vector<Sample> high_decoding_rows_;
+  
+  /** Preallocated for performance (grown only when a block is longer than
+   all the previous ones) */
+  std::vector<Sample> nfc_components_;
+  std::vector<const Sample*> component_data_;
+  std::vector<Sample> low_output_;
+  std::vector<Sample> high_output_;
+};
+  
+  
+enum class HoaDecodingMethod {
+  PseudoInverse,
+  AllRad
+};
+  
+  
+/**
+ Decoder of 3D higher order ambisonics for arbitrary (irregular) loudspeaker
+ layouts, e.g. domes. The decoding matrix is computed once, at
+ construction, with one of two methods:
+ - `PseudoInverse`: mode matching, i.e. the (regularised) pseudo-inverse of
+   the matrix of the spherical harmonics in the loudspeaker directions.
+   This is exact for layouts that sample the whole sphere well, but has
+   large gains for layouts that cover only part of it;
+ - `AllRad`: all-round ambisonic decoding, as described by F. Zotter and
+   M. Frank in "All-round ambisonic panning and decoding", JAES, 2012. The
+   signals are decoded to a dense, uniform grid of virtual loudspeakers,
+   which are then panned to the real ones with VBAP on the triangles of
+   their convex hull. Imaginary loudspeakers are added at the zenith and at
+   the nadir when the layout does not cover them, and their signals are
+   discarded.
+ 
+ The input is expected with the normalisation and ordering of
+ `AmbisonicsMic` (`N3d` or `Sn3d`). If `energy_decoding` is true, the
+ max-rE weights are applied above `cut_off_frequency`, with the same
+ crossover filters as `AmbisonicsHorizDec`.
+ 
+ The output of each loudspeaker is the product of a row of the matrix with
+ the whole block of input components. For very large layouts, the
+ loudspeakers can be split across `num_threads` threads.
+ */
+class Ambisonics3dDec : public Decoder {
+public:
+  Ambisonics3dDec(const Int order,
+                  const std::vector<mcl::Point>& loudspeaker_positions,
+                  const HoaDecodingMethod method = HoaDecodingMethod::AllRad,
+                  const bool energy_decoding = false,
+                  const Time cut_off_frequency = 700.0,
+                  const Time sampling_frequency = 44100.0,
+                  const HoaNormalisation normalisation = N3d,
+                  const HoaOrdering ordering_convention = HoaOrdering::Acn,
+                  const Int num_threads = 1);
+  
+  Int num_loudspeakers() const noexcept { return num_loudspeakers_; }
+  
+  /**
+   Returns the decoding matrix (one row per loudspeaker, one column per
+   component in ACN ordering), without the max-rE weights.
+   */
+  mcl::Matrix<Sample> decoding_matrix() const noexcept;
+  
+  virtual void Decode(const Buffer& input_buffer,
+                      Buffer& output_buffer);
+  
+  /**
+   Returns the mode-matching decoding matrix, with N3d normalisation and
+   ACN ordering.
+   */
+  static mcl::Matrix<Sample>
+  PseudoInverseDec(const Int order,
+                   const std::vector<mcl::Point>& loudspeaker_positions);
+  
+  /**
+   Returns the AllRAD decoding matrix, with N3d normalisation and ACN
+   ordering.
+   */
+  static mcl::Matrix<Sample>
+  AllRadDec(const Int order,
+            const std::vector<mcl::Point>& loudspeaker_positions);
+  
+  /**
+   Returns the max-rE weight of each order (up to `order`), as in Zotter
+   and Frank's article, normalised so that the energy of a uniform
+   decoding is preserved.
+   */
+  static std::vector<Sample> MaxEnergyWeights(const Int order);
+  
+  static bool Test();
+  
+  virtual ~Ambisonics3dDec();
+  
+private:
+  /**
+   Decodes the range of loudspeakers of `thread_id` at every block, until
+   the object is destroyed.
+   */
+  void RunWorker(const Int thread_id) noexcept;
+  
+  /**
+   Returns the triangles (as triplets of indexes) of the convex hull of
+   `points`, which are directions (unit vectors).
+   */
+  static std::vector<std::vector<Int> >
+  ConvexHull(const std::vector<mcl::Point>& points);
+  
+  /** Decodes the loudspeakers from `begin` to `end` (excluded). */
+  void DecodeLoudspeakers(const Int begin, const Int end,
+                          const Int num_samples, Buffer& output_buffer,
+                          std::vector<Sample>& low_output,
+                          std::vector<Sample>& high_output) noexcept;
+  
+  /**
+   Writes into `output_data` the product of the row of a decoding matrix
+   `matrix_row` and the components in `component_data_`.
+   */
+  void MultiplyRow(const Sample* matrix_row, const Int num_samples,
+                   Sample* output_data) const noexcept;
+  
+  Int order_;
+  Int num_components_;
+  Int num_loudspeakers_;
+  bool energy_decoding_;
+  Int num_threads_;
+  
+  /** Input channel of each ACN index */
+  std::vector<Int> channel_ids_;
+  
+  /** Rows (one per loudspeaker) of the decoding matrix, and of its product
+   with the max-rE weights, stored contiguously */
+  std::vector<Sample> low_decoding_rows_;
+  std::vector<Sample> high_decoding_rows_;
+  
+  // One filter per loudspeaker
+  std::vector<mcl::IirFilter> crossover_filters_low_;
+  std::vector<mcl::IirFilter> crossover_filters_high_;
+  
+  /** Preallocated for performance (one pair of rows per thread) */
+  std::vector<const Sample*> component_data_;
+  std::vector<std::vector<Sample> > low_outputs_;
+  std::vector<std::vector<Sample> > high_outputs_;
+  
+  /**
+   Threads other than the calling one, which are started at construction
+   and wait for each block (numbered by `block_id_`), so that Decode does
+   not create threads or allocate.
+   */
+  std::vector<std::thread> workers_;
+  std::mutex mutex_;
+  std::condition_variable block_ready_;
+  std::condition_variable block_done_;
+  Int block_id_;
+  Int num_workers_done_;
+  Int block_num_samples_;
+  Buffer* block_output_buffer_;
+  bool is_stopping_;
+};
+  
+  
+/**
+ Rotates the sound field encoded in a `HoaBuffer` (with `N3d` or `Sn3d`
+ normalisation), e.g. to compensate the movements of the head of the
+ listener. This costs O(channels^2) per sample regardless of the number of
+ sources, rather than re-encoding each source with a new orientation.
+ The rotation matrix of the real spherical harmonics is block diagonal
+ (one block per order) and is computed with the recursion in J. Ivanic and
+ K. Ruedenberg, "Rotation matrices for real spherical harmonics. Direct
+ determination by recursion", J. Phys. Chem., 1996 (and its 1998
+ erratum), starting from the 3x3 rotation matrix of the quaternion.
+ */
+class AmbisonicsRotator {
+public:
+  AmbisonicsRotator(const Int order,
+                    const HoaOrdering ordering_convention = HoaOrdering::Acn);
+  
+  /**
+   Sets the rotation of the sound field, i.e. a source in direction p
+   will be in direction `rotation` p. To compensate the orientation of the
+   head, pass its inverse. The matrix is interpolated linearly, across the
+   next block, from the previous rotation to this one, to avoid zipper
+   noise.
+   */
+  void SetRotation(const mcl::Quaternion& rotation) noexcept;
+  
+  /**
+   Rotates the sound field in `input_buffer` into `output_buffer`, which
+   can be the same buffer.
+   */
+  void Rotate(const Buffer& input_buffer, Buffer& output_buffer) noexcept;
+  
+  /**
+   Returns the rotation matrix of the spherical harmonics up to `order`,
+   with rows and columns in ACN ordering, for the rotation `rotation`.
+   */
+  static mcl::Matrix<Sample> GetRotationMatrix(const Int order,
+                                               const mcl::Quaternion& rotation);
+  
+  static bool Test();
+  
+private:
+  /**
+   Returns the blocks of the rotation matrix (one per order, each with
+   (2*order+1)^2 elements in row-major order, and indexed by degrees
+   between -order and order).
+   */
+  static std::vector<std::vector<Sample> >
+  GetRotationBlocks(const Int order, const mcl::Quaternion& rotation) noexcept;
+  
+  Int order_;
+  HoaOrdering ordering_convention_;
+  
+  /** Channels of the components of each order, from degree -order to order */
+  std::vector<std::vector<Int> > channel_ids_;
+  
+  std::vector<std::vector<Sample> > current_blocks_;
+  std::vector<std::vector<Sample> > target_blocks_;
+  
+  /** Preallocated for performance */
+  std::vector<Sample> input_frame_;
+};
+  
+  
+/**
+ Binaural decoder of higher order ambisonics through virtual loudspeakers.
+ The ambisonics signals are decoded (mode-matching, see
+ `Ambisonics3dDec::PseudoInverseDec`) to virtual loudspeakers on the
+ sphere, each of which is then convolved with the HRIRs of its direction.
+ Since both operations are linear, the HRIRs of the loudspeakers are summed
+ once, at construction, into one filter per ambisonics component and per
+ ear, so that decoding costs 2*(`order`+1)^2 convolutions, regardless of
+ the number of sources encoded in the ambisonics signals.
+ */
+class AmbisonicsBinauralDec : public Decoder {
+public:
+  /**
+   `order` is the HOA order, and the input is expected with all the
+   (`order`+1)^2 components, as written by `AmbisonicsMic` with
+   `normalisation` (`N3d` or `Sn3d`). Exact reconstruction of the
+   spherical harmonics requires at least (`order`+1)^2 loudspeakers, in
+   (quasi-)uniform directions, e.g. a t-design or a Fibonacci grid.
+   The HRIRs are read from `binaural_mic` (e.g. a `KemarMic`), in the
+   direction of each loudspeaker relative to the head, and are truncated
+   to `hrir_length` samples. `binaural_mic` is not modified.
+   */
+  AmbisonicsBinauralDec(const Int order,
+                        const std::vector<mcl::Point>& loudspeaker_positions,
+                        BinauralMic& binaural_mic,
+                        const Int hrir_length,
+                        const HoaNormalisation normalisation = N3d,
+                        const HoaOrdering ordering_convention = HoaOrdering::Acn);
+  
+  /**
+   Decodes `input_buffer` (a `HoaBuffer`) into `output_buffer` (a
+   `StereoBuffer`), overwriting its content.
+   */
+  virtual void Decode(const Buffer& input_buffer,
+                      Buffer& output_buffer);
+  
+  static bool Test();
+  
+  virtual ~AmbisonicsBinauralDec() {}
+  
+private:
+  /**
+   Returns the response of `binaural_mic` at `ear` to an impulse from
+   `point`, truncated to `length` samples, including the delay separated
+   from the BRIR (if any).
+   */
+  static Signal GetHrir(BinauralMic& binaural_mic, const Ear ear,
+                        const mcl::Point& point, const Int length) noexcept;
+  
+  Int order_;
+  HoaOrdering ordering_convention_;
+  
+  /** Channel of the input buffer of each component (in ACN ordering) */
+  std::vector<Int> channel_ids_;
+  
+  /** One filter per component */
+  std::vector<mcl::FirFilter> filters_left_;
+  std::vector<mcl::FirFilter> filters_right_;
 };
   
   
@@ -545,6 +545,61 @@ public:
   }
 };
   
+
+/**
+ HOA buffer with order and channel ordering fixed at compile time. The
+ channel map is `constexpr`, so that, e.g., `GetChannelId(2, -1)` is
+ resolved by the compiler. It can be used wherever a `HoaBuffer` is
+ expected.
+ */
+template<Int Order, HoaOrdering Ordering = HoaOrdering::Acn>
+class FixedOrderHoaBuffer : public HoaBuffer {
+public:
+  static_assert(Order > 0, "The Ambisonics order has to be positive");
+  
+  static constexpr Int kNumChannels = (Order+1)*(Order+1);
+  
+  explicit FixedOrderHoaBuffer(const Int num_samples) :
+      HoaBuffer(Order, num_samples, Ordering) {}
+  
+  inline void SetSample(const Int order, const Int degree, const Int sample_id,
+                        const Sample& sample_value) noexcept {
+    Buffer::SetSample(GetChannelId(order, degree), sample_id, sample_value);
+  }
+  
+  inline Sample GetSample(const Int order, const Int degree,
+                          const Int sample_id) const noexcept {
+    return Buffer::GetSample(GetChannelId(order, degree), sample_id);
+  }
+  
+  using HoaBuffer::GetChannelId;
+  
+  static constexpr Int GetChannelId(const Int order,
+                                    const Int degree) noexcept {
+    return (Ordering == HoaOrdering::Acn) ? order*order + order + degree :
+        (order == 0) ? 0 :
+        (order == 1) ? ((degree == 1) ? 1 : ((degree == -1) ? 2 : 3)) :
+        order*order + ((degree > 0) ? 2*degree-1 : -2*degree);
+  }
+  
+  /** Returns the channel of the component with ACN index `acn_id`. */
+  static constexpr Int GetChannelIdFromAcn(const Int acn_id) noexcept {
+    return GetChannelId(GetOrderFromAcn(acn_id),
+                        acn_id - GetOrderFromAcn(acn_id)*
+                                 (GetOrderFromAcn(acn_id)+1));
+  }
+  
+  /** Returns the order of the component with ACN index `acn_id`. */
+  static constexpr Int GetOrderFromAcn(const Int acn_id,
+                                       const Int order = 0) noexcept {
+    return ((order+1)*(order+1) > acn_id) ?
+        order : GetOrderFromAcn(acn_id, order+1);
+  }
+};
+
+template<Int Order, HoaOrdering Ordering>
+constexpr Int FixedOrderHoaBuffer<Order, Ordering>::kNumChannels;
+  
 } // End namespace
 
 #endif
@@ -13,11 +13,13 @@
 
 #include <map>
 #include <vector>
+#include <string>
 #include "microphone.h"
 #include "saltypes.h"
 #include "array.h"
 #include "salconstants.h"
 #include "firfilter.h"
+#include "delayfilter.h"
 
 namespace sal {
   
@@ -44,6 +46,8 @@ public:
   /** When bypass_ is true, the signals will not be filtered by the HRTF */
   void SetBypass(bool bypass) noexcept;
   
+  bool bypass() const noexcept { return bypass_; }
+  
   virtual void Reset() noexcept;
   
   bool IsCoincident() const noexcept { return true; }
@@ -61,12 +65,6 @@ public:
   
 private:
   
-  /** Retrieves the BRIR for a source in position `point`.
-   The head is assumed to be positioned lying on the z-axis and facing
-   the positive x-direction. E.g. a point on the positive x-axis
-   is facing directly ahead of the head. */
-  virtual Signal GetBrir(const Ear ear, const mcl::Point& point) noexcept = 0;
-  
   void CreateInstanceIfNotExist(const Int wave_id) noexcept;
   
   std::map<UInt, BinauralMicInstance> instances_;
@@ -78,8 +76,30 @@ private:
   bool bypass_;
   
   friend class BinauralMicInstance;
+  friend class AmbisonicsBinauralDec;
   
 protected:
+  /** Retrieves the BRIR for a source in position `point`.
+   The head is assumed to be positioned lying on the z-axis and facing
+   the positive x-direction. E.g. a point on the positive x-axis
+   is facing directly ahead of the head. */
+  virtual Signal GetBrir(const Ear ear, const mcl::Point& point) noexcept = 0;
+  
+  /**
+   Returns the delay (in samples, possibly fractional) to be applied to the
+   signal in addition to the BRIR given by `GetBrir`. This is zero unless
+   the delays have been separated from the BRIRs (see
+   `DatabaseBinauralMic::SplitMinimumPhase`).
+   */
+  virtual Time GetBrirDelay(const Ear ear, const mcl::Point& point) noexcept {
+    return 0.0;
+  }
+  
+  /**
+   Returns the largest value that `GetBrirDelay` can return, which is used
+   to size the delay lines when the instances are created.
+   */
+  virtual Time GetMaxBrirDelay() const noexcept { return 0.0; }
   
   HeadRefOrientation reference_orientation_;
 };
@@ -97,13 +117,149 @@ public:
    Filters all responses by `filter`. Useful for instance for including
    an inverse headphone filter
    */
-  void FilterAll(mcl::DigitalFilter* filter);
+  virtual void FilterAll(mcl::DigitalFilter* filter);
+  
+  /**
+   Splits each HRIR into a minimum-phase filter, truncated to `num_taps`
+   samples, and a fractional delay, given by the difference between the
+   onsets of the original and of the minimum-phase responses. The delays
+   (which include the interaural time difference) are then applied through
+   an interpolated delay line, and ramped across the block when the
+   direction changes. This shortens the FIR filters, and avoids smearing
+   the ITD between directions. Call this before using the microphone.
+   */
+  virtual void SplitMinimumPhase(const Int num_taps = 64);
+  
+  /**
+   Returns the position (in samples, possibly fractional) where `signal`
+   first reaches a tenth of its peak absolute value.
+   */
+  static Time GetOnset(const Signal& signal) noexcept;
+  
+  /**
+   Switches to rendering through `num_components` components of the HRIRs,
+   computed once, jointly over both ears and all directions: the first is
+   the (normalised) mean HRIR, and the others are the principal components
+   of what is left. Each source is then only mixed, with direction-dependent
+   weights (the projections of its HRIRs on the components), into
+   `num_components` buses per ear, and `RenderComponents` convolves the
+   buses with the components. Hence, the convolutions cost the same
+   regardless of the number of sources. Setting `num_components` to zero
+   goes back to direct convolution. Call this after the database is final
+   (e.g. after `SplitMinimumPhase`, whose delays are still applied per
+   source).
+   */
+  void SetPrincipalComponents(const Int num_components);
+  
+  Int num_principal_components() const noexcept {
+    return principal_components_.size();
+  }
+  
+  /**
+   Returns the energy of the difference between the HRIRs and their
+   reconstruction from the components, relative to the energy of the HRIRs.
+   For white input, this is also the relative error of the rendering
+   against direct convolution.
+   */
+  Sample principal_components_error() const noexcept {
+    return principal_components_error_;
+  }
+  
+  /**
+   When rendering through principal components, `AddPlaneWave` only mixes
+   the sources into the buses. This convolves the buses (with all the
+   sources added since the last call) with the components, adds the result
+   to `output_buffer` and empties the buses. Call it once per block, after
+   all the sources.
+   */
+  void RenderComponents(Buffer& output_buffer) noexcept;
+  
+  virtual void AddPlaneWaveRelative(const Sample* signal,
+                                    const Int num_samples,
+                                    const mcl::Point& point,
+                                    const Int wave_id,
+                                    Buffer& output_buffer) noexcept;
+  
+  virtual void Reset() noexcept;
+  
+  /**
+   Returns `num_components` orthonormal vectors spanning (approximately) the
+   vectors in `data`: the normalised mean, followed by the principal
+   components of the data orthogonalised to it, in decreasing order of
+   variance (computed by power iteration with deflation).
+   */
+  static std::vector<Signal>
+  GetPrincipalComponents(const std::vector<Signal>& data,
+                         const Int num_components) noexcept;
+  
+  /**
+   Returns `hrtf_database` resampled from `input_sampling_frequency` to
+   `output_sampling_frequency` with a polyphase filter (see `Resampler`).
+   The HRIRs are also scaled by the ratio of the sampling frequencies, so
+   that their frequency responses are unchanged.
+   */
+  static std::vector<std::vector<Signal> >
+  Resample(const std::vector<std::vector<Signal> >& hrtf_database,
+           const Time input_sampling_frequency,
+           const Time output_sampling_frequency);
+  
+  /**
+   Empties the cache of resampled databases (see `ResampleDatabase`), e.g.
+   to release memory or after a database has changed on disk.
+   */
+  static void ClearResampledDatabaseCache() noexcept;
   
   virtual ~DatabaseBinauralMic() {}
 protected:
+  /**
+   Resamples both databases from `database_sampling_frequency` to
+   `sampling_frequency`. The result is kept in a cache shared by all
+   microphones (and threads) under `database_id`, which has to identify the
+   content of the database, so that it is computed only once per rate.
+   */
+  void ResampleDatabase(const std::string& database_id,
+                        const Time database_sampling_frequency,
+                        const Time sampling_frequency);
+  
+
   // Database
   std::vector<std::vector<Signal> > hrtf_database_right_;
   std::vector<std::vector<Signal> > hrtf_database_left_;
+  
+  /**
+   Delays separated from the HRIRs by `SplitMinimumPhase` (empty otherwise).
+   They are stored as one-sample signals indexed like the databases, so
+   that they can be looked up (and interpolated) in the same way.
+   */
+  std::vector<std::vector<Signal> > hrtf_delays_right_;
+  std::vector<std::vector<Signal> > hrtf_delays_left_;
+  
+  virtual Time GetMaxBrirDelay() const noexcept { return max_brir_delay_; }
+  
+private:
+  /** State of a source rendered through principal components */
+  struct ComponentsInstance {
+    mcl::Point previous_point;
+    /** weights[ear][component] */
+    std::vector<Sample> weights[2];
+    /** Weights at the start of the block, from which they are ramped */
+    std::vector<Sample> start_weights[2];
+    Time delays[2];
+    DelayFilter delay_filters[2];
+  };
+  
+  void UpdateWeights(const mcl::Point& point,
+                     ComponentsInstance& instance) noexcept;
+  
+  std::vector<Signal> principal_components_;
+  Sample principal_components_error_;
+  /** Filters (one per component) and buses of the left and right ears */
+  std::vector<mcl::FirFilter> component_filters_[2];
+  std::vector<Signal> component_buses_[2];
+  std::map<UInt, ComponentsInstance> components_instances_;
+  std::vector<Sample> delayed_input_;
+  /** Largest of the delays in `hrtf_delays_left_` and `hrtf_delays_right_` */
+  Time max_brir_delay_;
 };
   
   
@@ -118,7 +274,12 @@ private:
   filter_left_(mcl::FirFilter::GainFilter(1.0)),
   filter_right_(mcl::FirFilter::GainFilter(1.0)),
   update_length_(update_length),
-  reference_orientation_(reference_orientation) {}
+  reference_orientation_(reference_orientation),
+  delay_filter_left_(0, GetMaxLatency(base_mic->GetMaxBrirDelay())),
+  delay_filter_right_(0, GetMaxLatency(base_mic->GetMaxBrirDelay())),
+  delay_left_(0.0), delay_right_(0.0),
+  target_delay_left_(0.0), target_delay_right_(0.0),
+  delayed_(false) {}
   
   void AddPlaneWaveRelative(const Sample* input_data,
                             const Int num_samples,
@@ -127,6 +288,24 @@ private:
   
   void UpdateFilter(const mcl::Point& point) noexcept;
   
+  /**
+   Returns the length of a delay line that can be read (with Lagrange
+   interpolation) at any delay up to `max_delay`.
+   */
+  static Int GetMaxLatency(const Time max_delay) noexcept {
+    return ((Int) ceil(max_delay)) + 2;
+  }
+  
+  /**
+   Writes `input_data` into `delay_filter` and reads it back into
+   `output_data`, with a delay ramping linearly from `start_delay` to
+   `end_delay` across the block. The delays cannot exceed those that
+   `delay_filter` was sized for (see `GetMaxLatency`).
+   */
+  static void Delay(const Sample* input_data, const Int num_samples,
+                    const Time start_delay, const Time end_delay,
+                    DelayFilter& delay_filter, Sample* output_data) noexcept;
+  
   /**
    The microphone object is called for every sample, while the position
    of SDN's elements is changed once in a while. Hence, these angles are
@@ -141,7 +320,20 @@ private:
   sal::Int update_length_;
   HeadRefOrientation reference_orientation_;
   
+  DelayFilter delay_filter_left_;
+  DelayFilter delay_filter_right_;
+  Time delay_left_;
+  Time delay_right_;
+  Time target_delay_left_;
+  Time target_delay_right_;
+  
+  /** True once the base microphone has returned a non-zero delay */
+  bool delayed_;
+  
+  std::vector<Sample> delayed_input_;
+  
   friend class BinauralMic;
+  friend class DatabaseBinauralMic;
 };
   
   
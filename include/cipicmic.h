@@ -19,6 +19,7 @@
 #include "array.h"
 #include "binauralmic.h"
 #include "salconstants.h"
+#include "hrtfpack.h"
 
 #define NUM_ELEVATIONS_CIPIC 50
 #define LENGTH_BRIR_CIPIC 200
@@ -33,16 +34,31 @@ public:
   
   enum DataType {
     txt,
-    wav
+    wav,
+    pack // Binary pack (see HrtfPack); `directory` is the file path
   };
   
   /**
    Constructs a Kemar microphone opject.
    `directory` contains the hrtf database.
+   If `sampling_frequency` differs from the one of the database, the
+   database is resampled once and cached (see `ResampleDatabase`).
    */
   CipicMic(const mcl::Point& position, const mcl::Quaternion& orientation,
            const std::string& directory, const DataType data_type,
-           const Int update_length = 0);
+           const Int update_length = 0,
+           const Time sampling_frequency = 44100.0);
+  
+  /**
+   Converts the text or wav database in `directory` into a binary pack
+   file, which can then be loaded with `DataType::pack`. The database is
+   resampled to `sampling_frequency`.
+   */
+  static bool WritePack(const std::string& pack_file_path,
+                        const std::string& directory,
+                        const DataType data_type,
+                        const HrtfPack::SampleFormat sample_format = HrtfPack::kFloat32,
+                        const Time sampling_frequency = 44100.0);
   
   using BinauralMic::IsCoincident;
   using BinauralMic::num_channels;
@@ -57,9 +73,29 @@ private:
                                                 const std::string& directory,
                                                 const DataType data_type,
                                                 const std::vector<sal::Angle>& azimuths);
+  
+  /**
+   Loads both ears from a binary pack, and writes its sampling frequency in
+   `sampling_frequency`. Returns false if it fails.
+   */
+  static bool LoadPack(const std::string& file_path,
+                       std::vector<std::vector<Signal> >& hrtf_database_left,
+                       std::vector<std::vector<Signal> >& hrtf_database_right,
+                       Time& sampling_frequency);
+  
+  static std::vector<sal::Angle> GetAzimuths() noexcept;
 
   virtual Signal GetBrir(const Ear ear, const mcl::Point& point) noexcept;
   
+  virtual Time GetBrirDelay(const Ear ear, const mcl::Point& point) noexcept;
+  
+  /**
+   Writes in `azimuth_index` and `elevation_index` the indices of the
+   measurement closest to the direction of `point`.
+   */
+  void FindIndices(const mcl::Point& point, Int& azimuth_index,
+                   Int& elevation_index) const noexcept;
+  
   std::vector<sal::Angle> azimuths_;
   
 };
@@ -90,6 +90,27 @@ public:
     return (f_x_b-f_x_a)/(x_b-x_a)*(sanitised_delay_tap-x_a)+f_x_a;
   }
   
+  /**
+   Same as `FractionalReadAt`, but with third-order Lagrange interpolation
+   (on four taps), which has a flatter magnitude response than linear
+   interpolation. Below one sample of delay it falls back to linear
+   interpolation, since the tap ahead has not been written yet.
+   */
+  inline Sample LagrangeReadAt(const Time fractional_delay_tap) const noexcept {
+    if (fractional_delay_tap < 1.0) {
+      return FractionalReadAt(fractional_delay_tap);
+    }
+    Time sanitised_delay_tap = std::min(fractional_delay_tap,
+                                        (Time) (max_latency_-2));
+    Int x_b = (Int) sanitised_delay_tap; // Cast to int is equivalent to floor
+    // Position relative to the first of the taps x_b-1, x_b, x_b+1, x_b+2
+    Time d = sanitised_delay_tap - ((Time) x_b) + 1.0;
+    return - (d-1.0)*(d-2.0)*(d-3.0)/6.0*ReadAt(x_b-1)
+           + d*(d-2.0)*(d-3.0)/2.0*ReadAt(x_b)
+           - d*(d-1.0)*(d-3.0)/2.0*ReadAt(x_b+1)
+           + d*(d-1.0)*(d-2.0)/6.0*ReadAt(x_b+2);
+  }
+  
   /** This causes time to tick by one sample. */
   inline void Tick() noexcept {
     write_index_ = (write_index_ != end_) ? (write_index_+1) : start_;
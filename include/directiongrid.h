@@ -0,0 +1,94 @@
+/*
+ directiongrid.h
+ Spatial Audio Library (SAL)
+ Copyright (c) 2015, Enzo De Sena
+ All rights reserved.
+
+ Authors: Enzo De Sena, enzodesena@gmail.com
+
+ */
+
+#ifndef SAL_DIRECTIONGRID_H
+#define SAL_DIRECTIONGRID_H
+
+#include <vector>
+#include <functional>
+#include "point.h"
+#include "saltypes.h"
+
+namespace sal {
+
+/**
+ Precomputed lookup table that maps a direction of arrival to the (up to
+ four) measurements of a HRTF database surrounding it, together with their
+ interpolation weights. The directions are indexed through a cube map:
+ each face of the cube is divided into `num_cells_per_side` x
+ `num_cells_per_side` cells, and the neighbours of each cell are computed
+ once, at its centre. A lookup therefore costs a few comparisons and two
+ divisions, and does not call any trigonometric function.
+
+ The cube faces are oriented in the same reference system as the database,
+ i.e. the positive x-axis is azimuth = 0 and elevation = 0, and the positive
+ z-axis is elevation = 90 degrees.
+ */
+class DirectionGrid {
+public:
+  static const Int kMaxNumNeighbours = 4;
+
+  struct Neighbour {
+    Int row_id;
+    Int column_id;
+    Sample weight;
+  };
+
+  struct Cell {
+    Int num_neighbours;
+    Neighbour neighbours[kMaxNumNeighbours];
+  };
+
+  /**
+   Returns the measurements surrounding the direction with the given
+   `elevation` and `azimuth` (both in degrees), with weights summing to one.
+   */
+  typedef std::function<Cell(const Angle elevation,
+                             const Angle azimuth)> NeighboursFunction;
+
+  /** Constructs an empty grid. */
+  DirectionGrid() noexcept : num_cells_per_side_(0) {}
+
+  DirectionGrid(const Int num_cells_per_side,
+                const NeighboursFunction& neighbours_function);
+
+  bool IsEmpty() const noexcept { return cells_.empty(); }
+
+  Int num_cells() const noexcept { return cells_.size(); }
+
+  /**
+   Returns the id of the cell containing the direction of `point`, which does
+   not need to be normalised. The origin is conventionally mapped to the
+   cell in front (azimuth = 0 and elevation = 0).
+   */
+  Int GetCellId(const mcl::Point& point) const noexcept;
+
+  const Cell& cell(const Int cell_id) const noexcept;
+
+  /** Returns the direction (with unit norm) of the centre of a cell. */
+  mcl::Point GetCellCentre(const Int cell_id) const noexcept;
+
+  /**
+   Adds a neighbour to `cell`. Neighbours with zero weight are skipped, and
+   the weight of a measurement that is already in the cell is accumulated.
+   */
+  static void AddNeighbour(const Int row_id, const Int column_id,
+                           const Sample weight, Cell& cell) noexcept;
+
+  static bool Test();
+
+private:
+  Int num_cells_per_side_;
+  std::vector<Cell> cells_;
+};
+
+} // namespace sal
+
+#endif
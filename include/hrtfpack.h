@@ -0,0 +1,146 @@
+/*
+ hrtfpack.h
+ Spatial Audio Library (SAL)
+ Copyright (c) 2015, Enzo De Sena
+ All rights reserved.
+
+ Authors: Enzo De Sena, enzodesena@gmail.com
+
+ */
+
+#ifndef SAL_HRTFPACK_H
+#define SAL_HRTFPACK_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "saltypes.h"
+
+namespace sal {
+
+/**
+ Binary container for a HRTF database. The file is made of a fixed-size
+ header, followed by the direction grid and by the HRIRs of the left and
+ right ears. Each HRIR starts on a 64-byte boundary, so that once the file
+ is memory-mapped the HRIRs can be used in place without any parsing.
+
+ Layout (native byte order, checked through `byte_order_mark`):
+
+   HrtfPackHeader
+   HrtfPackDirection[num_directions]
+   (padding up to data_offset)
+   left-ear HRIRs, one every `stride` samples
+   right-ear HRIRs, one every `stride` samples
+
+ The grid is described as a jagged table of `num_rows` rows, which is how
+ `DatabaseBinauralMic` stores its database (e.g. elevation then azimuth for
+ the Kemar database, azimuth then elevation for the CIPIC database).
+ */
+struct HrtfPackHeader {
+  char magic[8];
+  std::uint32_t byte_order_mark;
+  std::uint32_t version;
+  std::uint32_t sample_format;
+  std::uint32_t num_rows;
+  std::uint32_t num_directions;
+  std::uint32_t num_samples;
+  std::uint32_t stride;
+  std::uint32_t reserved;
+  double sampling_frequency;
+  std::uint64_t directions_offset;
+  std::uint64_t data_offset;
+};
+
+struct HrtfPackDirection {
+  std::int32_t row_id;
+  std::int32_t column_id;
+  float elevation; // In degrees
+  float azimuth; // In degrees
+};
+
+
+class HrtfPack {
+public:
+  enum SampleFormat {
+    kFloat32 = 0,
+    kFloat64 = 1
+  };
+
+  HrtfPack() noexcept;
+
+  ~HrtfPack() noexcept { Close(); }
+
+  /**
+   Memory-maps the pack in `file_path`. Returns false (and logs an error)
+   if the file cannot be opened or if it is not a valid pack.
+   */
+  bool Open(const std::string& file_path) noexcept;
+
+  /** Unmaps the file (if any). */
+  void Close() noexcept;
+
+  bool IsOpen() const noexcept { return data_ != nullptr; }
+
+  Int num_rows() const noexcept;
+  Int num_directions() const noexcept;
+  Int num_samples() const noexcept;
+  Time sampling_frequency() const noexcept;
+  SampleFormat sample_format() const noexcept;
+
+  const HrtfPackDirection& direction(const Int direction_id) const noexcept;
+
+  /**
+   Returns a pointer to the (64-byte aligned) HRIR in the mapped file.
+   The type of the data is given by `sample_format()`.
+   */
+  const void* GetRawHrir(const Ear ear, const Int direction_id) const noexcept;
+
+  /** Copies `num_samples()` samples of the HRIR into `output_data`. */
+  void GetHrir(const Ear ear, const Int direction_id,
+               Sample* output_data) const noexcept;
+
+  /**
+   Returns the database in the jagged format used by `DatabaseBinauralMic`,
+   i.e. output[row_id][column_id].
+   */
+  std::vector<std::vector<Signal> > GetDatabase(const Ear ear) const;
+
+  /**
+   Writes a pack file. `directions` lists the measurement points, and their
+   `row_id` and `column_id` index into `hrtf_database_left` and
+   `hrtf_database_right`. HRIRs shorter than the longest one are zero padded.
+   */
+  static bool Write(const std::string& file_path,
+                    const std::vector<HrtfPackDirection>& directions,
+                    const std::vector<std::vector<Signal> >& hrtf_database_left,
+                    const std::vector<std::vector<Signal> >& hrtf_database_right,
+                    const Time sampling_frequency,
+                    const SampleFormat sample_format = kFloat32);
+
+  static bool Test();
+
+  static const std::uint32_t kVersion = 1;
+  static const std::uint32_t kByteOrderMark = 0x01020304;
+  static const Int kAlignment = 64; // In bytes
+
+private:
+  HrtfPack(const HrtfPack&) = delete;
+  HrtfPack& operator=(const HrtfPack&) = delete;
+
+  bool Validate() const noexcept;
+
+  static Int SampleSize(const SampleFormat sample_format) noexcept;
+
+  const char* data_;
+  std::uint64_t size_;
+
+  /** True if the data has been read into memory instead of mapped. */
+  bool owns_data_;
+
+  const HrtfPackHeader* header_;
+  const HrtfPackDirection* directions_;
+};
+
+} // namespace sal
+
+#endif
@@ -13,7 +13,14 @@
 #include "source.h"
 #include "delayfilter.h"
 #include "microphone.h"
-#include "firfilter.h"
+#include "partitionedconvolver.h"
+#include "sparseconvolver.h"
+#include "directiongrid.h"
+#include <array>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 namespace sal {
   
@@ -35,19 +42,260 @@ private:
   
   sal::Time peterson_window_;
   
+  /**
+   Identifies an image independently of the extent of the lattice, with
+   2m+p along the x, y and z axes (where m and p are as in
+   `CuboidRoom::ImageSourcePosition`).
+   */
+  typedef std::array<sal::Int, 3> ImageKey;
+  
+  /**
+   Images that can fall within the RIR for any position of the microphone in
+   the room, as a structure of arrays. They depend only on the room and on
+   the source, so that when only the microphone moves the RIR is
+   recalculated from these. `gains` are the reflection gains, i.e. without
+   the attenuation due to the distance; `orders` are the numbers of
+   reflections; `keys` identify the images (see `ImageKey`);
+   `random_delays` are zero without randomisation; `delays` are those for
+   the current microphone.
+   */
+  struct ImageLattice {
+    std::vector<sal::Length> x;
+    std::vector<sal::Length> y;
+    std::vector<sal::Length> z;
+    std::vector<sal::Sample> gains;
+    std::vector<sal::Int> orders;
+    std::vector<ImageKey> keys;
+    std::vector<sal::Time> random_delays;
+    std::vector<sal::Time> delays;
+  };
+  
+  /**
+   Coordinates and reflection gains of the images along one axis, for
+   m=-n,...,n and p=0,1 (at index 2*(m+n)+p). `room_distances` are the
+   distances of the coordinates from the room along the axis, and `orders`
+   the number of reflections along the axis.
+   
+   `sorted_ids` are the indexes sorted by reflection order, so that the
+   images can be enumerated shell by shell. `max_gains[q]` and
+   `min_room_distances[q]` are the largest absolute gain and the smallest
+   distance among the images from sorted_ids[q] onwards, which bound
+   all the images that have not been enumerated yet.
+   */
+  struct ImageAxis {
+    std::vector<sal::Length> coordinates;
+    std::vector<sal::Length> room_distances;
+    std::vector<sal::Sample> gains;
+    std::vector<sal::Int> orders;
+    std::vector<sal::Int> sorted_ids;
+    std::vector<sal::Sample> max_gains;
+    std::vector<sal::Length> min_room_distances;
+  };
+  
   std::vector<sal::Sample> rir_;
-  std::vector<sal::Time> images_delay_;
-  std::vector<mcl::Point> images_position_;
   
-  std::vector<sal::DelayFilter> images_int_delay_filter_;
-  std::vector<mcl::FirFilter> images_frac_delay_filter_;
+  ImageLattice lattice_;
+  mcl::Point lattice_source_position_;
+  mcl::Point rir_mic_position_;
+  
+  /**
+   Peterson's windowed sinc, tabulated at `kPetersonOversampling` phases per
+   sample: row i holds the taps k=0,...,peterson_num_taps_-1 at
+   k+i/kPetersonOversampling-W/2 samples from the centre, where W is the
+   length of the window in samples.
+   */
+  std::vector<sal::Sample> peterson_table_;
+  sal::Int peterson_num_taps_;
+  
+  /**
+   Convolves the input with rir_ in Run. The part of rir_ before the
+   crossover is convolved instead by `sparse_convolver_` as a list of taps
+   (the non-zero samples), and is zero in `dense_rir_`, which is convolved
+   by `convolver_`.
+   */
+  PartitionedConvolver convolver_;
+  std::vector<sal::Sample> convolved_;
+  sal::Time sparse_crossover_;
+  SparseConvolver sparse_convolver_;
+  std::vector<sal::Int> early_tap_delays_;
+  std::vector<sal::Sample> early_tap_gains_;
+  std::vector<sal::Sample> dense_rir_;
+  std::vector<sal::Sample> sparse_convolved_;
   
+  /**
+   Rendering for the microphones that are not omnidirectional. The early
+   images are rendered one by one from their positions, reading the last
+   inputs from `early_delay_filter_` (their ids in the lattice, slots,
+   delays in samples and attenuations are below). Each early image keeps
+   its slot, and hence its wave_id, in `early_slots_` for as long as it is
+   early, also when the lattice is calculated again; the slots of the
+   images that are no longer early are reused, so that their number is
+   bounded. The late images are clustered by
+   their direction from the microphone in the cells of `late_grid_`, each
+   with its own RIR, which is convolved and rendered from the centre of the
+   cell.
+   */
+  sal::Int early_max_order_;
+  sal::Time early_max_time_;
+  std::vector<sal::Int> early_ids_;
+  std::vector<sal::Int> early_slot_ids_;
+  std::map<ImageKey, sal::Int> early_slots_;
+  std::vector<sal::Time> early_delays_;
+  std::vector<sal::Sample> early_attenuations_;
+  DelayFilter early_delay_filter_;
+  std::vector<sal::Sample> early_signals_;
+  DirectionGrid late_grid_;
+  std::vector<std::vector<sal::Sample> > late_rirs_;
+  std::vector<PartitionedConvolver> late_convolvers_;
+  
+  /**
+   Streaming mode, with the images up to `streaming_order_` rendered as taps
+   of `early_delay_filter_`. The coordinates of an image along each axis are
+   sign*(source coordinate)+offset, with the three signs and offsets of each
+   image in `streaming_signs_` and `streaming_offsets_`, so that the images
+   are moved with the source without being calculated again. The delays (in
+   samples) and attenuations are those reached at the end of the last block,
+   from which they are ramped during the next one.
+   */
+  sal::Int streaming_order_;
+  std::vector<sal::Length> streaming_signs_;
+  std::vector<sal::Length> streaming_offsets_;
+  std::vector<sal::Sample> streaming_gains_;
+  std::vector<sal::Time> streaming_delays_;
+  std::vector<sal::Sample> streaming_attenuations_;
+  std::vector<sal::Time> streaming_delay_steps_;
+  std::vector<sal::Sample> streaming_attenuation_steps_;
+  bool is_streaming_initialised_;
+  
+  /**
+   Contributions of the chunks of the lattice to the RIR, kept between
+   calls to avoid allocating them again when the microphone moves.
+   */
+  std::vector<std::vector<sal::Sample> > chunk_rirs_;
+  
+  /**
+   Threads other than the calling one, which are started by `SetNumThreads`
+   and wait for chunks of the lattice (from `next_chunk_id_` up to
+   `num_chunks_`), so that CalculateRir does not create threads.
+   */
+  std::vector<std::thread> workers_;
+  std::mutex mutex_;
+  std::condition_variable chunks_available_;
+  std::condition_variable chunk_ready_;
+  sal::Int next_chunk_id_;
+  sal::Int num_chunks_;
+  sal::Int chunk_length_;
+  mcl::Point chunk_mic_position_;
+  std::vector<char> is_chunk_ready_;
+  bool is_stopping_;
+  
+  /**
+   Whether the lattice and the images of the streaming mode have to be
+   calculated again. They are separate, since each is cleared only by the
+   path that recalculates it.
+   */
   bool modified_;
+  bool streaming_modified_;
+  
+  sal::Int num_threads_;
+  
+  sal::Sample amplitude_threshold_;
+  sal::Int max_reflection_order_;
+  
+  void CalculateLattice();
+  
+  void CalculatePetersonTable();
   
   void CalculateRir();
   
+  /** Calculates the contribution of the chunk `chunk_id` of the lattice */
+  void CalculateChunk(const sal::Int chunk_id) noexcept;
+  
+  /** Calculates chunks of the lattice until the object is destroyed. */
+  void RunWorker() noexcept;
+  
+  void StopWorkers();
+  
+  /** Sets the filters of the convolvers of the omni microphones from rir_ */
+  void UpdateOmniConvolvers();
+  
+  /**
+   Splits the images within the RIR into early and late images for the
+   current position of the microphone. This is called after CalculateRir,
+   which calculates the delays.
+   */
+  void CalculateSpatialRirs();
+  
+  void RunSpatial(const Sample* input_data, const Int num_samples,
+                  Buffer& output_buffer);
+  
+  /** Calculates the images of the streaming mode, which depend on the room */
+  void CalculateStreamingImages();
+  
+  void RunStreaming(const Sample* input_data, const Int num_samples,
+                    Buffer& output_buffer);
+  
+  /**
+   Returns the images along an axis of length `length`, up to `n` times the
+   room, where `beta_1` and `beta_2` are the reflection coefficients of the
+   walls at 0 and at `length`. The gains are built up by multiplication
+   rather than with powers.
+   */
+  static ImageAxis CalculateImageAxis(const sal::Int n,
+                                      const sal::Length length,
+                                      const sal::Length source_coordinate,
+                                      const sal::Sample beta_1,
+                                      const sal::Sample beta_2);
+  
+  /**
+   Calculates the delays of the images of the lattice from `begin_id` to
+   `end_id` (excluded) for the microphone in `mic_position`, and writes
+   those within the RIR in `rir`.
+   */
+  void CalculateImages(const sal::Int begin_id, const sal::Int end_id,
+                       const mcl::Point& mic_position,
+                       std::vector<sal::Sample>& rir);
+  
+  /**
+   Adds the images of the lattice to the RIRs of the positions from
+   `begin_id` to `end_id` (excluded).
+   */
+  void CalculateReceiverRirs(const std::vector<mcl::Point>& positions,
+                             const sal::Int begin_id, const sal::Int end_id,
+                             std::vector<std::vector<sal::Sample> >& rirs) const;
+  
+  /**
+   Returns whether an image with (absolute) reflection gain `gain` at a
+   distance of at least `distance` is below the amplitude threshold.
+   */
+  bool IsBelowThreshold(const sal::Sample gain,
+                        const sal::Length distance) const noexcept {
+    // Same as gain/(distance/SOUND_SPEED*sampling_frequency_) < threshold,
+    // without the division, which would be by zero next to the room
+    return gain*SOUND_SPEED < amplitude_threshold_*sampling_frequency_*distance;
+  }
+  
+  /** Returns whether an image is rendered on its own by RunSpatial */
+  bool IsEarly(const sal::Int order, const sal::Time delay) const noexcept {
+    return (early_max_order_ < 0 || order <= early_max_order_) &&
+           (early_max_time_ < 0.0 || delay <= early_max_time_);
+  }
+  
+  /** Returns whether a reflection order is above the maximum */
+  bool IsAboveMaxOrder(const sal::Int order) const noexcept {
+    return max_reflection_order_ >= 0 && order > max_reflection_order_;
+  }
+  
+  /** Returns whether an image with the given delay falls within the RIR. */
+  bool IsInRir(const sal::Time delay) const noexcept {
+    // Same as checking that round(delay*sampling_frequency_) is in the RIR
+    return delay*sampling_frequency_ > -0.5 &&
+           delay*sampling_frequency_ < ((sal::Time) rir_length_)-0.5;
+  }
+  
   void WriteSample(const sal::Time& delay_norm,
-                          const sal::Sample& gid);
+                   const sal::Sample& gid,
+                   std::vector<sal::Sample>& rir) const;
 public:
   Ism(Room* const room,
       sal::Source* const source,
@@ -56,21 +304,137 @@ public:
       sal::Int rir_length,
       const sal::Time sampling_frequency);
   
+  ~Ism();
+  
   void Run(const Sample* input_data, const Int num_samples,
            Buffer& output_buffer);
   
-  // Triggers a self-update of the network. Has to be called after microphone,
-  // room or source (not including stream push) is updated.
+  // Triggers a self-update of the network. Has to be called after the room
+  // or the interpolation parameters are updated. Moving the microphone or the
+  // source is detected by Run, and when only the microphone moves the images
+  // are not calculated again.
   void Update();
   
   std::vector<sal::Sample> rir() { return rir_; }
-  std::vector<sal::Time> images_delay() { return images_delay_; }
+  
+  /**
+   Returns the delays [samples] and gains of the taps (non-zero samples) of
+   the RIR before the sparse crossover, which are convolved with
+   `SparseConvolver`. They are calculated by Run for omni microphones.
+   */
+  std::vector<sal::Int> early_tap_delays() const { return early_tap_delays_; }
+  std::vector<sal::Sample> early_tap_gains() const { return early_tap_gains_; }
+  /**
+   Returns the RIRs at each of `positions` (e.g. of the microphones of an
+   array), for the room and source of this object. The images are
+   calculated only once, and for each image the delays are calculated for
+   all the positions together. The positions are split among the threads.
+   The RIRs are the same as those of the microphone of this object in the
+   same positions, up to the rounding errors.
+   */
+  std::vector<std::vector<sal::Sample> >
+  CalculateRirs(const std::vector<mcl::Point>& positions);
+  
+  /** Returns the delays of the images within the RIR */
+  std::vector<sal::Time> images_delay() const;
   
   void SetPetersonWindow(sal::Time duration) { peterson_window_ = duration; }
   
   void SetRandomDistance(sal::Length distance) { random_distance_ = distance; }
   
+  /**
+   Sets the number of threads used to calculate the RIR. The lattice of
+   images is split in chunks, whose contributions are summed in a fixed
+   order, so that the RIR does not depend on the number of threads. The
+   threads are started here and kept until the object is destroyed.
+   */
+  void SetNumThreads(sal::Int num_threads);
+  
+  /**
+   Skips the images whose amplitude in the RIR is below `threshold` for any
+   position of the microphone in the room (e.g. 1.0E-5 for -100 dB).
+   Since the images are enumerated shell by shell, the enumeration stops as
+   soon as whole shells fall below the threshold, which happens quickly
+   with absorptive walls. Zero (the default) keeps all the images.
+   */
+  void SetAmplitudeThreshold(sal::Sample threshold) {
+    ASSERT(threshold >= 0.0);
+    amplitude_threshold_ = threshold;
+    modified_ = true;
+    streaming_modified_ = true;
+  }
+  
+  /**
+   Skips the images with more than `order` reflections. A negative value
+   (the default) keeps all the images.
+   */
+  void SetMaxReflectionOrder(sal::Int order) {
+    max_reflection_order_ = order;
+    modified_ = true;
+    streaming_modified_ = true;
+  }
+  
+  /**
+   Sets the images that microphones that are not omnidirectional (e.g.
+   binaural or ambisonics microphones) render individually, from their own
+   directions: those with up to `max_order` reflections and a delay up to
+   `max_time` [s]. A negative value removes the corresponding limit. By
+   default these are the images up to the second order.
+   */
+  void SetEarlyReflections(const sal::Int max_order, const sal::Time max_time) {
+    early_max_order_ = max_order;
+    early_max_time_ = max_time;
+    modified_ = true;
+    streaming_modified_ = true;
+  }
+  
+  /**
+   Sets the number of directions of the other (late) images, which are
+   clustered in the 6*`num_cells_per_side`^2 cells of a cube map (see
+   `DirectionGrid`). Each cell is convolved and rendered once, so that the
+   cost does not depend on the number of late images. The default is one,
+   i.e. six directions.
+   */
+  void SetLateDirectionResolution(const sal::Int num_cells_per_side);
+  
+  /**
+   Enables the streaming mode, in which Run renders only the images with up
+   to `max_order` reflections (the early reflections), as taps of a single
+   delay line of the input. Their delays and gains are updated at every
+   block as the source or the microphone move, and ramped linearly across
+   the block, so that there are no discontinuities and moving sources have
+   the Doppler effect. No RIR is calculated or convolved. The delays are
+   fractional (with linear interpolation), do not include the random
+   distance and are limited to the length of the RIR. For the microphones
+   that are not omnidirectional, each image is rendered with its own
+   direction and wave_id. A negative value (the default) disables the
+   streaming mode.
+   */
+  void SetStreamingOrder(const sal::Int max_order) {
+    streaming_order_ = max_order;
+    modified_ = true;
+    streaming_modified_ = true;
+  }
+  
+  /**
+   Sets the time [s] before which the RIR is convolved as a list of taps
+   for omni microphones, rather than with FFTs. Without interpolation, the
+   early part of the RIR has only a few isolated taps, whose cost is much
+   lower than that of the dense convolution (see
+   `SparseConvolver::SimulationTime`); with Peterson's interpolation the
+   taps are dense. Zero (the default) convolves the whole RIR with FFTs.
+   */
+  void SetSparseCrossover(const sal::Time crossover) {
+    ASSERT(crossover >= 0.0);
+    sparse_crossover_ = crossover;
+    modified_ = true;
+    streaming_modified_ = true;
+  }
+  
   static bool Test();
+  
+  /** Prints the number of images per second calculated by CalculateRir. */
+  static bool SimulationTime();
 };
   
 } // namespace sal
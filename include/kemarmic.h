@@ -23,6 +23,8 @@
 #include "array.h"
 #include "binauralmic.h"
 #include "salconstants.h"
+#include "hrtfpack.h"
+#include "directiongrid.h"
 
 namespace sal {
   
@@ -46,7 +48,8 @@ public:
     kFullDataset,
     kDirectoryCompact, // Either for "compact" directory or "diffuse" directory
     kDirectoryLeft, // Full with DB-061 (standard pinna)
-    kDirectoryRight // Full with DB-065 (large red pinna)
+    kDirectoryRight, // Full with DB-065 (large red pinna)
+    kPackFile // Binary pack (see HrtfPack); `directory` is the file path
   };
   
   /** 
@@ -54,6 +57,8 @@ public:
    `directory` contains the hrtf database.
    With `num_samples` you can choose the length of the 
    BRIR. If set to zero yields the entire BRIR.
+   If `sampling_frequency` differs from the one of the database, the
+   database is resampled once and cached (see `ResampleDatabase`).
    */
   KemarMic(const mcl::Point& position,
            const mcl::Quaternion orientation,
@@ -66,9 +71,50 @@ public:
   
   static const int kFullBrirLength = -1;
   
+  /**
+   Number of cells per side of each face of the cube map used for
+   interpolation. It is odd, so that the axes fall on cell centres.
+   */
+  static const Int kDirectionGridResolution = 45;
+  
+  /**
+   When `interpolation` is true, each BRIR is obtained by blending the (up
+   to four) measurements surrounding the direction of arrival, instead of
+   taking the nearest one. The measurements and their weights are read from
+   a precomputed direction grid (see `DirectionGrid`), so that an update
+   costs the same for any direction. Directions are quantised to the cells
+   of the grid (about two degrees wide).
+   */
+  void SetInterpolation(const bool interpolation) noexcept;
+  
+  /**
+   When `cache` is true, the blended BRIRs are stored the first time a cell
+   of the direction grid is used, so that sources that remain in (or return
+   to) a cell do not need blending again. Memory grows with the number of
+   visited cells, up to two BRIRs for each of the 6*45^2 = 12150 cells: about
+   100 MB for the full dataset (512 samples), and 25 MB for the compact one.
+   */
+  void SetBlendedBrirCache(const bool cache) noexcept;
+  
+  virtual void FilterAll(mcl::DigitalFilter* filter);
+  
+  virtual void SplitMinimumPhase(const Int num_taps = 64);
+  
   static bool IsDatabaseAvailable(const std::string directory,
                                   const DatasetType dataset_type);
   
+  /**
+   Converts the database in `directory` (or the embedded one, depending on
+   `dataset_type`) into a binary pack file, which can then be loaded with
+   `kPackFile`. The database is resampled to `sampling_frequency`, so that
+   microphones at that rate can load the pack without resampling.
+   */
+  static bool WritePack(const std::string& pack_file_path,
+                        const std::string directory,
+                        const DatasetType dataset_type,
+                        const HrtfPack::SampleFormat sample_format = HrtfPack::kFloat32,
+                        const Time sampling_frequency = 44100.0);
+  
   static void PrintParsedDatabase(const Ear ear,
                                   const std::string directory,
                                   const DatasetType dataset_type,
@@ -91,11 +137,46 @@ public:
 private:
   virtual Signal GetBrir(const Ear ear, const mcl::Point& point) noexcept;
   
+  virtual Time GetBrirDelay(const Ear ear, const mcl::Point& point) noexcept;
+  
+  /**
+   Writes in `elevation_index` and `azimuth_index` the indices of the
+   measurement closest to the direction of `point`.
+   */
+  void FindNearestIndices(const mcl::Point& point, Int& elevation_index,
+                          Int& azimuth_index) noexcept;
+  
+  /** Returns the measurements surrounding the given direction (in degrees) */
+  static DirectionGrid::Cell GetNeighbours(const Angle elevation,
+                                           const Angle azimuth) noexcept;
+  
+  /** Returns the cell of the direction grid containing `point` */
+  Int GetCellId(const mcl::Point& point) const noexcept;
+  
+  /** Returns the weighted sum of the entries of `hrtf_database` in `cell` */
+  static Signal Blend(const std::vector<std::vector<Signal> >& hrtf_database,
+                      const DirectionGrid::Cell& cell) noexcept;
+  
+  void ClearBlendedBrirCache() noexcept;
+  
   static
   std::vector<std::vector<Signal> > Load(const Ear ear,
                                          const std::string directory,
                                          const DatasetType dataset_type);
   
+  /**
+   Loads both ears from a binary pack, and writes its sampling frequency in
+   `sampling_frequency`. Returns false if it fails.
+   */
+  static bool LoadPack(const std::string file_path,
+                       std::vector<std::vector<Signal> >& hrtf_database_left,
+                       std::vector<std::vector<Signal> >& hrtf_database_right,
+                       Time& sampling_frequency);
+  
+  /** Returns the key of the database in the cache of resampled databases */
+  static std::string GetDatabaseId(const std::string directory,
+                                   const DatasetType dataset_type) noexcept;
+  
   static std::vector<std::vector<Signal> > LoadEmbedded(const Ear ear,
                                                         const DatasetType dataset_type);
   
@@ -126,6 +207,13 @@ private:
   Array<mcl::Int, NUM_ELEVATIONS_KEMAR> num_measurements_;
   Array<mcl::Int, NUM_ELEVATIONS_KEMAR> elevations_;
   
+  bool interpolation_;
+  DirectionGrid direction_grid_;
+  
+  bool blended_brir_cache_;
+  std::vector<Signal> blended_brirs_left_;
+  std::vector<Signal> blended_brirs_right_;
+  
   static std::string GetFilePath(const Angle elevation, const Angle angle,
                                  const std::string directory,
                                  const DatasetType dataset_type) noexcept;
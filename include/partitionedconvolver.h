@@ -0,0 +1,121 @@
+/*
+ partitionedconvolver.h
+ Spatial Audio Library (SAL)
+ Copyright (c) 2015, Enzo De Sena
+ All rights reserved.
+
+ Authors: Enzo De Sena, enzodesena@gmail.com
+
+ */
+
+#ifndef SAL_PARTITIONEDCONVOLVER_H
+#define SAL_PARTITIONEDCONVOLVER_H
+
+#include <vector>
+#include <complex>
+#include "saltypes.h"
+
+namespace sal {
+
+/**
+ Convolves a signal with a long filter (e.g. a RIR), with no latency and a
+ cost per sample that grows only with the logarithm of the length of the
+ filter. The first `head_length` taps are convolved directly. The rest of
+ the filter is split into partitions that become four times longer every
+ three partitions, up to `max_partition_length` (non-uniform partitioning).
+ The partitions of each length are convolved with uniformly-partitioned
+ overlap-save, which runs once every partition length: since each
+ partition starts at least one partition length into the filter, its
+ output is only needed in the future, and is written ahead in a ring.
+
+ The partitions that are all zeros (e.g. the beginning of a RIR whose
+ early part is convolved separately) are skipped, and so are the inverse
+ transforms of the levels with only zero partitions.
+
+ Nothing is allocated after construction, including by `SetFilter`.
+ */
+class PartitionedConvolver {
+public:
+  /**
+   `head_length` and `max_partition_length` have to be powers of two, with
+   `max_partition_length` at least `head_length`.
+   */
+  PartitionedConvolver(const std::vector<Sample>& filter,
+                       const Int head_length = 64,
+                       const Int max_partition_length = 4096);
+
+  /**
+   Changes the filter, which cannot be longer than the one given at
+   construction, without resetting the input. The output that has already
+   been calculated (up to one partition ahead) is still from the previous
+   filter.
+   */
+  void SetFilter(const std::vector<Sample>& filter) noexcept;
+
+  /** Filters `num_samples` samples of `input_data` into `output_data` */
+  void Filter(const Sample* input_data, const Int num_samples,
+              Sample* output_data) noexcept;
+
+  void Reset() noexcept;
+
+  static bool Test();
+
+private:
+  typedef std::complex<Sample> Complex;
+
+  struct FftPlan {
+    Int size;
+    std::vector<Int> bit_reversal;
+    /** exp(-2 pi i k/size) for k=0,...,size/2-1 */
+    std::vector<Complex> twiddles;
+  };
+
+  /** Partitions of the same length, convolved with overlap-save */
+  struct Level {
+    Int partition_length;
+    /** Tap of the filter where the first partition starts */
+    Int offset;
+    FftPlan plan;
+    /** Spectra (of length 2*partition_length) of the partitions */
+    std::vector<std::vector<Complex> > filter_spectra;
+    /** Spectra of the last inputs, as a ring with the latest in `latest` */
+    std::vector<std::vector<Complex> > input_spectra;
+    Int latest;
+    /** Whether each partition is all zeros, and whether they all are */
+    std::vector<bool> is_partition_zero;
+    bool is_zero;
+  };
+
+  static FftPlan CreateFftPlan(const Int size);
+
+  /** In-place radix-2 FFT. The inverse is not scaled. */
+  static void Transform(const FftPlan& plan, const bool inverse,
+                        Complex* data) noexcept;
+
+  /** Convolves the last inputs with the partitions of `level` */
+  void ProcessLevel(Level& level) noexcept;
+
+  Int filter_length_;
+  Int head_length_;
+  std::vector<Sample> head_filter_;
+  bool is_head_zero_;
+  /** The last head_length_-1 inputs followed by the current block */
+  std::vector<Sample> head_buffer_;
+
+  std::vector<Level> levels_;
+
+  /** The last inputs, at time & input_mask_ */
+  std::vector<Sample> input_ring_;
+  Int input_mask_;
+  /** The output of the levels, at time & output_mask_ */
+  std::vector<Sample> output_ring_;
+  Int output_mask_;
+  std::vector<Complex> accumulator_;
+
+  /** Number of samples filtered so far */
+  Int time_;
+};
+
+} // namespace sal
+
+#endif
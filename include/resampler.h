@@ -0,0 +1,64 @@
+/*
+ resampler.h
+ Spatial Audio Library (SAL)
+ Copyright (c) 2015, Enzo De Sena
+ All rights reserved.
+
+ Authors: Enzo De Sena, enzodesena@gmail.com
+
+ */
+
+#ifndef SAL_RESAMPLER_H
+#define SAL_RESAMPLER_H
+
+#include <vector>
+#include "saltypes.h"
+
+namespace sal {
+
+/**
+ Polyphase resampler by a rational factor `up_factor()`/`down_factor()`,
+ obtained from the ratio of the (integer) sampling frequencies. The
+ anti-aliasing filter is a Kaiser-windowed sinc with cutoff at
+ `rolloff` times the lowest of the two Nyquist frequencies. Only the
+ `up_factor()` phases of the filter that are actually used are stored,
+ each `2*half_length()` taps long.
+
+ The resampler is meant for offline use (e.g. on HRTF databases at load
+ time): `Run` processes a whole signal and compensates the delay of the
+ filter, so that an impulse at time t in the input is at time t also in
+ the output.
+ */
+class Resampler {
+public:
+  Resampler(const Time input_sampling_frequency,
+            const Time output_sampling_frequency,
+            const Int num_zero_crossings = 32,
+            const Sample rolloff = 0.95);
+
+  Int up_factor() const noexcept { return up_factor_; }
+  Int down_factor() const noexcept { return down_factor_; }
+  Int half_length() const noexcept { return half_length_; }
+
+  /** Returns the length of the output for an input `input_length` long */
+  Int GetOutputLength(const Int input_length) const noexcept;
+
+  Signal Run(const Signal& input) const noexcept;
+
+  static bool Test();
+
+private:
+  /** Zero-order modified Bessel function of the first kind */
+  static Sample BesselI0(const Sample x) noexcept;
+
+  Int up_factor_;
+  Int down_factor_;
+  Int half_length_;
+
+  /** coefficients_[phase][tap] */
+  std::vector<std::vector<Sample> > coefficients_;
+};
+
+} // namespace sal
+
+#endif
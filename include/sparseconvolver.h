@@ -0,0 +1,74 @@
+/*
+ sparseconvolver.h
+ Spatial Audio Library (SAL)
+ Copyright (c) 2015, Enzo De Sena
+ All rights reserved.
+
+ Authors: Enzo De Sena, enzodesena@gmail.com
+
+ */
+
+#ifndef SAL_SPARSECONVOLVER_H
+#define SAL_SPARSECONVOLVER_H
+
+#include <vector>
+#include "saltypes.h"
+
+namespace sal {
+
+/**
+ Convolves a signal with a sparse filter, given as a list of taps (delay in
+ samples and gain), e.g. the early part of a RIR without interpolation.
+ The output is the sum of the delayed and scaled copies of the input, read
+ from a ring buffer, so that the cost per sample is the number of taps
+ rather than the length of the filter.
+
+ Nothing is allocated after construction, including by `SetTaps` as long as
+ there are at most `max_num_taps` taps.
+ */
+class SparseConvolver {
+public:
+  /** `max_delay` is the largest delay [samples] of the taps */
+  SparseConvolver(const Int max_delay, const Int max_num_taps);
+
+  /**
+   Changes the taps, without resetting the input. `delays` and `gains` have
+   to have the same length, and the delays cannot be larger than
+   `max_delay`.
+   */
+  void SetTaps(const std::vector<Int>& delays,
+               const std::vector<Sample>& gains) noexcept;
+
+  /** Filters `num_samples` samples of `input_data` into `output_data` */
+  void Filter(const Sample* input_data, const Int num_samples,
+              Sample* output_data) noexcept;
+
+  void Reset() noexcept;
+
+  Int num_taps() const noexcept { return delays_.size(); }
+
+  static bool Test();
+
+  /**
+   Prints the time it takes to filter with this object and with
+   `PartitionedConvolver` the first 100 ms of a RIR, as a function of the
+   density of the taps.
+   */
+  static bool SimulationTime();
+
+private:
+  Int max_delay_;
+  std::vector<Int> delays_;
+  std::vector<Sample> gains_;
+
+  /** The last inputs, at time & input_mask_ */
+  std::vector<Sample> input_ring_;
+  Int input_mask_;
+
+  /** Number of samples filtered so far */
+  Int time_;
+};
+
+} // namespace sal
+
+#endif
@@ -15,6 +15,9 @@
 #include "saltypes.h"
 #include "kemarmic.h"
 #include <map>
+#include <mutex>
+#include <atomic>
+#include <memory>
 #include "salconstants.h"
 
 namespace sal {
@@ -32,13 +35,46 @@ public:
                    const Time sampling_frequency,
                    const Int update_length = 0);
   
+  /**
+   Enables a table of HRIRs precomputed on a grid of `num_thetas` angles,
+   uniformly spaced between 0 and PI, and `num_distances` distances,
+   logarithmically spaced between `min_distance` and `max_distance`.
+   The HRIRs are then obtained by bilinear interpolation (in angle and
+   log-distance) of the four surrounding entries of the table, and
+   distances outside of the grid are clamped to it. The entries are
+   computed the first time they are needed (in a thread-safe way), unless
+   `precompute` is true, in which case they are all computed here.
+   Copies of the microphone share the same table.
+   */
+  void SetHrirTable(const Int num_thetas = 181,
+                    const Length min_distance = 0.2,
+                    const Length max_distance = 10.0,
+                    const Int num_distances = 12,
+                    const bool precompute = false);
+  
+  /** Goes back to computing every HRIR from the series. */
+  void ClearHrirTable() noexcept { hrir_table_.reset(); }
+  
   static bool Test();
   
   virtual ~SphericalHeadMic() {}
 private:
+  struct HrirTable {
+    Int num_thetas;
+    std::vector<Length> distances;
+    /** hrirs[distance_id*num_thetas+theta_id] */
+    std::vector<Signal> hrirs;
+    std::unique_ptr<std::atomic<bool>[]> filled;
+    /** Serialises the computation of the missing entries. */
+    std::mutex mutex;
+  };
   
   virtual Signal GetBrir(const Ear ear, const mcl::Point& point) noexcept;
   
+  /** Returns an entry of the table, computing it if it is missing. */
+  const Signal& GetTableHrir(const Int distance_id,
+                             const Int theta_id) noexcept;
+  
   /** For the various definitions see Duda's paper. */
   static mcl::Complex Sphere(Length a, Length r, Angle theta,
                              Time f, Time c, mcl::Real threshold);
@@ -91,6 +127,9 @@ private:
   /** This is the threshold of the sphere algorithm. */
   mcl::Real alg_threshold_;
   
+  /** Table of precomputed HRIRs (empty if the table is not enabled). */
+  std::shared_ptr<HrirTable> hrir_table_;
+  
 };
   
 } // namespace sal
@@ -0,0 +1,129 @@
+/*
+ structuralheadmic.h
+ Spatial Audio Library (SAL)
+ Copyright (c) 2015, Enzo De Sena
+ All rights reserved.
+
+ Authors: Enzo De Sena, enzodesena@gmail.com
+
+ */
+
+#ifndef SAL_STRUCTURALHEADMIC_H
+#define SAL_STRUCTURALHEADMIC_H
+
+#include <map>
+#include <vector>
+#include "microphone.h"
+#include "delayfilter.h"
+#include "saltypes.h"
+#include "salconstants.h"
+
+namespace sal {
+
+/**
+ This object implements the structural model of the head proposed by Brown
+ and Duda in the article "A structural model for binaural sound synthesis".
+ Each ear is rendered with a one-pole/one-zero head-shadow filter, whose
+ zero depends in closed form on the angle between the source and the ear,
+ and with the Woodworth delay of the propagation around a sphere. This is
+ a low-cost alternative to `SphericalHeadMic` and to the database
+ microphones: per source it costs a few operations per sample, instead of
+ one convolution with a BRIR per ear.
+
+ Both the filter coefficients and the delays are ramped linearly across
+ each block when the source moves, so that there are no discontinuities.
+ */
+class StructuralHeadMic : public StereoMicrophone {
+public:
+  /**
+   `ears_angle` is the angle formed between the facing direction and the
+   ears [rad]; `sphere_radius` is the radius of the head in [m].
+   */
+  StructuralHeadMic(const mcl::Point& position,
+                    const mcl::Quaternion& orientation,
+                    const Angle ears_angle = 100.0/180.0*PI,
+                    const Length sphere_radius = 0.0875,
+                    const Time sampling_frequency = 44100.0,
+                    const Length sound_speed = SOUND_SPEED);
+
+  virtual void Reset() noexcept;
+
+  bool IsCoincident() const noexcept { return true; }
+
+  Int num_channels() const noexcept { return 2; }
+
+  virtual void AddPlaneWaveRelative(const Sample* input_data,
+                                    const Int num_samples,
+                                    const mcl::Point& point,
+                                    const Int wave_id,
+                                    Buffer& output_buffer) noexcept;
+
+  /**
+   Returns the zero coefficient (alpha in Brown and Duda's article) of the
+   head-shadow filter, as a function of the angle between the source and
+   the ear `theta` [rad].
+   */
+  static Sample GetShadowCoefficient(const Angle theta) noexcept;
+
+  /**
+   Returns the Woodworth delay [s] of a plane wave with angle `theta` [rad]
+   from the ear, offset by `sphere_radius`/`sound_speed`, so that it is
+   never negative.
+   */
+  static Time GetWoodworthDelay(const Angle theta,
+                                const Length sphere_radius,
+                                const Length sound_speed) noexcept;
+
+  static bool Test();
+
+  /**
+   Returns the time [s] it takes to render a source for one minute, both
+   with this microphone and with `KemarMic`.
+   */
+  static bool SimulationTime();
+
+  virtual ~StructuralHeadMic() {}
+
+private:
+  struct EarState {
+    Sample alpha;
+    Time delay;
+    Sample previous_input;
+    Sample previous_output;
+  };
+
+  struct Instance {
+    /** Shared by the two ears, which read it at different taps. */
+    DelayFilter delay_filter;
+    EarState ears[2];
+    bool initialised;
+  };
+
+  /** Angle between the direction of `point` and the ear. */
+  Angle GetTheta(const mcl::Point& point, const Ear ear) const noexcept;
+
+  void CreateInstanceIfNotExist(const Int wave_id) noexcept;
+
+  Angle ears_angle_;
+  Length sphere_radius_;
+  Time sampling_frequency_;
+  Length sound_speed_;
+
+  /**
+   Coefficients of the bilinear transform of the head-shadow filter
+   H(s) = (alpha s + beta)/(s + beta), with beta = 2 c/a. The pole does not
+   depend on the direction, and the zero is linear in alpha, so that
+   b0 = b0_offset_ + b0_slope_ alpha and b1 = b1_offset_ + b1_slope_ alpha.
+   */
+  Sample a1_;
+  Sample b0_offset_;
+  Sample b0_slope_;
+  Sample b1_offset_;
+  Sample b1_slope_;
+
+  std::map<UInt, Instance> instances_;
+};
+
+} // namespace sal
+
+#endif
@@ -13,6 +13,7 @@
 
 #include "ambisonics.h"
 #include "matrixop.h"
+#include <algorithm>
 
 using mcl::Point;
 using mcl::Multiply;
@@ -46,41 +47,76 @@ void AmbisonicsMic::AddPlaneWaveRelative(const Sample* input_data,
       break;
     }
       
-#if MCL_LOAD_BOOST
     case Sn3d:
     case N3d: {
-      // Precompute for performance gain
-      const Angle theta = point.theta();
-      const Sample sqrt_4pi = mcl::Sqrt(4.0*PI);
+      // Waves with a lower level of detail only touch their first
+      // (order+1)^2 channels. When the order of a wave changes, the
+      // components between the previous and the new order are faded in or
+      // out across the block.
+      const Int target_order = GetWaveOrder(wave_id, point.norm());
+      Int previous_order = target_order;
+      if (target_order != order_ || current_orders_.count(wave_id) > 0) {
+        auto iterator = current_orders_.find(wave_id);
+        if (iterator == current_orders_.end()) {
+          current_orders_.insert(std::make_pair(wave_id, target_order));
+        } else {
+          previous_order = iterator->second;
+          iterator->second = target_order;
+        }
+      }
+      const Int low_order = std::min(previous_order, target_order);
+      const Int high_order = std::max(previous_order, target_order);
       
-      // Zero-th component
-      output_buffer.AddSamples(HoaBuffer::GetChannelId(0, 0, ordering_convention_), 0, num_samples, input_data);
+      GetSphericalHarmonics(high_order, point, normalisation_convention_,
+                            gains_.data());
+      for (Int order_n=0; order_n<=high_order; ++order_n) {
+        for (Int degree_m=-order_n; degree_m<=order_n; ++degree_m) {
+          output_pointers_[order_n*order_n+order_n+degree_m] =
+              output_buffer.GetWritePointer(HoaBuffer::GetChannelId(order_n,
+                  degree_m, ordering_convention_));
+        }
+      }
       
-      for (Int order_n=1; order_n<=order_; ++order_n) {
-        for (Int degree_m=0; degree_m<=order_n; ++degree_m) {
-          
-          mcl::Complex spherical_harmonic = mcl::SphericalHarmonic(order_n, (mcl::Int) mcl::Abs(degree_m), theta, phi);
-          mcl::Complex normalisation = mcl::Pow(-1.0, (mcl::Real) degree_m) *
-                (degree_m==0 ? 1.0 : sqrt_2) *
-                sqrt_4pi; // This is N3d normalisation
-          
-          if (normalisation_convention_ == Sn3d) {
-            normalisation = normalisation / sqrt(2.0*((mcl::Real) order_n)+1.0);
-          }
-          
-          mcl::Complex weight = spherical_harmonic * normalisation;
-          
-          output_buffer.MultiplyAddSamples(HoaBuffer::GetChannelId(order_n, -degree_m, ordering_convention_), 0, num_samples, input_data, mcl::ImagPart(weight));
-          output_buffer.MultiplyAddSamples(HoaBuffer::GetChannelId(order_n, degree_m, ordering_convention_), 0, num_samples, input_data, mcl::RealPart(weight));
-          
-          // The order of the two statements above is not random, since the case
-          // degree_m equals zero should give back the non-zero cosine term,
-          // i.e. the one corresponding to the real part.
+      // Channels are processed four at a time, so that each input sample
+      // is loaded once for four channels.
+      const Int num_channels = (low_order+1)*(low_order+1);
+      Int channel_id = 0;
+      for (; channel_id+4<=num_channels; channel_id+=4) {
+        Sample* output_0 = output_pointers_[channel_id];
+        Sample* output_1 = output_pointers_[channel_id+1];
+        Sample* output_2 = output_pointers_[channel_id+2];
+        Sample* output_3 = output_pointers_[channel_id+3];
+        const Sample gain_0 = gains_[channel_id];
+        const Sample gain_1 = gains_[channel_id+1];
+        const Sample gain_2 = gains_[channel_id+2];
+        const Sample gain_3 = gains_[channel_id+3];
+        for (Int i=0; i<num_samples; ++i) {
+          const Sample input_sample = input_data[i];
+          output_0[i] += gain_0*input_sample;
+          output_1[i] += gain_1*input_sample;
+          output_2[i] += gain_2*input_sample;
+          output_3[i] += gain_3*input_sample;
+        }
+      }
+      for (; channel_id<num_channels; ++channel_id) {
+        Sample* output = output_pointers_[channel_id];
+        const Sample gain = gains_[channel_id];
+        for (Int i=0; i<num_samples; ++i) { output[i] += gain*input_data[i]; }
+      }
+      
+      // Fading (reaching the new order at the end of the block)
+      const bool fade_in = target_order > previous_order;
+      const Sample step = 1.0/((Sample) num_samples);
+      for (; channel_id<(high_order+1)*(high_order+1); ++channel_id) {
+        Sample* output = output_pointers_[channel_id];
+        const Sample gain = gains_[channel_id];
+        for (Int i=0; i<num_samples; ++i) {
+          const Sample weight = ((Sample) (i+1))*step;
+          output[i] += gain*(fade_in ? weight : 1.0-weight)*input_data[i];
         }
       }
       break;
     }
-#endif
     case Fuma:
     default: {
       ASSERT(false);
@@ -89,6 +125,103 @@ void AmbisonicsMic::AddPlaneWaveRelative(const Sample* input_data,
   }
 }
 
+void AmbisonicsMic::SetWaveOrder(const Int wave_id, const Int order) noexcept {
+  ASSERT(order >= 0 && order <= order_);
+  wave_orders_[wave_id] = order;
+}
+  
+  
+void AmbisonicsMic::ClearWaveOrder(const Int wave_id) noexcept {
+  wave_orders_.erase(wave_id);
+}
+  
+  
+void AmbisonicsMic::SetLevelOfDetail(const Length full_order_distance,
+                                     const Int min_order) noexcept {
+  ASSERT(full_order_distance >= 0.0);
+  ASSERT(min_order >= 0 && min_order <= order_);
+  full_order_distance_ = full_order_distance;
+  min_order_ = min_order;
+}
+  
+  
+Int AmbisonicsMic::GetLevelOfDetailOrder(const Int order, const Int min_order,
+                                         const Length full_order_distance,
+                                         const Length distance) noexcept {
+  if (distance <= full_order_distance) { return order; }
+  const Int num_doublings = (Int) floor(log2(distance/full_order_distance));
+  return std::max(min_order, order-num_doublings);
+}
+  
+  
+Int AmbisonicsMic::GetWaveOrder(const Int wave_id,
+                                const Length distance) const noexcept {
+  if (! wave_orders_.empty()) {
+    auto iterator = wave_orders_.find(wave_id);
+    if (iterator != wave_orders_.end()) { return iterator->second; }
+  }
+  if (full_order_distance_ > 0.0) {
+    return GetLevelOfDetailOrder(order_, min_order_, full_order_distance_,
+                                 distance);
+  }
+  return order_;
+}
+  
+  
+void AmbisonicsMic::GetSphericalHarmonics(const Int order,
+                                          const Point& point,
+                                          const HoaNormalisation normalisation,
+                                          Sample* output) noexcept {
+  ASSERT(order >= 0);
+  ASSERT(normalisation == N3d || normalisation == Sn3d);
+  
+  const Length norm = point.norm();
+  // The origin is conventionally mapped to the front
+  const Sample x = (norm > 0.0) ? point.x()/norm : 1.0;
+  const Sample y = (norm > 0.0) ? point.y()/norm : 0.0;
+  const Sample z = (norm > 0.0) ? point.z()/norm : 0.0;
+  const Sample sin_theta = sqrt(x*x+y*y); // theta is the polar angle
+  const Sample cos_phi = (sin_theta > 0.0) ? x/sin_theta : 1.0;
+  const Sample sin_phi = (sin_theta > 0.0) ? y/sin_theta : 0.0;
+  
+  // p_m_m is the associated Legendre function of order and degree m,
+  // normalised by sqrt((2n+1)(n-m)!/(n+m)!), without the Condon-Shortley
+  // phase. cos_m_phi and sin_m_phi are cos(m phi) and sin(m phi).
+  Sample p_m_m = 1.0;
+  Sample cos_m_phi = 1.0;
+  Sample sin_m_phi = 0.0;
+  for (Int m=0; m<=order; ++m) {
+    if (m > 0) {
+      p_m_m *= sqrt(((Sample) (2*m+1))/((Sample) (2*m)))*sin_theta;
+      const Sample cos_previous = cos_m_phi;
+      cos_m_phi = cos_previous*cos_phi - sin_m_phi*sin_phi;
+      sin_m_phi = sin_m_phi*cos_phi + cos_previous*sin_phi;
+    }
+    const Sample gain_cos = (m == 0) ? 1.0 : sqrt(2.0)*cos_m_phi;
+    const Sample gain_sin = sqrt(2.0)*sin_m_phi;
+    
+    Sample p_n_m = p_m_m; // Degree n = m
+    Sample p_n_1_m = 0.0; // Degree n-1
+    for (Int n=m; n<=order; ++n) {
+      if (n > m) {
+        const Sample n_s = (Sample) n;
+        const Sample m_s = (Sample) m;
+        const Sample a = sqrt((4.0*n_s*n_s-1.0)/(n_s*n_s-m_s*m_s));
+        const Sample b = sqrt(((n_s-1.0)*(n_s-1.0)-m_s*m_s)/
+                              (4.0*(n_s-1.0)*(n_s-1.0)-1.0));
+        const Sample p_next = a*(z*p_n_m - b*p_n_1_m);
+        p_n_1_m = p_n_m;
+        p_n_m = p_next;
+      }
+      const Sample p = (normalisation == Sn3d) ?
+          p_n_m/sqrt((Sample) (2*n+1)) : p_n_m;
+      output[n*n+n+m] = p*gain_cos;
+      if (m > 0) { output[n*n+n-m] = p*gain_sin; }
+    }
+  }
+}
+  
+  
 std::vector<mcl::Real> AmbisonicsMic::HorizontalEncoding(Int order,
                                                          Angle theta) {
   std::vector<mcl::Real> output;
@@ -101,6 +234,142 @@ std::vector<mcl::Real> AmbisonicsMic::HorizontalEncoding(Int order,
   return output;
 }
   
+const Int AmbisonicsBatchEncoder::kChannelBlock;
+const Int AmbisonicsBatchEncoder::kTileLength;
+  
+  
+AmbisonicsBatchEncoder::AmbisonicsBatchEncoder(const Int order,
+                                               const Int num_sources,
+                                               const HoaNormalisation normalisation,
+                                               const HoaOrdering ordering) :
+        order_(order), num_sources_(num_sources),
+        num_channels_(HoaBuffer::GetNumChannels(order)),
+        num_padded_channels_((num_channels_+kChannelBlock-1)/kChannelBlock*
+                             kChannelBlock),
+        normalisation_(normalisation),
+        channel_ids_(num_channels_),
+        current_gains_(num_padded_channels_*num_sources, 0.0),
+        target_gains_(num_padded_channels_*num_sources, 0.0),
+        initialised_(num_sources, false),
+        steps_(num_padded_channels_*num_sources, 0.0),
+        harmonics_(num_channels_) {
+  ASSERT(num_sources > 0);
+  ASSERT(normalisation == N3d || normalisation == Sn3d);
+  for (Int n=0; n<=order; ++n) {
+    for (Int m=-n; m<=n; ++m) {
+      channel_ids_[n*n+n+m] = HoaBuffer::GetChannelId(n, m, ordering);
+    }
+  }
+}
+  
+  
+void AmbisonicsBatchEncoder::SetSourceDirection(const Int source_id,
+                                                const Point& direction) noexcept {
+  ASSERT(source_id >= 0 && source_id < num_sources_);
+  AmbisonicsMic::GetSphericalHarmonics(order_, direction, normalisation_,
+                                       harmonics_.data());
+  for (Int acn_id=0; acn_id<num_channels_; ++acn_id) {
+    target_gains_[acn_id*num_sources_+source_id] = harmonics_[acn_id];
+  }
+  if (! initialised_[source_id]) {
+    for (Int acn_id=0; acn_id<num_channels_; ++acn_id) {
+      current_gains_[acn_id*num_sources_+source_id] = harmonics_[acn_id];
+    }
+    initialised_[source_id] = true;
+  }
+}
+  
+  
+void AmbisonicsBatchEncoder::Encode(const Buffer& input_buffer,
+                                    Buffer& output_buffer) noexcept {
+  ASSERT(input_buffer.num_channels() == num_sources_);
+  ASSERT(output_buffer.num_channels() >= num_channels_);
+  ASSERT(input_buffer.num_samples() == output_buffer.num_samples());
+  const Int num_samples = input_buffer.num_samples();
+  if (num_samples == 0) { return; }
+  
+  // The gain of sample i is current_gains_ + (i+1)*steps_. The ramp is
+  // accumulated separately, and skipped when no source is moving.
+  bool ramping = false;
+  for (Int k=0; k<(Int) steps_.size(); ++k) {
+    steps_[k] = (target_gains_[k]-current_gains_[k])/((Sample) num_samples);
+    ramping = ramping || (steps_[k] != 0.0);
+  }
+  
+  // The accumulators are local, so that the compiler knows that they do not
+  // alias the inputs
+  Sample accumulators[kChannelBlock][kTileLength];
+  Sample ramp_accumulators[kChannelBlock][kTileLength];
+  for (Int tile_start=0; tile_start<num_samples; tile_start+=kTileLength) {
+    const Int tile_length = std::min(kTileLength, num_samples-tile_start);
+    for (Int block_start=0; block_start<num_channels_;
+         block_start+=kChannelBlock) {
+      for (Int k=0; k<kChannelBlock; ++k) {
+        std::fill(accumulators[k], accumulators[k]+tile_length, 0.0);
+        if (ramping) {
+          std::fill(ramp_accumulators[k], ramp_accumulators[k]+tile_length,
+                    0.0);
+        }
+      }
+      
+      const Sample* gains = &current_gains_[block_start*num_sources_];
+      const Sample* steps = &steps_[block_start*num_sources_];
+      for (Int source_id=0; source_id<num_sources_; ++source_id) {
+        const Sample* input_data =
+            input_buffer.GetReadPointer(source_id)+tile_start;
+        const Sample gain_0 = gains[source_id];
+        const Sample gain_1 = gains[num_sources_+source_id];
+        const Sample gain_2 = gains[2*num_sources_+source_id];
+        const Sample gain_3 = gains[3*num_sources_+source_id];
+        if (! ramping) {
+          for (Int i=0; i<tile_length; ++i) {
+            const Sample input_sample = input_data[i];
+            accumulators[0][i] += gain_0*input_sample;
+            accumulators[1][i] += gain_1*input_sample;
+            accumulators[2][i] += gain_2*input_sample;
+            accumulators[3][i] += gain_3*input_sample;
+          }
+        } else {
+          const Sample step_0 = steps[source_id];
+          const Sample step_1 = steps[num_sources_+source_id];
+          const Sample step_2 = steps[2*num_sources_+source_id];
+          const Sample step_3 = steps[3*num_sources_+source_id];
+          for (Int i=0; i<tile_length; ++i) {
+            const Sample input_sample = input_data[i];
+            accumulators[0][i] += gain_0*input_sample;
+            accumulators[1][i] += gain_1*input_sample;
+            accumulators[2][i] += gain_2*input_sample;
+            accumulators[3][i] += gain_3*input_sample;
+            ramp_accumulators[0][i] += step_0*input_sample;
+            ramp_accumulators[1][i] += step_1*input_sample;
+            ramp_accumulators[2][i] += step_2*input_sample;
+            ramp_accumulators[3][i] += step_3*input_sample;
+          }
+        }
+      }
+      
+      const Int block_length = std::min(kChannelBlock,
+                                        num_channels_-block_start);
+      for (Int k=0; k<block_length; ++k) {
+        Sample* output_data = output_buffer.GetWritePointer(
+            channel_ids_[block_start+k])+tile_start;
+        for (Int i=0; i<tile_length; ++i) {
+          output_data[i] += accumulators[k][i];
+        }
+        if (ramping) {
+          for (Int i=0; i<tile_length; ++i) {
+            output_data[i] += ((Sample) (tile_start+i+1))*
+                ramp_accumulators[k][i];
+          }
+        }
+      }
+    }
+  }
+  
+  current_gains_ = target_gains_;
+}
+  
+  
 AmbisonicsHorizDec::AmbisonicsHorizDec(const Int order,
                                        const bool energy_decoding,
                                        const Time cut_off_frequency,
@@ -159,6 +428,26 @@ AmbisonicsHorizDec::AmbisonicsHorizDec(const Int order,
   
   mode_matching_matrix_ = ModeMatchingDec(order_, loudspeaker_angles_);
   max_energy_matrix_ = MaxEnergyDec(order_, loudspeaker_angles_);
+  
+  const Int num_components = 2*order+1;
+  channel_ids_.push_back(HoaBuffer::GetChannelId(0, 0, ordering_convention_));
+  for (Int i=1; i<=order; ++i) {
+    channel_ids_.push_back(HoaBuffer::GetChannelId(i, 1, ordering_convention_));
+    channel_ids_.push_back(HoaBuffer::GetChannelId(i, -1, ordering_convention_));
+  }
+  component_data_.resize(num_components);
+  
+  const mcl::Matrix<Sample> high_matrix = mcl::Multiply(mode_matching_matrix_,
+                                                        max_energy_matrix_);
+  low_decoding_rows_.resize(num_loudspeakers_*num_components);
+  high_decoding_rows_.resize(num_loudspeakers_*num_components);
+  for (Int i=0; i<num_loudspeakers_; ++i) {
+    for (Int j=0; j<num_components; ++j) {
+      low_decoding_rows_[i*num_components+j] =
+          mode_matching_matrix_.GetElement(i, j);
+      high_decoding_rows_[i*num_components+j] = high_matrix.GetElement(i, j);
+    }
+  }
 }
   
   
@@ -197,23 +486,30 @@ mcl::Matrix<Sample> AmbisonicsHorizDec::MaxEnergyDec(Int order,
   return decoding_matrix;
 }
   
-std::vector<Sample>
-AmbisonicsHorizDec::GetFrame(const Int order, const Int sample_id,
-                             const Buffer& buffer) {
-  ASSERT(order>=0);
-  ASSERT(sample_id>=0 & sample_id<buffer.num_samples());
-  
-  std::vector<Sample> output;
-  output.reserve(2*order+1);
-  output.push_back(buffer.GetSample(HoaBuffer::GetChannelId(0, 0, ordering_convention_),
-                                    sample_id));
-  for (Int i=1; i<=order; ++i) {
-    output.push_back(buffer.GetSample(HoaBuffer::GetChannelId(i, 1, ordering_convention_),
-                                      sample_id));
-    output.push_back(buffer.GetSample(HoaBuffer::GetChannelId(i, -1, ordering_convention_),
-                                      sample_id));
+void AmbisonicsHorizDec::MultiplyRow(const Sample* matrix_row,
+                                     const std::vector<const Sample*>& component_data,
+                                     const Int num_samples,
+                                     Sample* output_data) noexcept {
+  const Int num_components = component_data.size();
+  const Sample gain_0 = matrix_row[0];
+  const Sample* input_0 = component_data[0];
+  for (Int i=0; i<num_samples; ++i) { output_data[i] = gain_0*input_0[i]; }
+  // Two components per pass, halving the passes over the output
+  Int j = 1;
+  for (; j+1<num_components; j+=2) {
+    const Sample gain_a = matrix_row[j];
+    const Sample gain_b = matrix_row[j+1];
+    const Sample* input_a = component_data[j];
+    const Sample* input_b = component_data[j+1];
+    for (Int i=0; i<num_samples; ++i) {
+      output_data[i] += gain_a*input_a[i] + gain_b*input_b[i];
+    }
+  }
+  if (j < num_components) {
+    const Sample gain = matrix_row[j];
+    const Sample* input_data = component_data[j];
+    for (Int i=0; i<num_samples; ++i) { output_data[i] += gain*input_data[i]; }
   }
-  return output;
 }
   
   
@@ -232,52 +528,52 @@ AmbisonicsHorizDec::GetFrame(const Int order, const Int sample_id,
 void AmbisonicsHorizDec::Decode(const Buffer& input_buffer,
                                 Buffer& output_buffer) {
   ASSERT(input_buffer.num_samples() == output_buffer.num_samples());
+  ASSERT(output_buffer.num_channels() >= num_loudspeakers_);
+  const Int num_samples = input_buffer.num_samples();
+  const Int num_components = 2*order_+1;
   
-  // Cache for speed
-  for (Int sample_id = 0; sample_id<input_buffer.num_samples(); ++sample_id) {
-    std::vector<Sample> bformat_frame = GetFrame(order_, sample_id,
-                                                 input_buffer);
-    
-    // Near-field correcting
+  // Near-field correcting (one component at a time, on the whole block)
+  if (near_field_correction_ &&
+      (Int) nfc_components_.size() < num_components*num_samples) {
+    nfc_components_.resize(num_components*num_samples);
+  }
+  for (Int j=0; j<num_components; ++j) {
+    const Sample* input_data = input_buffer.GetReadPointer(channel_ids_[j]);
     if (near_field_correction_) {
-      for (Int i=0; i<(2*order_+1); ++i) {
-        bformat_frame[i] = nfc_filters_[i].Filter(bformat_frame[i]);
-      }
-    }
-    
-    // Mode matching decoding
-    //  // Ambisonics decoding (mode-matching)
-    //  M_d = amb_decoding(N, loudspeaker_angles);
-    //  G_format_low = M_d*amb_nfc_filter(B_format, loudspeakers_distance, Fs, c);
-    std::vector<Sample> output = mcl::Multiply(mode_matching_matrix_,
-                                               bformat_frame);
-    if (energy_decoding_) {
-      // Maximum energy decoding at high frequency
-      //  // Ambisonics decoding (max r_e)
-      //  g = amb_re_weights_reg(N)*sqrt(5/3);
-      //  display('energy');
-      //  G = amb_re_weights_matrix(g);
-      //  G_format_high = M_d*G*B_format;
-      std::vector<Sample> output_high =
-                mcl::Multiply(mode_matching_matrix_,
-                              mcl::Multiply(max_energy_matrix_, bformat_frame));
-      
-      // Cross-fading high and low
-      //  // Generate output
-      //  [B_LF, A_LF, B_HF, A_HF] = amb_crossover_filter(cut_off_frequency, Fs);
-      //  out_low = filter(B_LF, A_LF, G_format_low, [], 2);
-      //  out_high = filter(B_HF, A_HF, G_format_high, [], 2);
-      //  out_nfc = out_low + out_high;
-      for (Int i=0; i<num_loudspeakers_; ++i) {
-        output[i] = crossover_filters_low_[i].Filter(output[i]) +
-                    crossover_filters_high_[i].Filter(output_high[i]);
-      }
+      Sample* nfc_data = &nfc_components_[j*num_samples];
+      nfc_filters_[j].Filter(input_data, num_samples, nfc_data);
+      component_data_[j] = nfc_data;
+    } else {
+      component_data_[j] = input_data;
     }
-    
-    // Push into each loudspeaker stream
+  }
+  
+  if (! energy_decoding_) {
+    // Mode matching decoding, directly into the output
     for (Int i=0; i<num_loudspeakers_; ++i) {
-      output_buffer.SetSample(i, sample_id, output[i]);
+      MultiplyRow(&low_decoding_rows_[i*num_components], component_data_,
+                  num_samples, output_buffer.GetWritePointer(i));
     }
+    return;
+  }
+  
+  // Mode matching decoding at low frequency and maximum energy decoding at
+  // high frequency, cross-faded by the crossover filters.
+  if ((Int) low_output_.size() < num_samples) {
+    low_output_.resize(num_samples);
+    high_output_.resize(num_samples);
+  }
+  for (Int i=0; i<num_loudspeakers_; ++i) {
+    Sample* output_data = output_buffer.GetWritePointer(i);
+    MultiplyRow(&low_decoding_rows_[i*num_components], component_data_,
+                num_samples, low_output_.data());
+    MultiplyRow(&high_decoding_rows_[i*num_components], component_data_,
+                num_samples, high_output_.data());
+    crossover_filters_low_[i].Filter(low_output_.data(), num_samples,
+                                     output_data);
+    crossover_filters_high_[i].Filter(high_output_.data(), num_samples,
+                                      low_output_.data());
+    for (Int k=0; k<num_samples; ++k) { output_data[k] += low_output_[k]; }
   }
 }
   
@@ -413,4 +709,725 @@ mcl::IirFilter AmbisonicsHorizDec::NFCFilter(const Int order,
   return mcl::IirFilter(B, A);
 }
 
+  
+AmbisonicsBinauralDec::AmbisonicsBinauralDec(const Int order,
+                                             const std::vector<Point>& loudspeaker_positions,
+                                             BinauralMic& binaural_mic,
+                                             const Int hrir_length,
+                                             const HoaNormalisation normalisation,
+                                             const HoaOrdering ordering_convention) :
+          order_(order), ordering_convention_(ordering_convention),
+          channel_ids_(HoaBuffer::GetNumChannels(order)) {
+  const Int num_loudspeakers = loudspeaker_positions.size();
+  const Int num_components = channel_ids_.size();
+  ASSERT(order >= 0 && num_loudspeakers > 0 && hrir_length > 0);
+  ASSERT(normalisation == N3d || normalisation == Sn3d);
+  
+  const mcl::Matrix<Sample> matrix =
+      Ambisonics3dDec::PseudoInverseDec(order, loudspeaker_positions);
+  std::vector<Signal> responses_left(num_components, Signal(hrir_length, 0.0));
+  std::vector<Signal> responses_right(num_components, Signal(hrir_length, 0.0));
+  for (Int i=0; i<num_loudspeakers; ++i) {
+    const Signal hrir_left = GetHrir(binaural_mic, kLeftEar,
+                                     loudspeaker_positions[i], hrir_length);
+    const Signal hrir_right = GetHrir(binaural_mic, kRightEar,
+                                      loudspeaker_positions[i], hrir_length);
+    for (Int n=0; n<=order; ++n) {
+      // The input components with Sn3d normalisation are smaller by
+      // sqrt(2n+1) than with N3d.
+      const Sample scale = (normalisation == Sn3d) ? sqrt(2.0*n+1.0) : 1.0;
+      for (Int m=-n; m<=n; ++m) {
+        const Int acn_id = n*n+n+m;
+        const Sample gain = matrix.GetElement(i, acn_id)*scale;
+        for (Int k=0; k<hrir_length; ++k) {
+          responses_left[acn_id][k] += gain*hrir_left[k];
+          responses_right[acn_id][k] += gain*hrir_right[k];
+        }
+      }
+    }
+  }
+  
+  for (Int n=0; n<=order; ++n) {
+    for (Int m=-n; m<=n; ++m) {
+      channel_ids_[n*n+n+m] = HoaBuffer::GetChannelId(n, m,
+                                                      ordering_convention_);
+    }
+  }
+  for (Int j=0; j<num_components; ++j) {
+    filters_left_.push_back(mcl::FirFilter(responses_left[j]));
+    filters_right_.push_back(mcl::FirFilter(responses_right[j]));
+  }
+}
+  
+  
+Signal AmbisonicsBinauralDec::GetHrir(BinauralMic& binaural_mic, const Ear ear,
+                                      const Point& point,
+                                      const Int length) noexcept {
+  const Signal brir = binaural_mic.GetBrir(ear, point);
+  const Time delay = binaural_mic.GetBrirDelay(ear, point);
+  
+  // Impulse delayed with the same (Lagrange) interpolation as
+  // `BinauralMicInstance`, convolved with the BRIR
+  DelayFilter delay_filter(0, ((Int) ceil(delay))+2);
+  Signal hrir(length, 0.0);
+  for (Int i=0; i<length; ++i) {
+    delay_filter.Write((i == 0) ? 1.0 : 0.0);
+    const Sample delayed_impulse = delay_filter.LagrangeReadAt(delay);
+    delay_filter.Tick();
+    if (delayed_impulse == 0.0) { continue; }
+    for (Int k=0; k<(Int)brir.size() && i+k<length; ++k) {
+      hrir[i+k] += delayed_impulse*brir[k];
+    }
+  }
+  return hrir;
+}
+  
+  
+void AmbisonicsBinauralDec::Decode(const Buffer& input_buffer,
+                                   Buffer& output_buffer) {
+  ASSERT(input_buffer.num_samples() == output_buffer.num_samples());
+  ASSERT(output_buffer.num_channels() == 2);
+  const Int num_samples = input_buffer.num_samples();
+  
+  output_buffer.Reset();
+  for (Int j=0; j<(Int)channel_ids_.size(); ++j) {
+    const Sample* input_data = input_buffer.GetReadPointer(channel_ids_[j]);
+    output_buffer.FilterAddSamples(Buffer::kLeftChannel, 0, num_samples,
+                                   input_data, filters_left_[j]);
+    output_buffer.FilterAddSamples(Buffer::kRightChannel, 0, num_samples,
+                                   input_data, filters_right_[j]);
+  }
+}
+
+  
+// Regularisation of the pseudo-inverse, relative to the average eigenvalue
+// of the Gram matrix of the spherical harmonics
+static const Sample kPseudoInverseRegularisation = 1.0E-9;
+
+// Number of (quasi-uniform) virtual loudspeakers of the AllRAD decoder
+static const Int kNumVirtualLoudspeakers = 2000;
+
+// Imaginary loudspeakers are added at the zenith (nadir) if no loudspeaker
+// is above (below) this elevation
+static const Angle kImaginaryLoudspeakerElevation = PI/4.0;
+
+// Tolerance of the geometric tests of the convex hull and of VBAP
+static const Sample kGeometryTolerance = 1.0E-9;
+
+
+/**
+ Returns the inverse of the `size` x `size` matrix `matrix` (in row-major
+ order), computed with Gauss-Jordan elimination with partial pivoting.
+ */
+static std::vector<Sample> InvertMatrix(std::vector<Sample> matrix,
+                                        const Int size) {
+  std::vector<Sample> inverse(size*size, 0.0);
+  for (Int i=0; i<size; ++i) { inverse[i*size+i] = 1.0; }
+  for (Int column=0; column<size; ++column) {
+    Int pivot = column;
+    for (Int row=column+1; row<size; ++row) {
+      if (std::abs(matrix[row*size+column]) >
+          std::abs(matrix[pivot*size+column])) {
+        pivot = row;
+      }
+    }
+    ASSERT(matrix[pivot*size+column] != 0.0);
+    for (Int j=0; j<size; ++j) {
+      std::swap(matrix[pivot*size+j], matrix[column*size+j]);
+      std::swap(inverse[pivot*size+j], inverse[column*size+j]);
+    }
+    const Sample scale = 1.0/matrix[column*size+column];
+    for (Int j=0; j<size; ++j) {
+      matrix[column*size+j] *= scale;
+      inverse[column*size+j] *= scale;
+    }
+    for (Int row=0; row<size; ++row) {
+      const Sample factor = matrix[row*size+column];
+      if (row == column || factor == 0.0) { continue; }
+      for (Int j=0; j<size; ++j) {
+        matrix[row*size+j] -= factor*matrix[column*size+j];
+        inverse[row*size+j] -= factor*inverse[column*size+j];
+      }
+    }
+  }
+  return inverse;
+}
+  
+  
+Ambisonics3dDec::Ambisonics3dDec(const Int order,
+                                 const std::vector<Point>& loudspeaker_positions,
+                                 const HoaDecodingMethod method,
+                                 const bool energy_decoding,
+                                 const Time cut_off_frequency,
+                                 const Time sampling_frequency,
+                                 const HoaNormalisation normalisation,
+                                 const HoaOrdering ordering_convention,
+                                 const Int num_threads) :
+        order_(order), num_components_(HoaBuffer::GetNumChannels(order)),
+        num_loudspeakers_(loudspeaker_positions.size()),
+        energy_decoding_(energy_decoding),
+        num_threads_(std::max((Int) 1, std::min(num_threads,
+                                                num_loudspeakers_))),
+        channel_ids_(num_components_),
+        component_data_(num_components_),
+        low_outputs_(num_threads_),
+        high_outputs_(num_threads_),
+        block_id_(0), num_workers_done_(0), block_num_samples_(0),
+        block_output_buffer_(nullptr), is_stopping_(false) {
+  ASSERT(order > 0 && num_loudspeakers_ > 0);
+  ASSERT(normalisation == N3d || normalisation == Sn3d);
+  
+  const mcl::Matrix<Sample> matrix = (method == HoaDecodingMethod::AllRad) ?
+      AllRadDec(order, loudspeaker_positions) :
+      PseudoInverseDec(order, loudspeaker_positions);
+  const std::vector<Sample> weights = MaxEnergyWeights(order);
+  low_decoding_rows_.resize(num_loudspeakers_*num_components_);
+  high_decoding_rows_.resize(num_loudspeakers_*num_components_);
+  for (Int n=0; n<=order; ++n) {
+    // The input components with Sn3d normalisation are smaller by
+    // sqrt(2n+1) than with N3d.
+    const Sample scale = (normalisation == Sn3d) ? sqrt(2.0*n+1.0) : 1.0;
+    for (Int m=-n; m<=n; ++m) {
+      const Int acn_id = n*n+n+m;
+      channel_ids_[acn_id] = HoaBuffer::GetChannelId(n, m, ordering_convention);
+      for (Int i=0; i<num_loudspeakers_; ++i) {
+        const Sample element = matrix.GetElement(i, acn_id)*scale;
+        low_decoding_rows_[i*num_components_+acn_id] = element;
+        high_decoding_rows_[i*num_components_+acn_id] = element*weights[n];
+      }
+    }
+  }
+  
+  if (energy_decoding_) {
+    crossover_filters_low_ = std::vector<mcl::IirFilter>(num_loudspeakers_,
+        AmbisonicsHorizDec::CrossoverFilterLow(cut_off_frequency,
+                                               sampling_frequency));
+    crossover_filters_high_ = std::vector<mcl::IirFilter>(num_loudspeakers_,
+        AmbisonicsHorizDec::CrossoverFilterHigh(cut_off_frequency,
+                                                sampling_frequency));
+  }
+  
+  for (Int t=1; t<num_threads_; ++t) {
+    workers_.push_back(std::thread(&Ambisonics3dDec::RunWorker, this, t));
+  }
+}
+  
+  
+Ambisonics3dDec::~Ambisonics3dDec() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    is_stopping_ = true;
+  }
+  block_ready_.notify_all();
+  for (Int t=0; t<(Int) workers_.size(); ++t) { workers_[t].join(); }
+}
+  
+  
+void Ambisonics3dDec::RunWorker(const Int thread_id) noexcept {
+  Int last_block_id = 0;
+  for (;;) {
+    Int num_samples;
+    Buffer* output_buffer;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      block_ready_.wait(lock, [&]() {
+        return is_stopping_ || block_id_ != last_block_id;
+      });
+      if (is_stopping_) { return; }
+      last_block_id = block_id_;
+      num_samples = block_num_samples_;
+      output_buffer = block_output_buffer_;
+    }
+    DecodeLoudspeakers(thread_id*num_loudspeakers_/num_threads_,
+                       (thread_id+1)*num_loudspeakers_/num_threads_,
+                       num_samples, *output_buffer, low_outputs_[thread_id],
+                       high_outputs_[thread_id]);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      ++num_workers_done_;
+    }
+    block_done_.notify_one();
+  }
+}
+  
+  
+mcl::Matrix<Sample> Ambisonics3dDec::decoding_matrix() const noexcept {
+  mcl::Matrix<Sample> matrix(num_loudspeakers_, num_components_);
+  for (Int i=0; i<num_loudspeakers_; ++i) {
+    for (Int j=0; j<num_components_; ++j) {
+      matrix.SetElement(i, j, low_decoding_rows_[i*num_components_+j]);
+    }
+  }
+  return matrix;
+}
+  
+  
+mcl::Matrix<Sample>
+Ambisonics3dDec::PseudoInverseDec(const Int order,
+                                  const std::vector<Point>& loudspeaker_positions) {
+  const Int num_components = HoaBuffer::GetNumChannels(order);
+  const Int num_loudspeakers = loudspeaker_positions.size();
+  
+  // harmonics[i*num_components+j] is the j-th harmonic of loudspeaker i
+  std::vector<Sample> harmonics(num_loudspeakers*num_components);
+  for (Int i=0; i<num_loudspeakers; ++i) {
+    AmbisonicsMic::GetSphericalHarmonics(order, loudspeaker_positions[i], N3d,
+                                         &harmonics[i*num_components]);
+  }
+  
+  // D = Y^T (Y Y^T + lambda I)^(-1), where the columns of Y are the
+  // harmonics of each loudspeaker.
+  std::vector<Sample> gram(num_components*num_components, 0.0);
+  for (Int j=0; j<num_components; ++j) {
+    for (Int k=0; k<num_components; ++k) {
+      for (Int i=0; i<num_loudspeakers; ++i) {
+        gram[j*num_components+k] += harmonics[i*num_components+j]*
+            harmonics[i*num_components+k];
+      }
+    }
+  }
+  Sample trace = 0.0;
+  for (Int j=0; j<num_components; ++j) { trace += gram[j*num_components+j]; }
+  for (Int j=0; j<num_components; ++j) {
+    gram[j*num_components+j] +=
+        kPseudoInverseRegularisation*trace/((Sample) num_components);
+  }
+  const std::vector<Sample> inverse = InvertMatrix(gram, num_components);
+  
+  mcl::Matrix<Sample> matrix(num_loudspeakers, num_components);
+  for (Int i=0; i<num_loudspeakers; ++i) {
+    for (Int k=0; k<num_components; ++k) {
+      Sample element = 0.0;
+      for (Int j=0; j<num_components; ++j) {
+        element += harmonics[i*num_components+j]*inverse[j*num_components+k];
+      }
+      matrix.SetElement(i, k, element);
+    }
+  }
+  return matrix;
+}
+  
+  
+std::vector<std::vector<Int> >
+Ambisonics3dDec::ConvexHull(const std::vector<Point>& points) {
+  // Brute force: a triangle is on the hull if all the other points are on
+  // the same side of its plane. This is fast enough for the number of
+  // loudspeakers of real layouts (less than a second for a few hundreds).
+  // The faces with four or more coplanar points are covered by more than one
+  // (overlapping) triangle, which is not a problem for VBAP.
+  const Int num_points = points.size();
+  std::vector<std::vector<Int> > triangles;
+  for (Int i=0; i<num_points; ++i) {
+    for (Int j=i+1; j<num_points; ++j) {
+      for (Int k=j+1; k<num_points; ++k) {
+        const Point normal = mcl::CrossProduct(
+            mcl::Subtract(points[j], points[i]),
+            mcl::Subtract(points[k], points[i]));
+        if (normal.norm() < kGeometryTolerance) { continue; } // Collinear
+        bool is_above = false;
+        bool is_below = false;
+        for (Int l=0; l<num_points && !(is_above && is_below); ++l) {
+          const Sample distance =
+              mcl::DotProduct(normal, mcl::Subtract(points[l], points[i]));
+          is_above = is_above || (distance > kGeometryTolerance);
+          is_below = is_below || (distance < -kGeometryTolerance);
+        }
+        if (! (is_above && is_below)) {
+          std::vector<Int> triangle(3);
+          triangle[0] = i; triangle[1] = j; triangle[2] = k;
+          triangles.push_back(triangle);
+        }
+      }
+    }
+  }
+  return triangles;
+}
+  
+  
+mcl::Matrix<Sample>
+Ambisonics3dDec::AllRadDec(const Int order,
+                           const std::vector<Point>& loudspeaker_positions) {
+  const Int num_components = HoaBuffer::GetNumChannels(order);
+  const Int num_loudspeakers = loudspeaker_positions.size();
+  
+  std::vector<Point> directions;
+  Sample max_z = -1.0;
+  Sample min_z = 1.0;
+  for (Int i=0; i<num_loudspeakers; ++i) {
+    ASSERT(loudspeaker_positions[i].norm() > 0.0);
+    directions.push_back(mcl::Normalized(loudspeaker_positions[i]));
+    max_z = std::max(max_z, directions.back().z());
+    min_z = std::min(min_z, directions.back().z());
+  }
+  // The imaginary loudspeakers are at the end, so that they are easy to
+  // discard.
+  if (max_z < sin(kImaginaryLoudspeakerElevation)) {
+    directions.push_back(Point(0.0, 0.0, 1.0));
+  }
+  if (min_z > -sin(kImaginaryLoudspeakerElevation)) {
+    directions.push_back(Point(0.0, 0.0, -1.0));
+  }
+  
+  // Inverses of the matrices with the directions of the vertices of each
+  // triangle as columns, so that the VBAP gains are inverse*direction.
+  const std::vector<std::vector<Int> > hull = ConvexHull(directions);
+  std::vector<std::vector<Int> > triangles;
+  std::vector<mcl::Matrix<Sample> > inverses;
+  for (Int t=0; t<(Int) hull.size(); ++t) {
+    const Point& a = directions[hull[t][0]];
+    const Point& b = directions[hull[t][1]];
+    const Point& c = directions[hull[t][2]];
+    const Sample determinant = mcl::DotProduct(a, mcl::CrossProduct(b, c));
+    // Skip the triangles whose plane contains the origin
+    if (std::abs(determinant) < kGeometryTolerance) { continue; }
+    const Point rows[3] = {mcl::CrossProduct(b, c), mcl::CrossProduct(c, a),
+                           mcl::CrossProduct(a, b)};
+    mcl::Matrix<Sample> inverse(3, 3);
+    for (Int i=0; i<3; ++i) {
+      inverse.SetElement(i, 0, rows[i].x()/determinant);
+      inverse.SetElement(i, 1, rows[i].y()/determinant);
+      inverse.SetElement(i, 2, rows[i].z()/determinant);
+    }
+    triangles.push_back(hull[t]);
+    inverses.push_back(inverse);
+  }
+  
+  // Sampling decoder to a Fibonacci grid of virtual loudspeakers (with equal
+  // areas), followed by VBAP. With N3d normalisation, the average of the
+  // outer products of the harmonics on the grid is (approximately) the
+  // identity, so that the virtual loudspeaker signals are Y_v^T b / V.
+  mcl::Matrix<Sample> matrix(num_loudspeakers, num_components);
+  std::vector<Sample> harmonics(num_components);
+  const Angle golden_angle = PI*(3.0-sqrt(5.0));
+  const Sample num_virtual = (Sample) kNumVirtualLoudspeakers;
+  for (Int v=0; v<kNumVirtualLoudspeakers; ++v) {
+    const Sample z = 1.0-(2.0*v+1.0)/num_virtual;
+    const Sample radius = sqrt(1.0-z*z);
+    const Point direction(radius*cos(golden_angle*v),
+                          radius*sin(golden_angle*v), z);
+    
+    Int triangle_id = -1;
+    Sample gains[3];
+    for (Int t=0; t<(Int) triangles.size() && triangle_id < 0; ++t) {
+      for (Int i=0; i<3; ++i) {
+        gains[i] = inverses[t].GetElement(i, 0)*direction.x() +
+            inverses[t].GetElement(i, 1)*direction.y() +
+            inverses[t].GetElement(i, 2)*direction.z();
+      }
+      if (gains[0] > -kGeometryTolerance && gains[1] > -kGeometryTolerance &&
+          gains[2] > -kGeometryTolerance) {
+        triangle_id = t;
+      }
+    }
+    if (triangle_id < 0) {
+      mcl::Logger::GetInstance().LogError("No loudspeaker triangle contains "
+                                          "the direction (%f, %f, %f).",
+                                          direction.x(), direction.y(),
+                                          direction.z());
+      continue;
+    }
+    
+    const Sample norm = sqrt(gains[0]*gains[0] + gains[1]*gains[1] +
+                             gains[2]*gains[2]);
+    AmbisonicsMic::GetSphericalHarmonics(order, direction, N3d,
+                                         harmonics.data());
+    for (Int i=0; i<3; ++i) {
+      const Int loudspeaker_id = triangles[triangle_id][i];
+      if (loudspeaker_id >= num_loudspeakers) { continue; } // Imaginary
+      const Sample gain = std::max(gains[i], 0.0)/norm/num_virtual;
+      for (Int j=0; j<num_components; ++j) {
+        matrix.SetElement(loudspeaker_id, j,
+                          matrix.GetElement(loudspeaker_id, j) +
+                          gain*harmonics[j]);
+      }
+    }
+  }
+  return matrix;
+}
+  
+  
+std::vector<Sample> Ambisonics3dDec::MaxEnergyWeights(const Int order) {
+  // Legendre polynomials of cos(137.9 deg/(order+1.51)), with Bonnet's
+  // recursion
+  const Sample x = cos(137.9/180.0*PI/(((Sample) order)+1.51));
+  std::vector<Sample> weights(order+1);
+  weights[0] = 1.0;
+  if (order > 0) { weights[1] = x; }
+  for (Int n=2; n<=order; ++n) {
+    weights[n] = ((2.0*n-1.0)*x*weights[n-1] - (n-1.0)*weights[n-2])/
+        ((Sample) n);
+  }
+  // Normalisation of the energy (each order has 2n+1 components)
+  Sample energy = 0.0;
+  Sample weighted_energy = 0.0;
+  for (Int n=0; n<=order; ++n) {
+    energy += 2.0*n+1.0;
+    weighted_energy += (2.0*n+1.0)*weights[n]*weights[n];
+  }
+  const Sample scale = sqrt(energy/weighted_energy);
+  for (Int n=0; n<=order; ++n) { weights[n] *= scale; }
+  return weights;
+}
+  
+  
+void Ambisonics3dDec::MultiplyRow(const Sample* matrix_row,
+                                  const Int num_samples,
+                                  Sample* output_data) const noexcept {
+  // Four components per pass over the output, in a loop that the compiler
+  // can vectorise
+  std::fill(output_data, output_data+num_samples, 0.0);
+  Int j = 0;
+  for (; j+4<=num_components_; j+=4) {
+    const Sample gain_0 = matrix_row[j];
+    const Sample gain_1 = matrix_row[j+1];
+    const Sample gain_2 = matrix_row[j+2];
+    const Sample gain_3 = matrix_row[j+3];
+    const Sample* input_0 = component_data_[j];
+    const Sample* input_1 = component_data_[j+1];
+    const Sample* input_2 = component_data_[j+2];
+    const Sample* input_3 = component_data_[j+3];
+    for (Int i=0; i<num_samples; ++i) {
+      output_data[i] += gain_0*input_0[i] + gain_1*input_1[i] +
+          gain_2*input_2[i] + gain_3*input_3[i];
+    }
+  }
+  for (; j<num_components_; ++j) {
+    const Sample gain = matrix_row[j];
+    const Sample* input_data = component_data_[j];
+    for (Int i=0; i<num_samples; ++i) { output_data[i] += gain*input_data[i]; }
+  }
+}
+  
+  
+void Ambisonics3dDec::DecodeLoudspeakers(const Int begin, const Int end,
+                                         const Int num_samples,
+                                         Buffer& output_buffer,
+                                         std::vector<Sample>& low_output,
+                                         std::vector<Sample>& high_output) noexcept {
+  for (Int i=begin; i<end; ++i) {
+    Sample* output_data = output_buffer.GetWritePointer(i);
+    if (! energy_decoding_) {
+      MultiplyRow(&low_decoding_rows_[i*num_components_], num_samples,
+                  output_data);
+      continue;
+    }
+    MultiplyRow(&low_decoding_rows_[i*num_components_], num_samples,
+                low_output.data());
+    MultiplyRow(&high_decoding_rows_[i*num_components_], num_samples,
+                high_output.data());
+    crossover_filters_low_[i].Filter(low_output.data(), num_samples,
+                                     output_data);
+    crossover_filters_high_[i].Filter(high_output.data(), num_samples,
+                                      low_output.data());
+    for (Int k=0; k<num_samples; ++k) { output_data[k] += low_output[k]; }
+  }
+}
+  
+  
+void Ambisonics3dDec::Decode(const Buffer& input_buffer,
+                             Buffer& output_buffer) {
+  ASSERT(input_buffer.num_samples() == output_buffer.num_samples());
+  ASSERT(input_buffer.num_channels() >= num_components_);
+  ASSERT(output_buffer.num_channels() >= num_loudspeakers_);
+  const Int num_samples = input_buffer.num_samples();
+  
+  for (Int j=0; j<num_components_; ++j) {
+    component_data_[j] = input_buffer.GetReadPointer(channel_ids_[j]);
+  }
+  if (energy_decoding_ && (Int) low_outputs_[0].size() < num_samples) {
+    for (Int t=0; t<num_threads_; ++t) {
+      low_outputs_[t].resize(num_samples);
+      high_outputs_[t].resize(num_samples);
+    }
+  }
+  
+  // Each thread decodes a contiguous range of loudspeakers, with its own
+  // scratch rows; the calling thread takes the first range, and the
+  // workers the others.
+  if (! workers_.empty()) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      block_num_samples_ = num_samples;
+      block_output_buffer_ = &output_buffer;
+      num_workers_done_ = 0;
+      ++block_id_;
+    }
+    block_ready_.notify_all();
+  }
+  DecodeLoudspeakers(0, num_loudspeakers_/num_threads_, num_samples,
+                     output_buffer, low_outputs_[0], high_outputs_[0]);
+  if (! workers_.empty()) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    block_done_.wait(lock, [&]() {
+      return num_workers_done_ == (Int) workers_.size();
+    });
+  }
+}
+  
+  
+AmbisonicsRotator::AmbisonicsRotator(const Int order,
+                                     const HoaOrdering ordering_convention) :
+          order_(order), ordering_convention_(ordering_convention),
+          current_blocks_(GetRotationBlocks(order, mcl::Quaternion::Identity())),
+          target_blocks_(current_blocks_),
+          input_frame_(2*order+1) {
+  ASSERT(order >= 0);
+  channel_ids_.resize(order+1);
+  for (Int l=0; l<=order; ++l) {
+    for (Int m=-l; m<=l; ++m) {
+      channel_ids_[l].push_back(HoaBuffer::GetChannelId(l, m,
+                                                        ordering_convention_));
+    }
+  }
+}
+  
+  
+void AmbisonicsRotator::SetRotation(const mcl::Quaternion& rotation) noexcept {
+  target_blocks_ = GetRotationBlocks(order_, rotation);
+}
+  
+  
+void AmbisonicsRotator::Rotate(const Buffer& input_buffer,
+                               Buffer& output_buffer) noexcept {
+  ASSERT(input_buffer.num_samples() == output_buffer.num_samples());
+  ASSERT(input_buffer.num_channels() >= HoaBuffer::GetNumChannels(order_));
+  ASSERT(output_buffer.num_channels() >= HoaBuffer::GetNumChannels(order_));
+  const Int num_samples = input_buffer.num_samples();
+  
+  for (Int order=0; order<=order_; ++order) {
+    const Int size = 2*order+1;
+    const std::vector<Sample>& current = current_blocks_[order];
+    const std::vector<Sample>& target = target_blocks_[order];
+    const bool interpolate = (current != target);
+    const std::vector<Int>& channel_ids = channel_ids_[order];
+    
+    for (Int sample_id=0; sample_id<num_samples; ++sample_id) {
+      for (Int i=0; i<size; ++i) {
+        input_frame_[i] = input_buffer.GetSample(channel_ids[i], sample_id);
+      }
+      const Sample weight = ((Sample) (sample_id+1))/((Sample) num_samples);
+      for (Int i=0; i<size; ++i) {
+        const Sample* current_row = &current[i*size];
+        Sample output = 0.0;
+        for (Int j=0; j<size; ++j) { output += current_row[j]*input_frame_[j]; }
+        if (interpolate) {
+          const Sample* target_row = &target[i*size];
+          Sample step = 0.0;
+          for (Int j=0; j<size; ++j) {
+            step += (target_row[j]-current_row[j])*input_frame_[j];
+          }
+          output += weight*step;
+        }
+        output_buffer.SetSample(channel_ids[i], sample_id, output);
+      }
+    }
+  }
+  current_blocks_ = target_blocks_;
+}
+  
+  
+mcl::Matrix<Sample>
+AmbisonicsRotator::GetRotationMatrix(const Int order,
+                                     const mcl::Quaternion& rotation) {
+  const std::vector<std::vector<Sample> > blocks = GetRotationBlocks(order,
+                                                                     rotation);
+  const Int num_channels = HoaBuffer::GetNumChannels(order);
+  mcl::Matrix<Sample> matrix(num_channels, num_channels);
+  for (Int l=0; l<=order; ++l) {
+    const Int size = 2*l+1;
+    for (Int i=0; i<size; ++i) {
+      for (Int j=0; j<size; ++j) {
+        matrix.SetElement(l*l+i, l*l+j, blocks[l][i*size+j]);
+      }
+    }
+  }
+  return matrix;
+}
+  
+  
+std::vector<std::vector<Sample> >
+AmbisonicsRotator::GetRotationBlocks(const Int order,
+                                     const mcl::Quaternion& rotation) noexcept {
+  std::vector<std::vector<Sample> > blocks(order+1);
+  blocks[0] = std::vector<Sample>(1, 1.0);
+  if (order == 0) { return blocks; }
+  
+  // The first-order block is the 3x3 rotation matrix, with the axes in the
+  // order of the degrees -1, 0, 1, i.e. y, z, x.
+  const Point axes[3] = {Point(0.0,1.0,0.0), Point(0.0,0.0,1.0),
+                         Point(1.0,0.0,0.0)};
+  blocks[1].resize(9);
+  for (Int j=0; j<3; ++j) {
+    const Point rotated = mcl::QuatRotate(rotation, axes[j]);
+    blocks[1][0*3+j] = rotated.y();
+    blocks[1][1*3+j] = rotated.z();
+    blocks[1][2*3+j] = rotated.x();
+  }
+  
+  // Element of the first-order block for degrees `i` and `j` in [-1, 1]
+  auto r1 = [&blocks] (const Int i, const Int j) -> Sample {
+    return blocks[1][(i+1)*3+(j+1)];
+  };
+  
+  for (Int l=2; l<=order; ++l) {
+    const std::vector<Sample>& previous = blocks[l-1];
+    // Element of the previous block for degrees `a` and `b` in [-l+1, l-1]
+    auto m = [&previous, l] (const Int a, const Int b) -> Sample {
+      return previous[(a+l-1)*(2*l-1)+(b+l-1)];
+    };
+    // Function P of Ivanic and Ruedenberg's article
+    auto p = [&r1, &m, l] (const Int i, const Int a, const Int b) -> Sample {
+      if (b == l) {
+        return r1(i,1)*m(a,l-1) - r1(i,-1)*m(a,-l+1);
+      } else if (b == -l) {
+        return r1(i,1)*m(a,-l+1) + r1(i,-1)*m(a,l-1);
+      } else {
+        return r1(i,0)*m(a,b);
+      }
+    };
+    
+    const Int size = 2*l+1;
+    blocks[l].resize(size*size);
+    for (Int m_id=-l; m_id<=l; ++m_id) {
+      const Int abs_m = std::abs(m_id);
+      const Sample delta = (m_id == 0) ? 1.0 : 0.0;
+      for (Int n_id=-l; n_id<=l; ++n_id) {
+        const Sample denominator = (std::abs(n_id) < l) ?
+            (Sample) ((l+n_id)*(l-n_id)) : (Sample) ((2*l)*(2*l-1));
+        const Sample u = sqrt(((Sample) ((l+m_id)*(l-m_id)))/denominator);
+        const Sample v = 0.5*sqrt((1.0+delta)*((Sample) ((l+abs_m-1)*(l+abs_m)))/
+                                  denominator)*(1.0-2.0*delta);
+        const Sample w = -0.5*sqrt(((Sample) ((l-abs_m-1)*(l-abs_m)))/
+                                   denominator)*(1.0-delta);
+        
+        Sample element = 0.0;
+        if (u != 0.0) { element += u*p(0,m_id,n_id); }
+        if (v != 0.0) {
+          Sample v_term;
+          if (m_id == 0) {
+            v_term = p(1,1,n_id) + p(-1,-1,n_id);
+          } else if (m_id > 0) {
+            const Sample delta_1 = (m_id == 1) ? 1.0 : 0.0;
+            v_term = p(1,m_id-1,n_id)*sqrt(1.0+delta_1) -
+                p(-1,-m_id+1,n_id)*(1.0-delta_1);
+          } else {
+            const Sample delta_1 = (m_id == -1) ? 1.0 : 0.0;
+            v_term = p(1,m_id+1,n_id)*(1.0-delta_1) +
+                p(-1,-m_id-1,n_id)*sqrt(1.0+delta_1);
+          }
+          element += v*v_term;
+        }
+        if (w != 0.0) {
+          const Sample w_term = (m_id > 0) ?
+              p(1,m_id+1,n_id) + p(-1,-m_id-1,n_id) :
+              p(1,m_id-1,n_id) - p(-1,-m_id+1,n_id);
+          element += w*w_term;
+        }
+        blocks[l][(m_id+l)*size+(n_id+l)] = element;
+      }
+    }
+  }
+  return blocks;
+}
+
 } // namespace sal
@@ -0,0 +1,87 @@
+/*
+ sal_hrtf_pack.cpp
+ Spatial Audio Library (SAL)
+ Copyright (c) 2015, Enzo De Sena
+ All rights reserved.
+ 
+ Authors: Enzo De Sena, enzodesena@gmail.com
+ 
+ Converts the HRTF databases in hrtfs/ into binary pack files (see
+ hrtfpack.h), which can then be loaded by KemarMic and CipicMic. E.g.:
+ 
+   sal_hrtf_pack kemar_compact hrtfs/kemar_compact kemar_compact.salhrtf
+   sal_hrtf_pack kemar_diffuse hrtfs/kemar_diffuse kemar_diffuse.salhrtf
+   sal_hrtf_pack kemar_full hrtfs/kemar_full kemar_full.salhrtf
+   sal_hrtf_pack cipic_wav hrtfs/cipic/subject21 cipic_21.salhrtf double
+ 
+ An optional last argument resamples the database, e.g.:
+ 
+   sal_hrtf_pack kemar_full hrtfs/kemar_full kemar_full_48k.salhrtf float 48000
+ 
+ */
+
+#include "kemarmic.h"
+#include "cipicmic.h"
+#include "hrtfpack.h"
+#include <iostream>
+#include <string>
+#include <cstdlib>
+
+int main(int argc, char * const argv[]) {
+  if (argc < 4) {
+    std::cout<<"Usage: "<<argv[0]<<" <kemar_compact|kemar_diffuse|kemar_full|"
+             <<"kemar_full_right|cipic_txt|cipic_wav> <input directory> "
+             <<"<output file> [float|double] [sampling frequency]\n";
+    return 1;
+  }
+  
+  const std::string database(argv[1]);
+  const std::string directory(argv[2]);
+  const std::string pack_file_path(argv[3]);
+  const sal::HrtfPack::SampleFormat sample_format =
+      (argc > 4 && std::string(argv[4]) == "double") ?
+      sal::HrtfPack::kFloat64 : sal::HrtfPack::kFloat32;
+  const sal::Time sampling_frequency = (argc > 5) ? atof(argv[5]) : 44100.0;
+  if (sampling_frequency <= 0.0) {
+    std::cout<<"Invalid sampling frequency: "<<argv[5]<<"\n";
+    return 1;
+  }
+  
+  bool success = false;
+  if (database == "kemar_compact" || database == "kemar_diffuse") {
+    success = sal::KemarMic::WritePack(pack_file_path, directory,
+                                       sal::KemarMic::kDirectoryCompact,
+                                       sample_format, sampling_frequency);
+  } else if (database == "kemar_full") {
+    success = sal::KemarMic::WritePack(pack_file_path, directory,
+                                       sal::KemarMic::kDirectoryLeft,
+                                       sample_format, sampling_frequency);
+  } else if (database == "kemar_full_right") {
+    success = sal::KemarMic::WritePack(pack_file_path, directory,
+                                       sal::KemarMic::kDirectoryRight,
+                                       sample_format, sampling_frequency);
+  } else if (database == "cipic_txt") {
+    success = sal::CipicMic::WritePack(pack_file_path, directory,
+                                       sal::CipicMic::txt, sample_format,
+                                       sampling_frequency);
+  } else if (database == "cipic_wav") {
+    success = sal::CipicMic::WritePack(pack_file_path, directory,
+                                       sal::CipicMic::wav, sample_format,
+                                       sampling_frequency);
+  } else {
+    std::cout<<"Unknown database: "<<database<<"\n";
+    return 1;
+  }
+  
+  if (! success) {
+    std::cout<<"Could not write "<<pack_file_path<<"\n";
+    return 1;
+  }
+  
+  sal::HrtfPack pack;
+  if (! pack.Open(pack_file_path)) { return 1; }
+  std::cout<<"Written "<<pack.num_directions()<<" directions of "
+           <<pack.num_samples()<<" samples at "<<pack.sampling_frequency()
+           <<" Hz to "<<pack_file_path<<"\n";
+  return 0;
+}
@@ -12,13 +12,19 @@
 #include "microphone.h"
 #include "microphonearray.h"
 #include "sphericalheadmic.h"
+#include "structuralheadmic.h"
 #include "kemarmic.h"
 #include "ambisonics.h"
 #include "delayfilter.h"
+#include "partitionedconvolver.h"
+#include "sparseconvolver.h"
 #include "propagationline.h"
 #include "freefieldsimulation.h"
 #include "wavhandler.h"
 #include "cipicmic.h"
+#include "hrtfpack.h"
+#include "directiongrid.h"
+#include "resampler.h"
 #include "ism.h"
 #include "cuboidroom.h"
 #include "fdtd.h"
@@ -34,12 +40,22 @@ int main(int argc, char * const argv[]) {
   sal::Buffer::Test();
   sal::AmbisonicsMic::Test();
   sal::AmbisonicsHorizDec::Test();
+  sal::AmbisonicsBinauralDec::Test();
+  sal::Ambisonics3dDec::Test();
+  sal::AmbisonicsRotator::Test();
+  sal::AmbisonicsBatchEncoder::Test();
   sal::Microphone::Test();
   sal::KemarMic::Test();
+  sal::HrtfPack::Test();
+  sal::DirectionGrid::Test();
+  sal::Resampler::Test();
 //  sal::CipicMic::Test();
   sal::SphericalHeadMic::Test();
+  sal::StructuralHeadMic::Test();
   sal::MicrophoneArrayTest();
   sal::DelayFilter::Test();
+  sal::PartitionedConvolver::Test();
+  sal::SparseConvolver::Test();
   sal::PropagationLine::Test();
   sal::FreeFieldSim::Test();
   sal::CuboidRoom::Test();
@@ -54,6 +70,11 @@ int main(int argc, char * const argv[]) {
 #endif
   
   sal::TdBem::SimulationTime();
+  sal::StructuralHeadMic::SimulationTime();
+  sal::AmbisonicsMic::SimulationTime();
+  sal::AmbisonicsBatchEncoder::SimulationTime();
+  sal::Ism::SimulationTime();
+  sal::SparseConvolver::SimulationTime();
   std::cout<<"FDTD speed: "<<sal::Fdtd::SimulationTime()<<" s\n";
     
   return 0;
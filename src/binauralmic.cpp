@@ -11,7 +11,12 @@
 #include "binauralmic.h"
 #include "point.h"
 #include "salconstants.h"
+#include "resampler.h"
+#include "transformop.h"
 #include <string.h>
+#include <mutex>
+#include <algorithm>
+#include <cmath>
 
 using mcl::Point;
 using mcl::Quaternion;
@@ -55,6 +60,8 @@ void BinauralMic::Reset() noexcept {
       ++iterator) {
     iterator->second.filter_left_.Reset();
     iterator->second.filter_right_.Reset();
+    iterator->second.delay_filter_left_.Reset();
+    iterator->second.delay_filter_right_.Reset();
   }
 }
 
@@ -73,10 +80,43 @@ void BinauralMicInstance::AddPlaneWaveRelative(const Sample* input_data,
                                                const mcl::Point& point,
                                                Buffer& output_buffer) noexcept {
   UpdateFilter(point);
+  if (! delayed_) {
+    output_buffer.FilterAddSamples(Buffer::kLeftChannel, 0, num_samples,
+                                   input_data, filter_left_);
+    output_buffer.FilterAddSamples(Buffer::kRightChannel, 0, num_samples,
+                                   input_data, filter_right_);
+    return;
+  }
+  
+  if ((Int) delayed_input_.size() < num_samples) {
+    delayed_input_.resize(num_samples);
+  }
+  Delay(input_data, num_samples, delay_left_, target_delay_left_,
+        delay_filter_left_, delayed_input_.data());
   output_buffer.FilterAddSamples(Buffer::kLeftChannel, 0, num_samples,
-                                 input_data, filter_left_);
+                                 delayed_input_.data(), filter_left_);
+  Delay(input_data, num_samples, delay_right_, target_delay_right_,
+        delay_filter_right_, delayed_input_.data());
   output_buffer.FilterAddSamples(Buffer::kRightChannel, 0, num_samples,
-                                 input_data, filter_right_);
+                                 delayed_input_.data(), filter_right_);
+  delay_left_ = target_delay_left_;
+  delay_right_ = target_delay_right_;
+}
+  
+  
+void BinauralMicInstance::Delay(const Sample* input_data, const Int num_samples,
+                                const Time start_delay, const Time end_delay,
+                                DelayFilter& delay_filter,
+                                Sample* output_data) noexcept {
+  ASSERT(GetMaxLatency(std::max(start_delay, end_delay)) <=
+         delay_filter.max_latency());
+  const Time delay_step = (end_delay-start_delay)/((Time) num_samples);
+  for (Int i=0; i<num_samples; ++i) {
+    delay_filter.Write(input_data[i]);
+    output_data[i] = delay_filter.LagrangeReadAt(start_delay +
+                                                 delay_step*((Time) (i+1)));
+    delay_filter.Tick();
+  }
 }
 
 void BinauralMicInstance::UpdateFilter(const Point& point) noexcept {
@@ -88,6 +128,16 @@ void BinauralMicInstance::UpdateFilter(const Point& point) noexcept {
                                       update_length_);
     filter_right_.SetImpulseResponse(base_mic_->GetBrir(kRightEar, point),
                                       update_length_);
+    
+    target_delay_left_ = base_mic_->GetBrirDelay(kLeftEar, point);
+    target_delay_right_ = base_mic_->GetBrirDelay(kRightEar, point);
+    if (! delayed_ &&
+        (target_delay_left_ != 0.0 || target_delay_right_ != 0.0)) {
+      // Start from the right delay rather than ramping from zero
+      delayed_ = true;
+      delay_left_ = target_delay_left_;
+      delay_right_ = target_delay_right_;
+    }
   }
 }
 
@@ -95,7 +145,8 @@ DatabaseBinauralMic::DatabaseBinauralMic(const Point& position,
                                          const Quaternion orientation,
                                          const Int update_length,
                                          const HeadRefOrientation reference_orientation) :
-BinauralMic(position, orientation, update_length, reference_orientation) {}
+BinauralMic(position, orientation, update_length, reference_orientation),
+principal_components_error_(0.0), max_brir_delay_(0.0) {}
 
 
 void DatabaseBinauralMic::FilterAll(mcl::DigitalFilter* filter) {
@@ -103,4 +154,383 @@ void DatabaseBinauralMic::FilterAll(mcl::DigitalFilter* filter) {
   mcl::FilterAll(hrtf_database_left_, filter);
 }
   
+  
+void DatabaseBinauralMic::SplitMinimumPhase(const Int num_taps) {
+  ASSERT(num_taps > 0);
+  max_brir_delay_ = 0.0;
+  for (Int ear_id=0; ear_id<2; ++ear_id) {
+    std::vector<std::vector<Signal> >& hrtf_database = (ear_id == 0) ?
+        hrtf_database_left_ : hrtf_database_right_;
+    std::vector<std::vector<Signal> >& hrtf_delays = (ear_id == 0) ?
+        hrtf_delays_left_ : hrtf_delays_right_;
+    
+    hrtf_delays.resize(hrtf_database.size());
+    for (Int i=0; i<(Int)hrtf_database.size(); ++i) {
+      hrtf_delays[i].assign(hrtf_database[i].size(), Signal(1, 0.0));
+      for (Int j=0; j<(Int)hrtf_database[i].size(); ++j) {
+        Signal& hrir = hrtf_database[i][j];
+        if (hrir.empty()) { continue; }
+        
+        const Signal minimum_phase_hrir = mcl::MinPhase(hrir);
+        hrtf_delays[i][j][0] = std::max(GetOnset(hrir) -
+                                        GetOnset(minimum_phase_hrir), 0.0);
+        max_brir_delay_ = std::max(max_brir_delay_, hrtf_delays[i][j][0]);
+        hrir = Signal(minimum_phase_hrir.begin(),
+                      minimum_phase_hrir.begin() +
+                      std::min(num_taps, (Int) minimum_phase_hrir.size()));
+      }
+    }
+  }
+}
+  
+  
+Time DatabaseBinauralMic::GetOnset(const Signal& signal) noexcept {
+  Sample peak = 0.0;
+  for (Int i=0; i<(Int)signal.size(); ++i) {
+    peak = std::max(peak, std::abs(signal[i]));
+  }
+  if (peak == 0.0) { return 0.0; }
+  
+  const Sample threshold = peak/10.0;
+  for (Int i=0; i<(Int)signal.size(); ++i) {
+    const Sample value = std::abs(signal[i]);
+    if (value >= threshold) {
+      if (i == 0) { return 0.0; }
+      // Interpolate linearly between the previous sample and this one
+      const Sample previous_value = std::abs(signal[i-1]);
+      return ((Time) (i-1)) + (threshold-previous_value)/(value-previous_value);
+    }
+  }
+  ASSERT(false);
+  return 0.0;
+}
+  
+  
+std::vector<std::vector<Signal> >
+DatabaseBinauralMic::Resample(const std::vector<std::vector<Signal> >& hrtf_database,
+                              const Time input_sampling_frequency,
+                              const Time output_sampling_frequency) {
+  const Resampler resampler(input_sampling_frequency, output_sampling_frequency);
+  const Sample gain = input_sampling_frequency/output_sampling_frequency;
+  
+  std::vector<std::vector<Signal> > output(hrtf_database.size());
+  for (Int i=0; i<(Int)hrtf_database.size(); ++i) {
+    output[i].resize(hrtf_database[i].size());
+    for (Int j=0; j<(Int)hrtf_database[i].size(); ++j) {
+      output[i][j] = mcl::Multiply(resampler.Run(hrtf_database[i][j]), gain);
+    }
+  }
+  return output;
+}
+  
+  
+struct ResampledDatabase {
+  std::vector<std::vector<Signal> > left;
+  std::vector<std::vector<Signal> > right;
+};
+  
+static std::mutex resampled_database_mutex;
+  
+static std::map<std::string, ResampledDatabase>& GetResampledDatabaseCache() {
+  static std::map<std::string, ResampledDatabase> cache;
+  return cache;
+}
+  
+  
+void DatabaseBinauralMic::ClearResampledDatabaseCache() noexcept {
+  std::lock_guard<std::mutex> lock(resampled_database_mutex);
+  GetResampledDatabaseCache().clear();
+}
+  
+  
+void DatabaseBinauralMic::ResampleDatabase(const std::string& database_id,
+                                           const Time database_sampling_frequency,
+                                           const Time sampling_frequency) {
+  const std::string key = database_id + "@" +
+      std::to_string((long) mcl::RoundToInt(database_sampling_frequency)) + ">" +
+      std::to_string((long) mcl::RoundToInt(sampling_frequency));
+  
+  std::lock_guard<std::mutex> lock(resampled_database_mutex);
+  std::map<std::string, ResampledDatabase>& cache = GetResampledDatabaseCache();
+  auto iterator = cache.find(key);
+  if (iterator == cache.end()) {
+    ResampledDatabase resampled_database;
+    resampled_database.left = Resample(hrtf_database_left_,
+                                       database_sampling_frequency,
+                                       sampling_frequency);
+    resampled_database.right = Resample(hrtf_database_right_,
+                                        database_sampling_frequency,
+                                        sampling_frequency);
+    iterator = cache.insert(std::make_pair(key, resampled_database)).first;
+  }
+  hrtf_database_left_ = iterator->second.left;
+  hrtf_database_right_ = iterator->second.right;
+}
+  
+  
+std::vector<Signal>
+DatabaseBinauralMic::GetPrincipalComponents(const std::vector<Signal>& data,
+                                            const Int num_components) noexcept {
+  ASSERT(num_components > 0);
+  Int length = 0;
+  for (Int n=0; n<(Int)data.size(); ++n) {
+    length = std::max(length, (Int) data[n].size());
+  }
+  std::vector<Signal> components;
+  if (length == 0) { return components; }
+  
+  // Orthogonalises `vector` to the components found so far and normalises
+  // it, returning false if nothing is left of it.
+  auto orthonormalise = [&components, length] (Signal& vector) -> bool {
+    for (Int k=0; k<(Int)components.size(); ++k) {
+      Sample projection = 0.0;
+      for (Int i=0; i<length; ++i) { projection += vector[i]*components[k][i]; }
+      for (Int i=0; i<length; ++i) { vector[i] -= projection*components[k][i]; }
+    }
+    Sample norm = 0.0;
+    for (Int i=0; i<length; ++i) { norm += vector[i]*vector[i]; }
+    norm = sqrt(norm);
+    if (norm < VERY_SMALL*VERY_SMALL) { return false; }
+    for (Int i=0; i<length; ++i) { vector[i] /= norm; }
+    return true;
+  };
+  
+  Signal mean(length, 0.0);
+  for (Int n=0; n<(Int)data.size(); ++n) {
+    for (Int i=0; i<(Int)data[n].size(); ++i) { mean[i] += data[n][i]; }
+  }
+  if (! orthonormalise(mean)) { mean.assign(length, 0.0); mean[0] = 1.0; }
+  components.push_back(mean);
+  
+  // Covariance of the data, orthogonalised to the mean
+  std::vector<Signal> covariance(length, Signal(length, 0.0));
+  Signal residual(length);
+  for (Int n=0; n<(Int)data.size(); ++n) {
+    Sample projection = 0.0;
+    for (Int i=0; i<(Int)data[n].size(); ++i) {
+      projection += data[n][i]*mean[i];
+    }
+    for (Int i=0; i<length; ++i) {
+      residual[i] = ((i < (Int)data[n].size()) ? data[n][i] : 0.0) -
+          projection*mean[i];
+    }
+    for (Int i=0; i<length; ++i) {
+      if (residual[i] == 0.0) { continue; }
+      for (Int j=i; j<length; ++j) {
+        covariance[i][j] += residual[i]*residual[j];
+      }
+    }
+  }
+  for (Int i=0; i<length; ++i) {
+    for (Int j=0; j<i; ++j) { covariance[i][j] = covariance[j][i]; }
+  }
+  
+  const Int max_num_iterations = 1000;
+  Signal vector(length);
+  Signal next_vector(length);
+  while ((Int) components.size() < std::min(num_components, length)) {
+    // Deterministic starting vector, not orthogonal to any direction in
+    // particular
+    for (Int i=0; i<length; ++i) {
+      vector[i] = cos(1.0 + 0.7*((Sample) (i*(components.size()+1))));
+    }
+    if (! orthonormalise(vector)) { break; }
+    bool converged = false;
+    bool exhausted = false;
+    for (Int iteration=0; iteration<max_num_iterations && !converged;
+         ++iteration) {
+      for (Int i=0; i<length; ++i) {
+        Sample sum = 0.0;
+        for (Int j=0; j<length; ++j) { sum += covariance[i][j]*vector[j]; }
+        next_vector[i] = sum;
+      }
+      if (! orthonormalise(next_vector)) { exhausted = true; break; }
+      Sample difference = 0.0;
+      for (Int i=0; i<length; ++i) {
+        difference += std::abs(next_vector[i]-vector[i]);
+      }
+      converged = difference < VERY_SMALL*VERY_SMALL;
+      vector.swap(next_vector);
+    }
+    if (exhausted) { break; } // Nothing is left of the data
+    components.push_back(vector);
+  }
+  return components;
+}
+  
+  
+void DatabaseBinauralMic::SetPrincipalComponents(const Int num_components) {
+  ASSERT(num_components >= 0);
+  principal_components_.clear();
+  principal_components_error_ = 0.0;
+  components_instances_.clear();
+  for (Int ear_id=0; ear_id<2; ++ear_id) {
+    component_filters_[ear_id].clear();
+    component_buses_[ear_id].clear();
+  }
+  if (num_components == 0) { return; }
+  
+  std::vector<Signal> hrirs;
+  for (Int ear_id=0; ear_id<2; ++ear_id) {
+    const std::vector<std::vector<Signal> >& hrtf_database = (ear_id == 0) ?
+        hrtf_database_left_ : hrtf_database_right_;
+    for (Int i=0; i<(Int)hrtf_database.size(); ++i) {
+      for (Int j=0; j<(Int)hrtf_database[i].size(); ++j) {
+        if (hrtf_database[i][j].empty()) { continue; }
+        hrirs.push_back(hrtf_database[i][j]);
+      }
+    }
+  }
+  principal_components_ = GetPrincipalComponents(hrirs, num_components);
+  if (principal_components_.empty()) { return; }
+  
+  Sample error_energy = 0.0;
+  Sample energy = 0.0;
+  for (Int n=0; n<(Int)hrirs.size(); ++n) {
+    Signal error = hrirs[n];
+    error.resize(principal_components_[0].size(), 0.0);
+    for (Int k=0; k<(Int)principal_components_.size(); ++k) {
+      Sample projection = 0.0;
+      for (Int i=0; i<(Int)error.size(); ++i) {
+        projection += hrirs[n][i]*principal_components_[k][i];
+      }
+      for (Int i=0; i<(Int)error.size(); ++i) {
+        error[i] -= projection*principal_components_[k][i];
+      }
+    }
+    for (Int i=0; i<(Int)error.size(); ++i) {
+      error_energy += error[i]*error[i];
+      energy += (i < (Int)hrirs[n].size()) ? hrirs[n][i]*hrirs[n][i] : 0.0;
+    }
+  }
+  principal_components_error_ = (energy > 0.0) ? error_energy/energy : 0.0;
+  
+  for (Int ear_id=0; ear_id<2; ++ear_id) {
+    for (Int k=0; k<(Int)principal_components_.size(); ++k) {
+      component_filters_[ear_id].push_back(
+          mcl::FirFilter(principal_components_[k]));
+    }
+    component_buses_[ear_id].assign(principal_components_.size(), Signal());
+  }
+}
+  
+  
+void DatabaseBinauralMic::UpdateWeights(const Point& point,
+                                        ComponentsInstance& instance) noexcept {
+  for (Int ear_id=0; ear_id<2; ++ear_id) {
+    const Ear ear = (ear_id == 0) ? kLeftEar : kRightEar;
+    const Signal brir = GetBrir(ear, point);
+    std::vector<Sample>& weights = instance.weights[ear_id];
+    weights.assign(principal_components_.size(), 0.0);
+    instance.start_weights[ear_id].resize(principal_components_.size());
+    for (Int k=0; k<(Int)principal_components_.size(); ++k) {
+      const Int length = std::min(brir.size(), principal_components_[k].size());
+      for (Int i=0; i<length; ++i) {
+        weights[k] += brir[i]*principal_components_[k][i];
+      }
+    }
+    instance.delays[ear_id] = GetBrirDelay(ear, point);
+  }
+  instance.previous_point = point;
+}
+  
+  
+void DatabaseBinauralMic::AddPlaneWaveRelative(const Sample* input_data,
+                                               const Int num_samples,
+                                               const Point& point,
+                                               const Int wave_id,
+                                               Buffer& output_buffer) noexcept {
+  if (principal_components_.empty() || bypass()) {
+    BinauralMic::AddPlaneWaveRelative(input_data, num_samples, point, wave_id,
+                                      output_buffer);
+    return;
+  }
+  
+  auto iterator = components_instances_.find(wave_id);
+  if (iterator == components_instances_.end()) {
+    const Int max_latency = BinauralMicInstance::GetMaxLatency(max_brir_delay_);
+    ComponentsInstance instance = {
+      point, {Signal(), Signal()}, {Signal(), Signal()}, {0.0, 0.0},
+      {DelayFilter(0, max_latency), DelayFilter(0, max_latency)}
+    };
+    UpdateWeights(point, instance);
+    iterator = components_instances_.insert(std::make_pair(wave_id,
+                                                           instance)).first;
+  }
+  ComponentsInstance& instance = iterator->second;
+  
+  // The weights (and the delays) are ramped across the block
+  for (Int ear_id=0; ear_id<2; ++ear_id) {
+    std::copy(instance.weights[ear_id].begin(), instance.weights[ear_id].end(),
+              instance.start_weights[ear_id].begin());
+  }
+  const Time start_delays[2] = {instance.delays[0], instance.delays[1]};
+  if (! IsEqual(point, instance.previous_point)) {
+    UpdateWeights(point, instance);
+  }
+  
+  if ((Int) delayed_input_.size() < num_samples) {
+    delayed_input_.resize(num_samples);
+  }
+  const Int num_components = principal_components_.size();
+  for (Int ear_id=0; ear_id<2; ++ear_id) {
+    const Sample* ear_input = input_data;
+    if (start_delays[ear_id] != 0.0 || instance.delays[ear_id] != 0.0) {
+      BinauralMicInstance::Delay(input_data, num_samples,
+                                 start_delays[ear_id], instance.delays[ear_id],
+                                 instance.delay_filters[ear_id],
+                                 delayed_input_.data());
+      ear_input = delayed_input_.data();
+    }
+    
+    for (Int k=0; k<num_components; ++k) {
+      Signal& bus = component_buses_[ear_id][k];
+      if ((Int) bus.size() < num_samples) { bus.resize(num_samples, 0.0); }
+      const Sample start_weight = instance.start_weights[ear_id][k];
+      const Sample weight_step = (instance.weights[ear_id][k]-start_weight) /
+          ((Sample) num_samples);
+      for (Int i=0; i<num_samples; ++i) {
+        bus[i] += (start_weight+weight_step*((Sample) (i+1)))*ear_input[i];
+      }
+    }
+  }
+}
+  
+  
+void DatabaseBinauralMic::RenderComponents(Buffer& output_buffer) noexcept {
+  const Int num_samples = output_buffer.num_samples();
+  for (Int ear_id=0; ear_id<2; ++ear_id) {
+    const Int channel_id = (ear_id == 0) ?
+        Buffer::kLeftChannel : Buffer::kRightChannel;
+    for (Int k=0; k<(Int)component_buses_[ear_id].size(); ++k) {
+      Signal& bus = component_buses_[ear_id][k];
+      ASSERT((Int) bus.size() <= num_samples);
+      // The filters have to run also when no source has been added (the
+      // bus is empty), to let their tails out.
+      bus.resize(num_samples, 0.0);
+      output_buffer.FilterAddSamples(channel_id, 0, num_samples, bus.data(),
+                                     component_filters_[ear_id][k]);
+      std::fill(bus.begin(), bus.end(), 0.0);
+    }
+  }
+}
+  
+  
+void DatabaseBinauralMic::Reset() noexcept {
+  BinauralMic::Reset();
+  for (auto iterator = components_instances_.begin();
+       iterator != components_instances_.end();
+       ++iterator) {
+    iterator->second.delay_filters[0].Reset();
+    iterator->second.delay_filters[1].Reset();
+  }
+  for (Int ear_id=0; ear_id<2; ++ear_id) {
+    for (Int k=0; k<(Int)component_buses_[ear_id].size(); ++k) {
+      component_filters_[ear_id][k].Reset();
+      std::fill(component_buses_[ear_id][k].begin(),
+                component_buses_[ear_id][k].end(), 0.0);
+    }
+  }
+}
+  
 } // namespace sal
@@ -57,15 +57,103 @@ namespace sal {
 
 CipicMic::CipicMic(const Point& position, const Quaternion& orientation,
                    const std::string& directory, const DataType data_type,
-                   const Int update_length) :
+                   const Int update_length,
+                   const Time sampling_frequency) :
         DatabaseBinauralMic(position, orientation, update_length) {
   
-  azimuths_ = std::vector<sal::Angle>({-80.0,-65.0,-55.0,-45.0,-40.0,-35.0,
+  azimuths_ = GetAzimuths();
+
+  Time database_sampling_frequency = 44100.0;
+  if (data_type == pack) {
+    if (! LoadPack(directory, hrtf_database_left_, hrtf_database_right_,
+                   database_sampling_frequency)) {
+      mcl::Logger::GetInstance().LogErrorToCerr("Cipic pack not found.");
+      ASSERT(false);
+    }
+  } else {
+    hrtf_database_right_ = Load(kRightEar, directory, data_type, azimuths_);
+    hrtf_database_left_ = Load(kLeftEar, directory, data_type, azimuths_);
+  }
+  
+  if (! mcl::IsEqual(sampling_frequency, database_sampling_frequency)) {
+    ResampleDatabase("cipic:" + std::to_string((int) data_type) + ":" + directory,
+                     database_sampling_frequency, sampling_frequency);
+  }
+}
+  
+
+std::vector<sal::Angle> CipicMic::GetAzimuths() noexcept {
+  return std::vector<sal::Angle>({-80.0,-65.0,-55.0,-45.0,-40.0,-35.0,
     -30.0,-25.0,-20.0,-15.0,-10.0,-5.0, 0.0, 5.0, 10.0, 15.0, 20.0, 25.0,
     30.0, 35.0, 40.0, 45.0, 55.0, 65.0, 80.0});
+}
+  
 
-  hrtf_database_right_ = Load(kRightEar, directory, data_type, azimuths_);
-  hrtf_database_left_ = Load(kLeftEar, directory, data_type, azimuths_);
+bool CipicMic::LoadPack(const std::string& file_path,
+                        std::vector<std::vector<Signal> >& hrtf_database_left,
+                        std::vector<std::vector<Signal> >& hrtf_database_right,
+                        Time& sampling_frequency) {
+  HrtfPack hrtf_pack;
+  if (! hrtf_pack.Open(file_path)) { return false; }
+  sampling_frequency = hrtf_pack.sampling_frequency();
+  
+  // The pack has to contain the CIPIC grid: one row per azimuth, and one
+  // column per elevation (checked below)
+  if (hrtf_pack.num_rows() != (Int) GetAzimuths().size()) {
+    mcl::Logger::GetInstance().LogError("The HRTF pack %s does not contain "
+                                        "the CIPIC grid.", file_path.c_str());
+    return false;
+  }
+  
+  // The HRIRs keep the length stored in the pack, which depends on its
+  // sampling frequency
+  hrtf_database_left = hrtf_pack.GetDatabase(kLeftEar);
+  hrtf_database_right = hrtf_pack.GetDatabase(kRightEar);
+  
+  for (Int i=0; i<(Int)hrtf_database_left.size(); ++i) {
+    if (hrtf_database_left[i].size() != NUM_ELEVATIONS_CIPIC) {
+      mcl::Logger::GetInstance().LogError("The HRTF pack %s does not contain "
+                                          "the CIPIC grid.", file_path.c_str());
+      return false;
+    }
+  }
+  return true;
+}
+  
+
+bool CipicMic::WritePack(const std::string& pack_file_path,
+                         const std::string& directory,
+                         const DataType data_type,
+                         const HrtfPack::SampleFormat sample_format,
+                         const Time sampling_frequency) {
+  if (data_type == pack) { return false; } // Nothing to convert
+  
+  const std::vector<sal::Angle> azimuths = GetAzimuths();
+  std::vector<std::vector<Signal> > hrtf_database_left =
+      Load(kLeftEar, directory, data_type, azimuths);
+  std::vector<std::vector<Signal> > hrtf_database_right =
+      Load(kRightEar, directory, data_type, azimuths);
+  if (! mcl::IsEqual(sampling_frequency, 44100.0)) {
+    hrtf_database_left = Resample(hrtf_database_left, 44100.0, sampling_frequency);
+    hrtf_database_right = Resample(hrtf_database_right, 44100.0, sampling_frequency);
+  }
+  
+  std::vector<HrtfPackDirection> directions;
+  for (Int i=0; i<(Int)azimuths.size(); ++i) {
+    for (Int j=0; j<NUM_ELEVATIONS_CIPIC; ++j) {
+      HrtfPackDirection direction;
+      direction.row_id = (std::int32_t) i;
+      direction.column_id = (std::int32_t) j;
+      // Elevations are uniformly spaced by 360/64 deg starting from -45 deg
+      direction.elevation = (float) (-45.0 + 360.0/64.0*((Angle) j));
+      direction.azimuth = (float) azimuths[i];
+      directions.push_back(direction);
+    }
+  }
+  
+  return HrtfPack::Write(pack_file_path, directions,
+                         hrtf_database_left, hrtf_database_right,
+                         sampling_frequency, sample_format);
 }
 
 std::vector<std::vector<Signal> > CipicMic::Load(const Ear ear,
@@ -127,6 +215,28 @@ std::vector<std::vector<Signal> > CipicMic::Load(const Ear ear,
 
 
 Signal CipicMic::GetBrir(const Ear ear, const Point& point) noexcept {
+  Int azimuth_index;
+  Int elevation_index;
+  FindIndices(point, azimuth_index, elevation_index);
+  return (ear == kLeftEar) ?
+          hrtf_database_left_[azimuth_index][elevation_index] :
+          hrtf_database_right_[azimuth_index][elevation_index];
+}
+  
+  
+Time CipicMic::GetBrirDelay(const Ear ear, const Point& point) noexcept {
+  if (hrtf_delays_left_.empty()) { return 0.0; }
+  Int azimuth_index;
+  Int elevation_index;
+  FindIndices(point, azimuth_index, elevation_index);
+  return (ear == kLeftEar) ?
+          hrtf_delays_left_[azimuth_index][elevation_index][0] :
+          hrtf_delays_right_[azimuth_index][elevation_index][0];
+}
+  
+  
+void CipicMic::FindIndices(const Point& point, Int& azimuth_index,
+                           Int& elevation_index) const noexcept {
   // Calculate azimuth
   // For forward looking direction, Azimuth = 0 and elevation =0
   // "positive azimuth coresponds to moving right."
@@ -151,10 +261,8 @@ Signal CipicMic::GetBrir(const Ear ear, const Point& point) noexcept {
   ASSERT((azimuth >= (-90.0-VERY_SMALL)) &
          (azimuth <= (90.0+VERY_SMALL)));
   
-  Int azimuth_index = mcl::MinIndex(mcl::Abs(mcl::Add(azimuths_,
-                                                       -azimuth)));
+  azimuth_index = mcl::MinIndex(mcl::Abs(mcl::Add(azimuths_, -azimuth)));
   
-  Int elevation_index;
   if (elevation < -45.0) {
     elevation_index = 0;
   } else if (elevation > -45.0+360.0/64.0*49.0) {
@@ -165,10 +273,6 @@ Signal CipicMic::GetBrir(const Ear ear, const Point& point) noexcept {
   
   ASSERT((azimuth_index >= 0) & (azimuth_index < (Int)azimuths_.size()));
   ASSERT((elevation_index >= 0) & (elevation_index <= 49));
-  
-  return (ear == kLeftEar) ?
-          hrtf_database_left_[azimuth_index][elevation_index] :
-          hrtf_database_right_[azimuth_index][elevation_index];
 }
   
   
@@ -0,0 +1,109 @@
+/*
+ directiongrid.cpp
+ Spatial Audio Library (SAL)
+ Copyright (c) 2015, Enzo De Sena
+ All rights reserved.
+
+ Authors: Enzo De Sena, enzodesena@gmail.com
+
+ */
+
+#include "directiongrid.h"
+#include "salconstants.h"
+#include <cmath>
+
+using mcl::Point;
+
+namespace sal {
+
+DirectionGrid::DirectionGrid(const Int num_cells_per_side,
+                             const NeighboursFunction& neighbours_function) :
+        num_cells_per_side_(num_cells_per_side),
+        cells_(6*num_cells_per_side*num_cells_per_side) {
+  ASSERT(num_cells_per_side > 0);
+  for (Int i=0; i<(Int)cells_.size(); ++i) {
+    const Point centre = GetCellCentre(i);
+    const Angle elevation = asin(centre.z())/PI*180.0;
+    Angle azimuth = atan2(centre.y(), centre.x())/PI*180.0;
+    azimuth = mcl::Mod(azimuth, 360.0);
+    cells_[i] = neighbours_function(elevation, azimuth);
+    ASSERT(cells_[i].num_neighbours > 0 &&
+           cells_[i].num_neighbours <= kMaxNumNeighbours);
+  }
+}
+
+
+// The faces are numbered +x, -x, +y, -y, +z, -z. On each face, `u` and `v`
+// are the two remaining coordinates (in the order x, y, z) divided by the
+// absolute value of the major one.
+Int DirectionGrid::GetCellId(const Point& point) const noexcept {
+  ASSERT(! IsEmpty());
+  const Sample coordinates[3] = {point.x(), point.y(), point.z()};
+  const Sample abs_coordinates[3] = {std::abs(coordinates[0]),
+    std::abs(coordinates[1]), std::abs(coordinates[2])};
+
+  Int major_axis = 0;
+  if (abs_coordinates[1] > abs_coordinates[major_axis]) { major_axis = 1; }
+  if (abs_coordinates[2] > abs_coordinates[major_axis]) { major_axis = 2; }
+
+  const Sample major = abs_coordinates[major_axis];
+  if (major == 0.0) { return GetCellId(Point(1.0, 0.0, 0.0)); }
+
+  const Int face_id = 2*major_axis + ((coordinates[major_axis] < 0.0) ? 1 : 0);
+  const Int u_axis = (major_axis == 0) ? 1 : 0;
+  const Int v_axis = (major_axis == 2) ? 1 : 2;
+
+  const Sample half_side = ((Sample) num_cells_per_side_)/2.0;
+  Int u_id = (Int) ((coordinates[u_axis]/major + 1.0)*half_side);
+  Int v_id = (Int) ((coordinates[v_axis]/major + 1.0)*half_side);
+  // The edge of the face (u = 1 or v = 1) belongs to the last cell
+  if (u_id >= num_cells_per_side_) { u_id = num_cells_per_side_-1; }
+  if (v_id >= num_cells_per_side_) { v_id = num_cells_per_side_-1; }
+
+  return (face_id*num_cells_per_side_ + u_id)*num_cells_per_side_ + v_id;
+}
+
+
+const DirectionGrid::Cell& DirectionGrid::cell(const Int cell_id) const noexcept {
+  ASSERT(cell_id >= 0 && cell_id < num_cells());
+  return cells_[cell_id];
+}
+
+
+Point DirectionGrid::GetCellCentre(const Int cell_id) const noexcept {
+  ASSERT(cell_id >= 0 && cell_id < num_cells());
+  const Int v_id = cell_id % num_cells_per_side_;
+  const Int u_id = (cell_id / num_cells_per_side_) % num_cells_per_side_;
+  const Int face_id = cell_id / (num_cells_per_side_*num_cells_per_side_);
+
+  const Int major_axis = face_id/2;
+  const Int u_axis = (major_axis == 0) ? 1 : 0;
+  const Int v_axis = (major_axis == 2) ? 1 : 2;
+
+  Sample coordinates[3];
+  coordinates[major_axis] = (face_id%2 == 0) ? 1.0 : -1.0;
+  coordinates[u_axis] = 2.0*(((Sample) u_id)+0.5)/((Sample) num_cells_per_side_)-1.0;
+  coordinates[v_axis] = 2.0*(((Sample) v_id)+0.5)/((Sample) num_cells_per_side_)-1.0;
+
+  return Normalized(Point(coordinates[0], coordinates[1], coordinates[2]));
+}
+
+
+void DirectionGrid::AddNeighbour(const Int row_id, const Int column_id,
+                                 const Sample weight, Cell& cell) noexcept {
+  if (weight == 0.0) { return; }
+  for (Int i=0; i<cell.num_neighbours; ++i) {
+    if (cell.neighbours[i].row_id == row_id &&
+        cell.neighbours[i].column_id == column_id) {
+      cell.neighbours[i].weight += weight;
+      return;
+    }
+  }
+  ASSERT(cell.num_neighbours < kMaxNumNeighbours);
+  cell.neighbours[cell.num_neighbours].row_id = row_id;
+  cell.neighbours[cell.num_neighbours].column_id = column_id;
+  cell.neighbours[cell.num_neighbours].weight = weight;
+  cell.num_neighbours++;
+}
+
+} // namespace sal
@@ -0,0 +1,300 @@
+/*
+ hrtfpack.cpp
+ Spatial Audio Library (SAL)
+ Copyright (c) 2015, Enzo De Sena
+ All rights reserved.
+
+ Authors: Enzo De Sena, enzodesena@gmail.com
+
+ */
+
+#include "hrtfpack.h"
+#include "mcltypes.h"
+#include <fstream>
+#include <cstring>
+#include <algorithm>
+
+#ifndef _WIN32
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <fcntl.h>
+  #include <unistd.h>
+#endif
+
+namespace sal {
+
+HrtfPack::HrtfPack() noexcept :
+        data_(nullptr), size_(0), owns_data_(false),
+        header_(nullptr), directions_(nullptr) {}
+
+
+bool HrtfPack::Open(const std::string& file_path) noexcept {
+  Close();
+
+#ifndef _WIN32
+  int file_descriptor = open(file_path.c_str(), O_RDONLY);
+  if (file_descriptor < 0) {
+    mcl::Logger::GetInstance().LogError("Could not open HRTF pack %s.",
+                                        file_path.c_str());
+    return false;
+  }
+  struct stat file_status;
+  if (fstat(file_descriptor, &file_status) != 0 ||
+      file_status.st_size < (off_t) sizeof(HrtfPackHeader)) {
+    close(file_descriptor);
+    mcl::Logger::GetInstance().LogError("HRTF pack %s is too short.",
+                                        file_path.c_str());
+    return false;
+  }
+  size_ = (std::uint64_t) file_status.st_size;
+  void* mapped = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE,
+                      file_descriptor, 0);
+  close(file_descriptor); // The mapping stays valid after closing.
+  if (mapped == MAP_FAILED) {
+    size_ = 0;
+    mcl::Logger::GetInstance().LogError("Could not map HRTF pack %s.",
+                                        file_path.c_str());
+    return false;
+  }
+  data_ = (const char*) mapped;
+  owns_data_ = false;
+#else
+  std::ifstream file;
+  file.open(file_path, std::ios::in | std::ios::binary | std::ios::ate);
+  if (! file.good()) {
+    mcl::Logger::GetInstance().LogError("Could not open HRTF pack %s.",
+                                        file_path.c_str());
+    return false;
+  }
+  size_ = (std::uint64_t) file.tellg();
+  if (size_ < sizeof(HrtfPackHeader)) {
+    size_ = 0;
+    mcl::Logger::GetInstance().LogError("HRTF pack %s is too short.",
+                                        file_path.c_str());
+    return false;
+  }
+  // Allocating as double guarantees the alignment of the samples
+  // (the HRIRs are aligned relative to the start of the file).
+  char* buffer = (char*) new double[size_/sizeof(double)+1];
+  file.seekg(0, std::ios::beg);
+  file.read(buffer, size_);
+  data_ = buffer;
+  owns_data_ = true;
+#endif
+
+  header_ = (const HrtfPackHeader*) data_;
+  directions_ = (const HrtfPackDirection*) (data_ + header_->directions_offset);
+
+  if (! Validate()) {
+    mcl::Logger::GetInstance().LogError("%s is not a valid HRTF pack.",
+                                        file_path.c_str());
+    Close();
+    return false;
+  }
+  return true;
+}
+
+
+void HrtfPack::Close() noexcept {
+  if (data_ == nullptr) { return; }
+  if (owns_data_) {
+    delete[] (double*) data_;
+  } else {
+#ifndef _WIN32
+    munmap((void*) data_, size_);
+#endif
+  }
+  data_ = nullptr;
+  size_ = 0;
+  header_ = nullptr;
+  directions_ = nullptr;
+}
+
+
+bool HrtfPack::Validate() const noexcept {
+  if (std::strncmp(header_->magic, "SALHRTF", 8) != 0) { return false; }
+  if (header_->byte_order_mark != kByteOrderMark) { return false; }
+  if (header_->version != kVersion) { return false; }
+  if (header_->sample_format != kFloat32 &&
+      header_->sample_format != kFloat64) { return false; }
+  if (header_->stride < header_->num_samples) { return false; }
+
+  const std::uint64_t directions_end = header_->directions_offset +
+      ((std::uint64_t) header_->num_directions)*sizeof(HrtfPackDirection);
+  const std::uint64_t data_end = header_->data_offset +
+      2*((std::uint64_t) header_->num_directions)*header_->stride*
+      SampleSize((SampleFormat) header_->sample_format);
+  if (directions_end > header_->data_offset || data_end > size_) {
+    return false;
+  }
+  if (header_->data_offset % kAlignment != 0) { return false; }
+
+  for (std::uint32_t i=0; i<header_->num_directions; ++i) {
+    if (directions_[i].row_id < 0 ||
+        directions_[i].row_id >= (std::int32_t) header_->num_rows ||
+        directions_[i].column_id < 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+
+Int HrtfPack::SampleSize(const SampleFormat sample_format) noexcept {
+  return (sample_format == kFloat32) ? sizeof(float) : sizeof(double);
+}
+
+
+Int HrtfPack::num_rows() const noexcept {
+  ASSERT(IsOpen());
+  return header_->num_rows;
+}
+
+Int HrtfPack::num_directions() const noexcept {
+  ASSERT(IsOpen());
+  return header_->num_directions;
+}
+
+Int HrtfPack::num_samples() const noexcept {
+  ASSERT(IsOpen());
+  return header_->num_samples;
+}
+
+Time HrtfPack::sampling_frequency() const noexcept {
+  ASSERT(IsOpen());
+  return header_->sampling_frequency;
+}
+
+HrtfPack::SampleFormat HrtfPack::sample_format() const noexcept {
+  ASSERT(IsOpen());
+  return (SampleFormat) header_->sample_format;
+}
+
+
+const HrtfPackDirection& HrtfPack::direction(const Int direction_id) const noexcept {
+  ASSERT(IsOpen());
+  ASSERT(direction_id >= 0 && direction_id < num_directions());
+  return directions_[direction_id];
+}
+
+
+const void* HrtfPack::GetRawHrir(const Ear ear,
+                                 const Int direction_id) const noexcept {
+  ASSERT(IsOpen());
+  ASSERT(direction_id >= 0 && direction_id < num_directions());
+  const std::uint64_t hrir_id = (ear == kLeftEar) ?
+      direction_id : header_->num_directions + direction_id;
+  return data_ + header_->data_offset +
+         hrir_id*header_->stride*SampleSize(sample_format());
+}
+
+
+void HrtfPack::GetHrir(const Ear ear, const Int direction_id,
+                       Sample* output_data) const noexcept {
+  const Int length = num_samples();
+  if (sample_format() == kFloat32) {
+    const float* hrir = (const float*) GetRawHrir(ear, direction_id);
+    for (Int i=0; i<length; ++i) { output_data[i] = (Sample) hrir[i]; }
+  } else {
+    const double* hrir = (const double*) GetRawHrir(ear, direction_id);
+    for (Int i=0; i<length; ++i) { output_data[i] = (Sample) hrir[i]; }
+  }
+}
+
+
+std::vector<std::vector<Signal> > HrtfPack::GetDatabase(const Ear ear) const {
+  ASSERT(IsOpen());
+  std::vector<std::vector<Signal> > hrtf_database(num_rows());
+  for (Int i=0; i<num_directions(); ++i) {
+    const HrtfPackDirection& point = directions_[i];
+    std::vector<Signal>& row = hrtf_database[point.row_id];
+    if ((Int) row.size() <= point.column_id) { row.resize(point.column_id+1); }
+    row[point.column_id] = Signal(num_samples());
+    GetHrir(ear, i, row[point.column_id].data());
+  }
+  return hrtf_database;
+}
+
+
+bool HrtfPack::Write(const std::string& file_path,
+                     const std::vector<HrtfPackDirection>& directions,
+                     const std::vector<std::vector<Signal> >& hrtf_database_left,
+                     const std::vector<std::vector<Signal> >& hrtf_database_right,
+                     const Time sampling_frequency,
+                     const SampleFormat sample_format) {
+  ASSERT(hrtf_database_left.size() == hrtf_database_right.size());
+  const Int num_directions = directions.size();
+
+  Int num_samples = 0;
+  for (Int i=0; i<num_directions; ++i) {
+    const Int row_id = directions[i].row_id;
+    const Int column_id = directions[i].column_id;
+    ASSERT(row_id >= 0 && row_id < (Int) hrtf_database_left.size());
+    ASSERT(column_id >= 0 && column_id < (Int) hrtf_database_left[row_id].size());
+    num_samples = std::max(num_samples,
+                           (Int) hrtf_database_left[row_id][column_id].size());
+    num_samples = std::max(num_samples,
+                           (Int) hrtf_database_right[row_id][column_id].size());
+  }
+
+  const Int sample_size = SampleSize(sample_format);
+  const Int samples_per_alignment = kAlignment/sample_size;
+  const Int stride = ((num_samples+samples_per_alignment-1)/
+                      samples_per_alignment)*samples_per_alignment;
+
+  HrtfPackHeader header;
+  std::memset(&header, 0, sizeof(HrtfPackHeader));
+  std::strncpy(header.magic, "SALHRTF", 8);
+  header.byte_order_mark = kByteOrderMark;
+  header.version = kVersion;
+  header.sample_format = sample_format;
+  header.num_rows = hrtf_database_left.size();
+  header.num_directions = num_directions;
+  header.num_samples = num_samples;
+  header.stride = stride;
+  header.sampling_frequency = sampling_frequency;
+  header.directions_offset = sizeof(HrtfPackHeader);
+  const std::uint64_t directions_end = header.directions_offset +
+      num_directions*sizeof(HrtfPackDirection);
+  header.data_offset = ((directions_end+kAlignment-1)/kAlignment)*kAlignment;
+
+  std::ofstream file;
+  file.open(file_path, std::ios::out | std::ios::binary | std::ios::trunc);
+  if (! file.good()) {
+    mcl::Logger::GetInstance().LogError("Could not write HRTF pack %s.",
+                                        file_path.c_str());
+    return false;
+  }
+
+  file.write((const char*) &header, sizeof(HrtfPackHeader));
+  file.write((const char*) directions.data(),
+             num_directions*sizeof(HrtfPackDirection));
+  const std::vector<char> padding(header.data_offset-directions_end, 0);
+  file.write(padding.data(), padding.size());
+
+  std::vector<float> hrir_float(stride);
+  std::vector<double> hrir_double(stride);
+  for (Int ear_id=0; ear_id<2; ++ear_id) {
+    const std::vector<std::vector<Signal> >& hrtf_database =
+        (ear_id == 0) ? hrtf_database_left : hrtf_database_right;
+    for (Int i=0; i<num_directions; ++i) {
+      const Signal& hrir =
+          hrtf_database[directions[i].row_id][directions[i].column_id];
+      for (Int k=0; k<stride; ++k) {
+        const Sample value = (k < (Int) hrir.size()) ? hrir[k] : 0.0;
+        hrir_float[k] = (float) value;
+        hrir_double[k] = (double) value;
+      }
+      if (sample_format == kFloat32) {
+        file.write((const char*) hrir_float.data(), stride*sample_size);
+      } else {
+        file.write((const char*) hrir_double.data(), stride*sample_size);
+      }
+    }
+  }
+
+  file.close();
+  return ! file.fail();
+}
+
+} // namespace sal
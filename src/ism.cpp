@@ -8,6 +8,10 @@
 #include "ism.h"
 #include "salconstants.h"
 #include "randomop.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
 
 using sal::Time;
 using sal::Length;
@@ -25,6 +29,20 @@ using mcl::Abs;
 using sal::Length;
 
 namespace sal {
+  
+  
+// Only the cells of the grid of the late images are used, and not their
+// neighbours, which are set to a placeholder
+static DirectionGrid::Cell PlaceholderCell(const Angle elevation,
+                                           const Angle azimuth) {
+  DirectionGrid::Cell cell;
+  cell.num_neighbours = 1;
+  cell.neighbours[0].row_id = 0;
+  cell.neighbours[0].column_id = 0;
+  cell.neighbours[0].weight = 1.0;
+  return cell;
+}
+  
 
 Ism::Ism(Room* const room,
          Source* const source,
@@ -38,160 +56,796 @@ Ism::Ism(Room* const room,
         sampling_frequency_(sampling_frequency),
         random_distance_(0),
         peterson_window_(0.004), // Standard value in Peterson's paper
-        modified_(true)
+        peterson_num_taps_(0),
+        convolver_(mcl::Zeros<Sample>(rir_length)),
+        sparse_crossover_(0.0),
+        sparse_convolver_(rir_length-1, rir_length),
+        early_max_order_(2),
+        early_max_time_(-1.0),
+        early_delay_filter_(0, rir_length+1),
+        late_grid_(1, PlaceholderCell),
+        streaming_order_(-1),
+        is_streaming_initialised_(false),
+        next_chunk_id_(0), num_chunks_(0), chunk_length_(0),
+        is_stopping_(false),
+        modified_(true),
+        streaming_modified_(true),
+        num_threads_(1),
+        amplitude_threshold_(0.0),
+        max_reflection_order_(-1)
   {}
   
   
+Ism::~Ism() { StopWorkers(); }
+  
+  
+void Ism::SetNumThreads(const Int num_threads) {
+  ASSERT(num_threads > 0);
+  StopWorkers();
+  num_threads_ = num_threads;
+  for (Int i=1; i<num_threads_; ++i) {
+    workers_.push_back(std::thread(&Ism::RunWorker, this));
+  }
+}
+  
+  
+void Ism::StopWorkers() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    is_stopping_ = true;
+  }
+  chunks_available_.notify_all();
+  for (Int i=0; i<(Int) workers_.size(); ++i) { workers_[i].join(); }
+  workers_.clear();
+  is_stopping_ = false;
+}
+  
+  
+  
+  
+// Minimum number of images of the lattice that are processed together
+static const Int kMinChunkLength = 1024;
+  
+// Number of phases per sample of the table of Peterson's kernel, which is
+// interpolated linearly between phases
+static const Int kPetersonOversampling = 128;
+  
+  
+static bool IsSamePosition(const Point& point_a, const Point& point_b) {
+  return point_a.x() == point_b.x() && point_a.y() == point_b.y() &&
+         point_a.z() == point_b.z();
+}
   
   
 void Ism::Run(const Sample* input_data, const Int num_samples,
               Buffer& output_buffer) {
-  if (modified_) { Ism::CalculateRir(); }
+  if (streaming_order_ >= 0) {
+    RunStreaming(input_data, num_samples, output_buffer);
+    return;
+  }
   
-  // TODO: I still need to test the spatialised implementation
+  const bool is_lattice_stale = modified_ ||
+      ! IsSamePosition(source_->position(), lattice_source_position_);
+  if (is_lattice_stale) { CalculateLattice(); }
+  if (is_lattice_stale ||
+      ! IsSamePosition(microphone_->position(), rir_mic_position_)) {
+    CalculateRir();
+    if (microphone_->IsOmni()) {
+      UpdateOmniConvolvers();
+    } else {
+      CalculateSpatialRirs();
+    }
+  }
+  modified_ = false;
+  
+  // This only allocates when the blocks become longer
+  if ((Int) convolved_.size() < num_samples) { convolved_.resize(num_samples); }
   if (microphone_->IsOmni()) {
-    mcl::FirFilter filter(rir_);
-    assert(num_samples<MCL_MAX_VLA_LENGTH);
-    Sample temp[num_samples];
-    filter.Filter(input_data, num_samples, temp);
-    microphone_->AddPlaneWave(temp, num_samples, mcl::Point(0,0,0), output_buffer);
+    convolver_.Filter(input_data, num_samples, convolved_.data());
+    if (sparse_crossover_ > 0.0) {
+      if ((Int) sparse_convolved_.size() < num_samples) {
+        sparse_convolved_.resize(num_samples);
+      }
+      sparse_convolver_.Filter(input_data, num_samples,
+                               sparse_convolved_.data());
+      for (Int i=0; i<num_samples; ++i) {
+        convolved_[i] += sparse_convolved_[i];
+      }
+    }
+    microphone_->AddPlaneWave(convolved_.data(), num_samples,
+                              mcl::Point(0,0,0), output_buffer);
   } else {
-    ASSERT(false);
+    RunSpatial(input_data, num_samples, output_buffer);
   }
 }
   
   
-/** Calculates the Rir. This is called by Run() before filtering. */
-void Ism::CalculateRir() {
-  mcl::Matrix<Sample> beta(2,3);
+void Ism::UpdateOmniConvolvers() {
+  early_tap_delays_.clear();
+  early_tap_gains_.clear();
+  if (sparse_crossover_ == 0.0) {
+    convolver_.SetFilter(rir_);
+    return;
+  }
+  
+  const Int crossover_length = std::min(rir_length_,
+      mcl::RoundToInt(sparse_crossover_*sampling_frequency_));
+  dense_rir_.assign(rir_.begin(), rir_.end());
+  for (Int i=0; i<crossover_length; ++i) {
+    if (rir_[i] == 0.0) { continue; }
+    early_tap_delays_.push_back(i);
+    early_tap_gains_.push_back(rir_[i]);
+    dense_rir_[i] = 0.0;
+  }
+  sparse_convolver_.SetTaps(early_tap_delays_, early_tap_gains_);
+  convolver_.SetFilter(dense_rir_);
+}
+  
+  
+void Ism::CalculateSpatialRirs() {
+  const Int num_cells = late_grid_.num_cells();
+  if ((Int) late_convolvers_.size() != num_cells) {
+    late_convolvers_.clear();
+    for (Int cell_id=0; cell_id<num_cells; ++cell_id) {
+      late_convolvers_.push_back(
+          PartitionedConvolver(mcl::Zeros<Sample>(rir_length_)));
+    }
+  }
+  late_rirs_.resize(num_cells);
+  for (Int cell_id=0; cell_id<num_cells; ++cell_id) {
+    late_rirs_[cell_id].assign(rir_length_, 0.0);
+  }
+  early_ids_.clear();
+  early_slot_ids_.clear();
+  early_delays_.clear();
+  early_attenuations_.clear();
+  
+  const Point mic_position = microphone_->position();
+  const Int num_images = lattice_.x.size();
+  for (Int i=0; i<num_images; ++i) {
+    const Time delay = lattice_.delays[i];
+    if (! IsInRir(delay)) { continue; }
+    const Sample attenuation = lattice_.gains[i]/(delay*sampling_frequency_);
+    if (IsEarly(lattice_.orders[i], delay)) {
+      // Without interpolation the delays are rounded as in the RIR
+      const Time delay_norm = delay*sampling_frequency_;
+      early_ids_.push_back(i);
+      early_slot_ids_.push_back(-1);
+      early_delays_.push_back((interpolation_ == none) ?
+                              (Time) mcl::RoundToInt(delay_norm) : delay_norm);
+      early_attenuations_.push_back(attenuation);
+    } else {
+      const Int cell_id = late_grid_.GetCellId(
+          Point(lattice_.x[i]-mic_position.x(),
+                lattice_.y[i]-mic_position.y(),
+                lattice_.z[i]-mic_position.z()));
+      WriteSample(delay, attenuation, late_rirs_[cell_id]);
+    }
+  }
+  
+  for (Int cell_id=0; cell_id<num_cells; ++cell_id) {
+    late_convolvers_[cell_id].SetFilter(late_rirs_[cell_id]);
+  }
+  
+  // The images that were already early keep their slots, and the others
+  // take the first free slots
+  const Int num_early = early_ids_.size();
+  std::map<ImageKey, Int> slots;
+  std::vector<bool> is_slot_used(std::max(num_early,
+                                          (Int) early_slots_.size()), false);
+  for (Int j=0; j<num_early; ++j) {
+    const ImageKey& key = lattice_.keys[early_ids_[j]];
+    std::map<ImageKey, Int>::const_iterator slot = early_slots_.find(key);
+    if (slot != early_slots_.end()) {
+      early_slot_ids_[j] = slot->second;
+      is_slot_used[slot->second] = true;
+      slots[key] = slot->second;
+    }
+  }
+  Int free_slot_id = 0;
+  for (Int j=0; j<num_early; ++j) {
+    if (early_slot_ids_[j] >= 0) { continue; }
+    while (is_slot_used[free_slot_id]) { ++free_slot_id; }
+    early_slot_ids_[j] = free_slot_id;
+    is_slot_used[free_slot_id] = true;
+    slots[lattice_.keys[early_ids_[j]]] = free_slot_id;
+  }
+  early_slots_.swap(slots);
+}
+  
+  
+void Ism::RunSpatial(const Sample* input_data, const Int num_samples,
+                     Buffer& output_buffer) {
+  // The late images use the wave_ids from 0 to num_cells-1, and the early
+  // images num_cells plus their slot
+  const Point mic_position = microphone_->position();
+  const Int num_cells = late_grid_.num_cells();
+  for (Int cell_id=0; cell_id<num_cells; ++cell_id) {
+    late_convolvers_[cell_id].Filter(input_data, num_samples,
+                                     convolved_.data());
+    const Point centre = late_grid_.GetCellCentre(cell_id);
+    microphone_->AddPlaneWave(convolved_.data(), num_samples,
+                              Point(mic_position.x()+centre.x(),
+                                    mic_position.y()+centre.y(),
+                                    mic_position.z()+centre.z()),
+                              cell_id, output_buffer);
+  }
+  
+  const Int num_early = early_ids_.size();
+  if ((Int) early_signals_.size() < num_early*num_samples) {
+    early_signals_.resize(num_early*num_samples);
+  }
+  Sample* signals = early_signals_.data();
+  for (Int i=0; i<num_samples; ++i) {
+    early_delay_filter_.Write(input_data[i]);
+    for (Int j=0; j<num_early; ++j) {
+      signals[j*num_samples+i] = early_attenuations_[j] *
+          early_delay_filter_.FractionalReadAt(early_delays_[j]);
+    }
+    early_delay_filter_.Tick();
+  }
+  for (Int j=0; j<num_early; ++j) {
+    const Int id = early_ids_[j];
+    microphone_->AddPlaneWave(signals+j*num_samples, num_samples,
+                              Point(lattice_.x[id], lattice_.y[id],
+                                    lattice_.z[id]),
+                              num_cells+early_slot_ids_[j], output_buffer);
+  }
+}
+  
+  
+void Ism::CalculateStreamingImages() {
   std::vector<mcl::IirFilter> filters = room_->wall_filters();
-  beta.SetElement(0, 0, filters[0].B()[0]); // beta_{x1}
-  beta.SetElement(0, 1, filters[2].B()[0]); // beta_{y1}
-  beta.SetElement(0, 2, filters[4].B()[0]); // beta_{z1}
+  const Triplet dimensions = ((CuboidRoom*)room_)->dimensions();
+  const Length lengths[3] = {dimensions.x(), dimensions.y(), dimensions.z()};
+  
+  // With the source at the origin, the coordinates of the images are the
+  // offsets. Along each axis, the order is at least 2|m|-1.
+  const Int n = streaming_order_/2+1;
+  ImageAxis axes[3];
+  for (Int i=0; i<3; ++i) {
+    axes[i] = CalculateImageAxis(n, lengths[i], 0.0,
+                                 filters[2*i].B()[0], filters[2*i+1].B()[0]);
+  }
+  
+  streaming_signs_.clear();
+  streaming_offsets_.clear();
+  streaming_gains_.clear();
+  const Int num_ids = axes[0].orders.size();
+  for (Int x_id=0; x_id<num_ids; ++x_id) {
+    for (Int y_id=0; y_id<num_ids; ++y_id) {
+      for (Int z_id=0; z_id<num_ids; ++z_id) {
+        const Int ids[3] = {x_id, y_id, z_id};
+        if (axes[0].orders[x_id]+axes[1].orders[y_id]+axes[2].orders[z_id] >
+            streaming_order_) { continue; }
+        for (Int i=0; i<3; ++i) {
+          // The index is 2*(m+n)+p, and the sign is 1-2p
+          streaming_signs_.push_back((ids[i] % 2 == 0) ? 1.0 : -1.0);
+          streaming_offsets_.push_back(axes[i].coordinates[ids[i]]);
+        }
+        streaming_gains_.push_back(axes[0].gains[x_id]*axes[1].gains[y_id] *
+                                   axes[2].gains[z_id]);
+      }
+    }
+  }
   
-  beta.SetElement(1, 0, filters[1].B()[0]); // beta_{x2}
-  beta.SetElement(1, 1, filters[3].B()[0]); // beta_{y2}
-  beta.SetElement(1, 2, filters[5].B()[0]); // beta_{z2}
+  const Int num_images = streaming_gains_.size();
+  streaming_delays_.assign(num_images, 0.0);
+  streaming_attenuations_.assign(num_images, 0.0);
+  streaming_delay_steps_.assign(num_images, 0.0);
+  streaming_attenuation_steps_.assign(num_images, 0.0);
+  is_streaming_initialised_ = false;
+}
   
-  Length room_x = ((CuboidRoom*)room_)->dimensions().x();
-  Length room_y = ((CuboidRoom*)room_)->dimensions().y();
-  Length room_z = ((CuboidRoom*)room_)->dimensions().z();
   
-  rir_ = mcl::Zeros<sal::Sample>(rir_length_);
+void Ism::RunStreaming(const Sample* input_data, const Int num_samples,
+                       Buffer& output_buffer) {
+  if (streaming_modified_) {
+    CalculateStreamingImages();
+    streaming_modified_ = false;
+  }
   
-  Time rir_time = ((Time)rir_length_)/((Time)sampling_frequency_);
-  Int n1 = (Int) floor(rir_time/(((Length)room_x)*2.0))+1;
-  Int n2 = (Int) floor(rir_time/(((Length)room_y)*2.0))+1;
-  Int n3 = (Int) floor(rir_time/(((Length)room_z)*2.0))+1;
+  const Int num_images = streaming_gains_.size();
+  const Point source_position = source_->position();
+  const Length source_coordinates[3] = {source_position.x(),
+    source_position.y(), source_position.z()};
+  const Point mic_position = microphone_->position();
+  const Length mic_coordinates[3] = {mic_position.x(), mic_position.y(),
+    mic_position.z()};
   
-  Int max_num_images = 8*(2*n1+1)*(2*n2+1)*(2*n3+1);
+  // The targets, reached at the end of the block
+  const Time max_delay = (Time) (rir_length_-1);
+  for (Int j=0; j<num_images; ++j) {
+    Length distance_2 = 0.0;
+    for (Int i=0; i<3; ++i) {
+      const Length coordinate = streaming_signs_[3*j+i]*source_coordinates[i] +
+          streaming_offsets_[3*j+i];
+      distance_2 += (coordinate-mic_coordinates[i]) *
+                    (coordinate-mic_coordinates[i]);
+    }
+    const Time delay = sqrt(distance_2)/SOUND_SPEED;
+    // The images beyond the RIR fade out
+    const Sample attenuation = IsInRir(delay) ?
+        streaming_gains_[j]/(delay*sampling_frequency_) : 0.0;
+    const Time delay_norm = std::min(delay*sampling_frequency_, max_delay);
+    if (! is_streaming_initialised_) {
+      // Start from the right parameters rather than ramping from zero
+      streaming_delays_[j] = delay_norm;
+      streaming_attenuations_[j] = attenuation;
+    }
+    streaming_delay_steps_[j] = (delay_norm-streaming_delays_[j]) /
+        ((Time) num_samples);
+    streaming_attenuation_steps_[j] = (attenuation-streaming_attenuations_[j]) /
+        ((Sample) num_samples);
+    // These are now the targets, and are ramped towards below
+    streaming_delays_[j] = delay_norm;
+    streaming_attenuations_[j] = attenuation;
+  }
+  is_streaming_initialised_ = true;
+  
+  // This only allocates when the blocks become longer
+  const bool is_omni = microphone_->IsOmni();
+  const Int num_signals = is_omni ? 1 : num_images;
+  if ((Int) early_signals_.size() < num_signals*num_samples) {
+    early_signals_.resize(num_signals*num_samples);
+  }
+  Sample* signals = early_signals_.data();
+  const Time* delays = streaming_delays_.data();
+  const Sample* attenuations = streaming_attenuations_.data();
+  const Time* delay_steps = streaming_delay_steps_.data();
+  const Sample* attenuation_steps = streaming_attenuation_steps_.data();
+  for (Int i=0; i<num_samples; ++i) {
+    early_delay_filter_.Write(input_data[i]);
+    // Number of steps left to the targets
+    const Sample steps_left = (Sample) (num_samples-1-i);
+    Sample sum = 0.0;
+    for (Int j=0; j<num_images; ++j) {
+      const Sample sample = (attenuations[j]-steps_left*attenuation_steps[j]) *
+          early_delay_filter_.FractionalReadAt(delays[j] -
+                                               steps_left*delay_steps[j]);
+      if (is_omni) {
+        sum += sample;
+      } else {
+        signals[j*num_samples+i] = sample;
+      }
+    }
+    if (is_omni) { signals[i] = sum; }
+    early_delay_filter_.Tick();
+  }
+  
+  if (is_omni) {
+    microphone_->AddPlaneWave(signals, num_samples, mcl::Point(0,0,0),
+                              output_buffer);
+  } else {
+    for (Int j=0; j<num_images; ++j) {
+      const Point image_position(
+          streaming_signs_[3*j]*source_coordinates[0]+streaming_offsets_[3*j],
+          streaming_signs_[3*j+1]*source_coordinates[1] +
+              streaming_offsets_[3*j+1],
+          streaming_signs_[3*j+2]*source_coordinates[2] +
+              streaming_offsets_[3*j+2]);
+      microphone_->AddPlaneWave(signals+j*num_samples, num_samples,
+                                image_position, j, output_buffer);
+    }
+  }
+}
   
-  images_delay_.reserve(max_num_images);
-  images_position_.reserve(max_num_images);
-  images_int_delay_filter_.reserve(max_num_images);
-  images_frac_delay_filter_.reserve(max_num_images);
   
-  mcl::RandomGenerator randn_gen;
-  std::vector<sal::Length> rand_delays;
+void Ism::SetLateDirectionResolution(const Int num_cells_per_side) {
+  late_grid_ = DirectionGrid(num_cells_per_side, PlaceholderCell);
+  modified_ = true;
+  streaming_modified_ = true;
+}
+  
+  
+/**
+ Calculates the images that may fall within the RIR for any position of the
+ microphone in the room, i.e. those whose distance from the room is within
+ the length of the RIR.
+ */
+void Ism::CalculateLattice() {
+  // The table does not depend on the microphone either
+  if (interpolation_ == peterson) { CalculatePetersonTable(); }
+  
+  std::vector<mcl::IirFilter> filters = room_->wall_filters();
+  const Triplet dimensions = ((CuboidRoom*)room_)->dimensions();
+  const Length lengths[3] = {dimensions.x(), dimensions.y(), dimensions.z()};
+  const Point source_position = source_->position();
+  const Length source_coordinates[3] = {source_position.x(),
+    source_position.y(), source_position.z()};
   
-  Int k;
   bool randomisation = (mcl::IsEqual(random_distance_, 0.0)) ? false : true;
+  Time rir_time = ((Time)rir_length_)/((Time)sampling_frequency_);
+  const Length max_distance = (rir_time+std::abs(random_distance_))*SOUND_SPEED;
+  
+  ImageAxis axes[3];
+  for (Int i=0; i<3; ++i) {
+    Int n = (Int) floor(max_distance/(lengths[i]*2.0))+1;
+    // The filters are ordered as x1, x2, y1, y2, z1, z2
+    axes[i] = CalculateImageAxis(n, lengths[i], source_coordinates[i],
+                                 filters[2*i].B()[0], filters[2*i+1].B()[0]);
+  }
+  
+  // The images are enumerated shell by shell, i.e. by increasing number of
+  // reflections along each axis. The loops stop as soon as all the images
+  // that are left have too many reflections, are too far or are below the
+  // amplitude threshold.
+  lattice_ = ImageLattice();
+  const ImageAxis& axis_x = axes[0];
+  const ImageAxis& axis_y = axes[1];
+  const ImageAxis& axis_z = axes[2];
+  const Int num_x = axis_x.sorted_ids.size();
+  const Int num_y = axis_y.sorted_ids.size();
+  const Int num_z = axis_z.sorted_ids.size();
+  const Length max_distance_2 = max_distance*max_distance;
+  for (Int qx=0; qx<num_x; ++qx) {
+    const Int x_id = axis_x.sorted_ids[qx];
+    const Int x_order = axis_x.orders[x_id];
+    const Length x_distance = axis_x.room_distances[x_id];
+    const Length x_distance_2 = x_distance*x_distance;
+    if (IsAboveMaxOrder(x_order) ||
+        axis_x.min_room_distances[qx] > max_distance ||
+        IsBelowThreshold(axis_x.max_gains[qx]*axis_y.max_gains[0] *
+                         axis_z.max_gains[0],
+                         axis_x.min_room_distances[qx])) { break; }
+    
+    for (Int qy=0; qy<num_y; ++qy) {
+      const Int y_id = axis_y.sorted_ids[qy];
+      const Int xy_order = x_order+axis_y.orders[y_id];
+      const Length y_distance = axis_y.room_distances[y_id];
+      const Length min_y_distance = axis_y.min_room_distances[qy];
+      const Length xy_distance_2 = x_distance_2 + y_distance*y_distance;
+      const Length min_xy_distance_2 = x_distance_2 +
+                                       min_y_distance*min_y_distance;
+      const Sample xy_gain = axis_x.gains[x_id]*axis_y.gains[y_id];
+      if (IsAboveMaxOrder(xy_order) || min_xy_distance_2 > max_distance_2 ||
+          IsBelowThreshold(std::abs(axis_x.gains[x_id])*axis_y.max_gains[qy] *
+                           axis_z.max_gains[0],
+                           sqrt(min_xy_distance_2))) { break; }
+      
+      for (Int qz=0; qz<num_z; ++qz) {
+        const Int z_id = axis_z.sorted_ids[qz];
+        const Length z_distance = axis_z.room_distances[z_id];
+        const Length min_z_distance = axis_z.min_room_distances[qz];
+        const Length min_distance_2 = xy_distance_2 +
+                                      min_z_distance*min_z_distance;
+        if (IsAboveMaxOrder(xy_order+axis_z.orders[z_id]) ||
+            min_distance_2 > max_distance_2 ||
+            IsBelowThreshold(std::abs(xy_gain)*axis_z.max_gains[qz],
+                             sqrt(min_distance_2))) { break; }
+        
+        const Length distance_2 = xy_distance_2 + z_distance*z_distance;
+        const Sample gain = xy_gain*axis_z.gains[z_id];
+        if (distance_2 > max_distance_2 ||
+            IsBelowThreshold(std::abs(gain), sqrt(distance_2))) { continue; }
+        lattice_.x.push_back(axis_x.coordinates[x_id]);
+        lattice_.y.push_back(axis_y.coordinates[y_id]);
+        lattice_.z.push_back(axis_z.coordinates[z_id]);
+        lattice_.gains.push_back(gain);
+        lattice_.orders.push_back(xy_order+axis_z.orders[z_id]);
+        // The ids are 2*(m+n)+p, with num_ids = 2*(2*n+1)
+        const ImageKey key = {{x_id-(num_x/2-1), y_id-(num_y/2-1),
+                               z_id-(num_z/2-1)}};
+        lattice_.keys.push_back(key);
+      }
+    }
+  }
+  
+  const Int num_images = lattice_.x.size();
   if (randomisation) {
+    mcl::RandomGenerator randn_gen;
     sal::Time top_limit = random_distance_;
-    rand_delays = mcl::Add(mcl::Multiply<sal::Time>(randn_gen.Rand(max_num_images),
-                                                    2.0*top_limit),
-                           -top_limit);
-    k = 0;
+    lattice_.random_delays =
+        mcl::Add(mcl::Multiply<sal::Time>(randn_gen.Rand(num_images),
+                                          2.0*top_limit),
+                 -top_limit);
+  } else {
+    lattice_.random_delays = mcl::Zeros<sal::Time>(num_images);
   }
+  lattice_.delays = mcl::Zeros<sal::Time>(num_images);
+  lattice_source_position_ = source_position;
+}
   
-  for (Int mx=-n1; mx<=n1; ++mx) {
-    for (Int my=-n2; my<=n2; ++my) {
-      for (Int mz=-n3; mz<=n3; ++mz) {
-        
-        for (Int px=0; px<=1; ++px) {
-          for (Int py=0; py<=1; ++py) {
-            for (Int pz=0; pz<=1; ++pz) {
-       
-             Point image_position =
-              ((CuboidRoom*)room_)->ImageSourcePosition(source_->position(),
-                                                        mx, my, mz,
-                                                        px, py, pz);
-              
-              Time delay =
-              mcl::Subtract(image_position,
-                            microphone_->position()).norm()/SOUND_SPEED;
-              
-              if (randomisation) { delay += rand_delays.at(k++); }
-              
-              if (round(delay*sampling_frequency_) < 0 ||
-                  round(delay*sampling_frequency_) >= rir_length_) { continue; }
-              
-              Sample gid = Pow(beta.GetElement(0,0), Abs((Sample)mx-px)) *
-                           Pow(beta.GetElement(1,0), Abs((Sample)mx)) *
-                           Pow(beta.GetElement(0,1), Abs((Sample)my-py)) *
-                           Pow(beta.GetElement(1,1), Abs((Sample)my)) *
-                           Pow(beta.GetElement(0,2), Abs((Sample)mz-pz)) *
-                           Pow(beta.GetElement(1,2), Abs((Sample)mz));
-              
-              Sample attenuation = gid/(delay*sampling_frequency_);
-              
-              images_position_.push_back(image_position);
-              images_delay_.push_back(delay);
-              
-              WriteSample(delay, attenuation);
-            }
-          }
-        }
+  
+/**
+ Calculates the RIR from the lattice of images, for the current position of
+ the microphone. This is called by Run() before filtering.
+ */
+void Ism::CalculateRir() {
+  const Point mic_position = microphone_->position();
+  rir_ = mcl::Zeros<sal::Sample>(rir_length_);
+  
+  // Each chunk of the lattice is calculated into its own RIR, by any of the
+  // threads. The chunks are then added to the RIR, always in the same order,
+  // so that the result does not depend on the number of threads. The chunks
+  // are at least as long as the RIR, so that adding them costs at most one
+  // operation per image.
+  const Int num_images = lattice_.x.size();
+  const Int chunk_length = std::max(kMinChunkLength, rir_length_);
+  const Int num_chunks = (num_images+chunk_length-1)/chunk_length;
+  chunk_rirs_.resize(num_chunks);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    chunk_length_ = chunk_length;
+    chunk_mic_position_ = mic_position;
+    is_chunk_ready_.assign(num_chunks, false);
+    next_chunk_id_ = 0;
+    num_chunks_ = num_chunks;
+  }
+  if (! workers_.empty()) { chunks_available_.notify_all(); }
+  
+  for (Int chunk_id=0; chunk_id<num_chunks; ++chunk_id) {
+    // Until the next chunk to be added is ready, the calling thread
+    // calculates the chunks that no worker has taken yet.
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (! is_chunk_ready_[chunk_id]) {
+      if (next_chunk_id_ < num_chunks_) {
+        const Int next_chunk_id = next_chunk_id_++;
+        lock.unlock();
+        CalculateChunk(next_chunk_id);
+        lock.lock();
+        is_chunk_ready_[next_chunk_id] = true;
+      } else {
+        chunk_ready_.wait(lock);
       }
     }
+    lock.unlock();
+    const Sample* chunk_rir = chunk_rirs_[chunk_id].data();
+    for (Int i=0; i<rir_length_; ++i) { rir_[i] += chunk_rir[i]; }
+  }
+  rir_mic_position_ = mic_position;
+}
+  
+  
+void Ism::CalculateChunk(const Int chunk_id) noexcept {
+  const Int num_images = lattice_.x.size();
+  CalculateImages(chunk_id*chunk_length_,
+                  std::min((chunk_id+1)*chunk_length_, num_images),
+                  chunk_mic_position_, chunk_rirs_[chunk_id]);
+}
+  
+  
+void Ism::RunWorker() noexcept {
+  for (;;) {
+    Int chunk_id;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      chunks_available_.wait(lock, [&]() {
+        return is_stopping_ || next_chunk_id_ < num_chunks_;
+      });
+      if (is_stopping_) { return; }
+      chunk_id = next_chunk_id_++;
+    }
+    CalculateChunk(chunk_id);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      is_chunk_ready_[chunk_id] = true;
+    }
+    chunk_ready_.notify_one();
+  }
+}
+  
+  
+std::vector<std::vector<Sample> >
+Ism::CalculateRirs(const std::vector<Point>& positions) {
+  if (modified_ ||
+      ! IsSamePosition(source_->position(), lattice_source_position_)) {
+    CalculateLattice();
+    // The RIR of the microphone of this object is now out of date
+    rir_mic_position_ = Point(NAN, NAN, NAN);
+    modified_ = false;
+  }
+  
+  const Int num_positions = positions.size();
+  std::vector<std::vector<Sample> > rirs(num_positions,
+                                         std::vector<Sample>(rir_length_, 0.0));
+  // Each thread writes the RIRs of different positions, so that the results
+  // do not depend on the number of threads.
+  const Int num_threads = std::min(num_threads_, num_positions);
+  std::vector<std::thread> threads;
+  for (Int i=1; i<num_threads; ++i) {
+    threads.push_back(std::thread(&Ism::CalculateReceiverRirs, this,
+                                  std::cref(positions),
+                                  i*num_positions/num_threads,
+                                  (i+1)*num_positions/num_threads,
+                                  std::ref(rirs)));
+  }
+  if (num_threads > 0) {
+    CalculateReceiverRirs(positions, 0, num_positions/num_threads, rirs);
   }
+  for (Int i=0; i<(Int) threads.size(); ++i) { threads[i].join(); }
+  return rirs;
 }
   
+  
+void Ism::CalculateReceiverRirs(const std::vector<Point>& positions,
+                                const Int begin_id, const Int end_id,
+                                std::vector<std::vector<Sample> >& rirs) const {
+  const Int num_receivers = end_id-begin_id;
+  std::vector<Length> receivers_x(num_receivers);
+  std::vector<Length> receivers_y(num_receivers);
+  std::vector<Length> receivers_z(num_receivers);
+  for (Int j=0; j<num_receivers; ++j) {
+    receivers_x[j] = positions[begin_id+j].x();
+    receivers_y[j] = positions[begin_id+j].y();
+    receivers_z[j] = positions[begin_id+j].z();
+  }
+  const Length* x = receivers_x.data();
+  const Length* y = receivers_y.data();
+  const Length* z = receivers_z.data();
+  std::vector<Time> delays_vector(num_receivers);
+  Time* delays = delays_vector.data();
+  
+  const Int num_images = lattice_.x.size();
+  for (Int i=0; i<num_images; ++i) {
+    const Length image_x = lattice_.x[i];
+    const Length image_y = lattice_.y[i];
+    const Length image_z = lattice_.z[i];
+    const Time random_delay = lattice_.random_delays[i];
+    
+    // This loop has no dependencies between receivers and is vectorised
+    for (Int j=0; j<num_receivers; ++j) {
+      const Length dx = image_x-x[j];
+      const Length dy = image_y-y[j];
+      const Length dz = image_z-z[j];
+      delays[j] = sqrt(dx*dx+dy*dy+dz*dz)/SOUND_SPEED + random_delay;
+    }
+    
+    for (Int j=0; j<num_receivers; ++j) {
+      if (! IsInRir(delays[j])) { continue; }
+      WriteSample(delays[j], lattice_.gains[i]/(delays[j]*sampling_frequency_),
+                  rirs[begin_id+j]);
+    }
+  }
+}
+  
+  
+std::vector<Time> Ism::images_delay() const {
+  std::vector<Time> images_delay;
+  for (Int i=0; i<(Int) lattice_.delays.size(); ++i) {
+    if (IsInRir(lattice_.delays[i])) {
+      images_delay.push_back(lattice_.delays[i]);
+    }
+  }
+  return images_delay;
+}
+  
+  
+void Ism::CalculatePetersonTable() {
+  // The cutoff frequency is 90% of Nyquist frequency
+  const Sample cutoff = 0.9/2.0; // Relative to the sampling frequency
+  const Time window_length = peterson_window_*sampling_frequency_;
+  peterson_num_taps_ = (Int) ceil(window_length)+1;
+  // One row more, since the phase can be kPetersonOversampling and the
+  // next row is also read for the interpolation
+  peterson_table_.assign((kPetersonOversampling+2)*peterson_num_taps_, 0.0);
+  for (Int i=0; i<kPetersonOversampling+2; ++i) {
+    for (Int k=0; k<peterson_num_taps_; ++k) {
+      const Time t = ((Time) k) + ((Time) i)/((Time) kPetersonOversampling) -
+                     window_length/2.0;
+      if (std::abs(t) >= window_length/2.0) { continue; }
+      const Sample sinc = (t == 0.0) ? 1.0 :
+          sin(2.0*PI*cutoff*t)/(2.0*PI*cutoff*t);
+      peterson_table_[i*peterson_num_taps_+k] =
+          1.0/2.0*(1.0+cos(2.0*PI*t/window_length))*sinc;
+    }
+  }
+}
+  
+  
+Ism::ImageAxis Ism::CalculateImageAxis(const Int n,
+                                       const Length length,
+                                       const Length source_coordinate,
+                                       const Sample beta_1,
+                                       const Sample beta_2) {
+  // beta_1^k for k=0,...,n+1 and beta_2^k for k=0,...,n
+  std::vector<Sample> powers_1(n+2, 1.0);
+  std::vector<Sample> powers_2(n+1, 1.0);
+  for (Int k=1; k<=n+1; ++k) { powers_1[k] = powers_1[k-1]*beta_1; }
+  for (Int k=1; k<=n; ++k) { powers_2[k] = powers_2[k-1]*beta_2; }
+  
+  const Int num_ids = 2*(2*n+1);
+  ImageAxis axis;
+  axis.coordinates.resize(num_ids);
+  axis.room_distances.resize(num_ids);
+  axis.gains.resize(num_ids);
+  axis.orders.resize(num_ids);
+  axis.sorted_ids.resize(num_ids);
+  axis.max_gains.resize(num_ids);
+  axis.min_room_distances.resize(num_ids);
+  for (Int m=-n; m<=n; ++m) {
+    for (Int p=0; p<=1; ++p) {
+      const Int id = 2*(m+n)+p;
+      // Same as CuboidRoom::ImageSourcePosition
+      axis.coordinates[id] = (1.0-2.0*((Length)p))*source_coordinate +
+                             2.0*length*((Length)m);
+      axis.room_distances[id] = std::max(0.0,
+                                         std::max(-axis.coordinates[id],
+                                                  axis.coordinates[id]-length));
+      axis.gains[id] = powers_1[std::abs(m-p)]*powers_2[std::abs(m)];
+      axis.orders[id] = std::abs(m-p)+std::abs(m);
+    }
+  }
+  
+  for (Int id=0; id<num_ids; ++id) { axis.sorted_ids[id] = id; }
+  std::stable_sort(axis.sorted_ids.begin(), axis.sorted_ids.end(),
+                   [&axis](const Int id_a, const Int id_b) {
+                     return axis.orders[id_a] < axis.orders[id_b];
+                   });
+  Sample max_gain = 0.0;
+  Length min_room_distance = INFINITY;
+  for (Int q=num_ids-1; q>=0; --q) {
+    max_gain = std::max(max_gain, std::abs(axis.gains[axis.sorted_ids[q]]));
+    min_room_distance = std::min(min_room_distance,
+                                 axis.room_distances[axis.sorted_ids[q]]);
+    axis.max_gains[q] = max_gain;
+    axis.min_room_distances[q] = min_room_distance;
+  }
+  return axis;
+}
+  
+  
+void Ism::CalculateImages(const Int begin_id, const Int end_id,
+                          const Point& mic_position,
+                          std::vector<Sample>& rir) {
+  rir.assign(rir_length_, 0.0);
+  const Int num_images = end_id-begin_id;
+  const Length* x = lattice_.x.data()+begin_id;
+  const Length* y = lattice_.y.data()+begin_id;
+  const Length* z = lattice_.z.data()+begin_id;
+  const Time* random_delays = lattice_.random_delays.data()+begin_id;
+  const Sample* gains = lattice_.gains.data()+begin_id;
+  Time* delays = lattice_.delays.data()+begin_id;
+  const Length mic_x = mic_position.x();
+  const Length mic_y = mic_position.y();
+  const Length mic_z = mic_position.z();
+  
+  // This loop has no dependencies between images and is vectorised
+  for (Int i=0; i<num_images; ++i) {
+    const Length dx = x[i]-mic_x;
+    const Length dy = y[i]-mic_y;
+    const Length dz = z[i]-mic_z;
+    delays[i] = sqrt(dx*dx+dy*dy+dz*dz)/SOUND_SPEED + random_delays[i];
+  }
+  
+  for (Int i=0; i<num_images; ++i) {
+    if (! IsInRir(delays[i])) { continue; }
+    WriteSample(delays[i], gains[i]/(delays[i]*sampling_frequency_), rir);
+  }
+}
+  
+  
 void Ism::WriteSample(const sal::Time& delay,
-                      const sal::Sample& attenuation) {
+                      const sal::Sample& attenuation,
+                      std::vector<Sample>& rir) const {
   sal::Time delay_norm = delay*sampling_frequency_;
   Int id_round = mcl::RoundToInt(delay_norm);
-  Int rir_length = rir_.size();
+  Int rir_length = rir.size();
   
   switch (interpolation_) {
     case none: {
-      rir_.at(id_round) += attenuation;
-      images_int_delay_filter_.push_back(sal::DelayFilter(id_round, id_round));
-      images_frac_delay_filter_.push_back(mcl::FirFilter::GainFilter(attenuation));
+      rir.at(id_round) += attenuation;
       break;
     }
     case peterson: {
-      // The cutoff frequency is 90% of Nyquist frequency
-      sal::Time f_c = 0.9*(sampling_frequency_/2.0);
-      sal::Time T_w = peterson_window_;
+      // The first tap is the first sample after the beginning of the window
+      const Time start = delay_norm - peterson_window_*sampling_frequency_/2.0;
+      const Int first_tap = (Int) floor(start)+1;
+      const Time phase = (((Time) first_tap)-start) *
+                         ((Time) kPetersonOversampling);
+      const Int phase_id = (Int) phase;
+      const Sample fraction = phase-((Time) phase_id);
+      const Sample* row = peterson_table_.data()+phase_id*peterson_num_taps_;
+      const Sample* next_row = row+peterson_num_taps_;
+      const Sample gain = attenuation*(1.0-fraction);
+      const Sample next_gain = attenuation*fraction;
       
-      sal::Time tau = ((sal::Time)delay_norm)/sampling_frequency_;
-      
-      std::vector<sal::Sample> filter_coefficients;
-      sal::Int integer_delay = (Int) floor(sampling_frequency_*(-T_w/2.0+tau));
-      for (Int n=integer_delay+1;
-           n<floor(sampling_frequency_*(T_w/2.0+tau));
-           ++n) {
-        if (n < 0 || n >= ((Int)rir_length)) { continue; }
-        
-        sal::Time t = ((sal::Time)n)/sampling_frequency_ - tau;
-        sal::Sample low_pass = 1.0/2.0*(1.0+cos(2.0*PI*t/T_w)) *
-                               sin(2.0*PI*f_c*t) / (2.0*PI*f_c*t);
-        
-        // If low_pass is nan it means that t=0 and sinc(0)=1
-        if (isnan(low_pass)) {
-          low_pass = 1.0 ;
-        }
-        
-        filter_coefficients.push_back(attenuation*low_pass);
-        rir_.at(n) += attenuation*low_pass;
+      const Int begin_k = std::max((Int) 0, -first_tap);
+      const Int end_k = std::min(peterson_num_taps_, rir_length-first_tap);
+      Sample* rir_data = rir.data();
+      for (Int k=begin_k; k<end_k; ++k) {
+        rir_data[first_tap+k] += gain*row[k] + next_gain*next_row[k];
       }
-      
-      sal::Int nneg_integer_delay = (integer_delay<0) ? 0 : integer_delay;
-      images_int_delay_filter_.push_back(sal::DelayFilter(nneg_integer_delay,
-                                                      nneg_integer_delay));
-      images_frac_delay_filter_.push_back(mcl::FirFilter(filter_coefficients));
-      
       break;
     }
   }
@@ -199,11 +853,10 @@ void Ism::WriteSample(const sal::Time& delay,
   
 void Ism::Update() {
   modified_ = true;
+  streaming_modified_ = true;
   rir_.clear();
-  images_delay_.clear();
-  images_position_.clear();
-  images_int_delay_filter_.clear();
-  images_frac_delay_filter_.clear();
+  lattice_ = ImageLattice();
+  chunk_rirs_.clear();
 }
   
 } // namespace sal
@@ -10,7 +10,6 @@
 
 #include "kemarmic.h"
 #include "point.h"
-#include "butter.h"
 #include "salconstants.h"
 #include "vectorop.h"
 #include <fstream>
@@ -37,13 +36,22 @@ KemarMic::KemarMic(const Point& position,
                    const Time sampling_frequency,
                    const std::string directory) :
           DatabaseBinauralMic(position, orientation, update_length,
-                              reference_orientation) {
+                              reference_orientation),
+          interpolation_(false), blended_brir_cache_(false) {
             
   num_measurements_ = GetNumMeasurements();
   elevations_ = GetElevations();
             
-    
-  if (dataset_type != kDirectoryCompact && dataset_type != kDirectoryLeft && dataset_type != kDirectoryRight) {
+  // All the datasets are sampled at 44100 Hz, except packs, which may have
+  // been resampled when writing them.
+  Time database_sampling_frequency = 44100.0;
+  if (dataset_type == kPackFile) {
+    if (! LoadPack(directory, hrtf_database_left_, hrtf_database_right_,
+                   database_sampling_frequency)) {
+      mcl::Logger::GetInstance().LogErrorToCerr("Kemar pack not found.");
+      ASSERT(false);
+    }
+  } else if (dataset_type != kDirectoryCompact && dataset_type != kDirectoryLeft && dataset_type != kDirectoryRight) {
     hrtf_database_right_ = LoadEmbedded(kRightEar, dataset_type);
     hrtf_database_left_ = LoadEmbedded(kLeftEar, dataset_type);
   } else {
@@ -51,45 +59,27 @@ KemarMic::KemarMic(const Point& position,
     hrtf_database_left_ = Load(kLeftEar, directory, dataset_type);
   }
   
-  Array<mcl::Int, NUM_ELEVATIONS_KEMAR> num_measurements = GetNumMeasurements();
-            
-  // This is the sampling frequency that will actually be used
-  Time used_sampling_frequency;
-  Int used_num_samples;
-  
-  if (sampling_frequency > 33075.0) {
-    used_sampling_frequency = 44100.0;
-    used_num_samples = kFullBrirLength;
-    // Do nothing as the database is already 44100.0
-  } else {
-    used_sampling_frequency = 22050.0;
-    used_num_samples = 64;
-    // Downsample the database by a factor 2
-    mcl::IirFilter filter = mcl::Butter(10, 0.001, 0.45);
-    FilterAll(&filter);
-    for (Int i=0; i<NUM_ELEVATIONS_KEMAR; ++i) {
-      for (Int j=0; j<num_measurements[i]; ++j) {
-        hrtf_database_right_[i][j] = mcl::Downsample(hrtf_database_right_[i][j], 2);
-        hrtf_database_left_[i][j] = mcl::Downsample(hrtf_database_left_[i][j], 2);
-      }
-    }
+  if (! mcl::IsEqual(sampling_frequency, database_sampling_frequency)) {
+    ResampleDatabase(GetDatabaseId(directory, dataset_type),
+                     database_sampling_frequency, sampling_frequency);
   }
+}
   
-  if (! mcl::IsEqual(sampling_frequency, 22050.0) && ! mcl::IsEqual(sampling_frequency, 44100.0)) {
-    mcl::Logger::GetInstance().LogError("The sampling frequency (%f) is not supported for "
-                                        "the Kemar mic. Using %f instead.",
-                                        sampling_frequency,
-                                        used_sampling_frequency);
-  }
   
-  if (used_num_samples != kFullBrirLength) {
-    for (Int i=0; i<NUM_ELEVATIONS_KEMAR; ++i) {
-      for (Int j=0; j<num_measurements[i]; ++j) {
-        hrtf_database_right_[i][j] = mcl::ZeroPad<Sample>(hrtf_database_right_[i][j], used_num_samples);
-        hrtf_database_left_[i][j] = mcl::ZeroPad<Sample>(hrtf_database_left_[i][j], used_num_samples);
-      }
-    }
+std::string KemarMic::GetDatabaseId(const std::string directory,
+                                    const DatasetType dataset_type) noexcept {
+  std::string database_id = "kemar:" + std::to_string((int) dataset_type);
+  switch (dataset_type) {
+    case kDirectoryCompact:
+    case kDirectoryLeft:
+    case kDirectoryRight:
+    case kPackFile:
+      database_id += ":" + directory;
+      break;
+    default:
+      break;
   }
+  return database_id;
 }
   
 
@@ -104,6 +94,14 @@ Array<mcl::Int, NUM_ELEVATIONS_KEMAR> KemarMic::GetElevations() noexcept {
   
 
 bool KemarMic::IsDatabaseAvailable(const std::string directory, const DatasetType dataset_type) {
+  if (dataset_type == kPackFile) {
+    std::vector<std::vector<Signal> > hrtf_database_left;
+    std::vector<std::vector<Signal> > hrtf_database_right;
+    Time sampling_frequency;
+    return LoadPack(directory, hrtf_database_left, hrtf_database_right,
+                    sampling_frequency);
+  }
+  
   Array<mcl::Int, NUM_ELEVATIONS_KEMAR> num_measurements = GetNumMeasurements();
   Array<mcl::Int, NUM_ELEVATIONS_KEMAR> elevations = GetElevations();
   
@@ -180,6 +178,86 @@ void KemarMic::PrintParsedDatabase(const Ear ear,
 }
 
   
+bool KemarMic::LoadPack(const std::string file_path,
+                        std::vector<std::vector<Signal> >& hrtf_database_left,
+                        std::vector<std::vector<Signal> >& hrtf_database_right,
+                        Time& sampling_frequency) {
+  HrtfPack pack;
+  if (! pack.Open(file_path)) { return false; }
+  sampling_frequency = pack.sampling_frequency();
+  
+  Array<mcl::Int, NUM_ELEVATIONS_KEMAR> num_measurements = GetNumMeasurements();
+  if (pack.num_rows() != NUM_ELEVATIONS_KEMAR) {
+    mcl::Logger::GetInstance().LogError("The HRTF pack %s does not contain "
+                                        "the Kemar grid.", file_path.c_str());
+    return false;
+  }
+  
+  hrtf_database_left = pack.GetDatabase(kLeftEar);
+  hrtf_database_right = pack.GetDatabase(kRightEar);
+  
+  for (Int i=0; i<NUM_ELEVATIONS_KEMAR; ++i) {
+    if ((Int) hrtf_database_left[i].size() != num_measurements[i]) {
+      mcl::Logger::GetInstance().LogError("The HRTF pack %s does not contain "
+                                          "the Kemar grid.", file_path.c_str());
+      return false;
+    }
+  }
+  return true;
+}
+  
+  
+bool KemarMic::WritePack(const std::string& pack_file_path,
+                         const std::string directory,
+                         const DatasetType dataset_type,
+                         const HrtfPack::SampleFormat sample_format,
+                         const Time sampling_frequency) {
+  std::vector<std::vector<Signal> > hrtf_database_left;
+  std::vector<std::vector<Signal> > hrtf_database_right;
+  
+  switch (dataset_type) {
+    case kDirectoryCompact:
+    case kDirectoryLeft:
+    case kDirectoryRight:
+      hrtf_database_left = Load(kLeftEar, directory, dataset_type);
+      hrtf_database_right = Load(kRightEar, directory, dataset_type);
+      break;
+    case kPackFile:
+      // Nothing to convert
+      return false;
+    default:
+      hrtf_database_left = LoadEmbedded(kLeftEar, dataset_type);
+      hrtf_database_right = LoadEmbedded(kRightEar, dataset_type);
+      break;
+  }
+  
+  if (! mcl::IsEqual(sampling_frequency, 44100.0)) {
+    hrtf_database_left = Resample(hrtf_database_left, 44100.0, sampling_frequency);
+    hrtf_database_right = Resample(hrtf_database_right, 44100.0, sampling_frequency);
+  }
+  
+  Array<mcl::Int, NUM_ELEVATIONS_KEMAR> num_measurements = GetNumMeasurements();
+  Array<mcl::Int, NUM_ELEVATIONS_KEMAR> elevations = GetElevations();
+  
+  std::vector<HrtfPackDirection> directions;
+  for (Int i=0; i<NUM_ELEVATIONS_KEMAR; ++i) {
+    const Angle resolution = 360.0 / num_measurements[i];
+    for (Int j=0; j<num_measurements[i]; ++j) {
+      HrtfPackDirection direction;
+      direction.row_id = (std::int32_t) i;
+      direction.column_id = (std::int32_t) j;
+      direction.elevation = (float) elevations[i];
+      direction.azimuth = (float) (j * resolution);
+      directions.push_back(direction);
+    }
+  }
+  
+  return HrtfPack::Write(pack_file_path, directions,
+                         hrtf_database_left, hrtf_database_right,
+                         sampling_frequency, sample_format);
+}
+  
+  
 std::vector<std::vector<Signal> > KemarMic::LoadEmbedded(const Ear ear,
                                                          const DatasetType dataset_type) {
   std::vector<std::vector<Signal> > hrtf_database;
@@ -330,7 +408,160 @@ Int KemarMic::FindAzimuthIndex(Angle azimuth, Int elevation_index) {
 }
   
 
+void KemarMic::SetInterpolation(const bool interpolation) noexcept {
+  if (interpolation && direction_grid_.IsEmpty()) {
+    direction_grid_ = DirectionGrid(kDirectionGridResolution, GetNeighbours);
+  }
+  interpolation_ = interpolation;
+}
+  
+  
+void KemarMic::SetBlendedBrirCache(const bool cache) noexcept {
+  blended_brir_cache_ = cache;
+  if (! cache) { ClearBlendedBrirCache(); }
+}
+  
+  
+void KemarMic::ClearBlendedBrirCache() noexcept {
+  blended_brirs_left_.clear();
+  blended_brirs_right_.clear();
+}
+  
+  
+void KemarMic::FilterAll(mcl::DigitalFilter* filter) {
+  DatabaseBinauralMic::FilterAll(filter);
+  // The cached BRIRs refer to the old database
+  ClearBlendedBrirCache();
+}
+  
+  
+void KemarMic::SplitMinimumPhase(const Int num_taps) {
+  DatabaseBinauralMic::SplitMinimumPhase(num_taps);
+  // The cached BRIRs refer to the old database
+  ClearBlendedBrirCache();
+}
+  
+  
+DirectionGrid::Cell KemarMic::GetNeighbours(const Angle elevation,
+                                            const Angle azimuth) noexcept {
+  Array<mcl::Int, NUM_ELEVATIONS_KEMAR> num_measurements = GetNumMeasurements();
+  Array<mcl::Int, NUM_ELEVATIONS_KEMAR> elevations = GetElevations();
+  
+  // Weights of the elevation rings below and above `elevation`. Below the
+  // lowest ring, the lowest ring is used.
+  Int elevation_ids[2];
+  Sample elevation_weights[2];
+  if (elevation <= elevations[0]) {
+    elevation_ids[0] = elevation_ids[1] = 0;
+    elevation_weights[0] = 1.0;
+    elevation_weights[1] = 0.0;
+  } else if (elevation >= elevations[NUM_ELEVATIONS_KEMAR-1]) {
+    elevation_ids[0] = elevation_ids[1] = NUM_ELEVATIONS_KEMAR-1;
+    elevation_weights[0] = 1.0;
+    elevation_weights[1] = 0.0;
+  } else {
+    Int i = 0;
+    while (elevations[i+1] <= elevation) { ++i; }
+    elevation_ids[0] = i;
+    elevation_ids[1] = i+1;
+    elevation_weights[1] = (elevation-elevations[i]) /
+                           (elevations[i+1]-elevations[i]);
+    elevation_weights[0] = 1.0-elevation_weights[1];
+  }
+  
+  DirectionGrid::Cell cell;
+  cell.num_neighbours = 0;
+  for (Int k=0; k<2; ++k) {
+    const Int i = elevation_ids[k];
+    const Angle resolution = 360.0 / ((Angle) num_measurements[i]);
+    const Angle position = mcl::Mod(azimuth, 360.0)/resolution;
+    const Int azimuth_id = ((Int) floor(position)) % num_measurements[i];
+    const Sample azimuth_weight = position-floor(position);
+    DirectionGrid::AddNeighbour(i, azimuth_id,
+                                elevation_weights[k]*(1.0-azimuth_weight),
+                                cell);
+    DirectionGrid::AddNeighbour(i, (azimuth_id+1) % num_measurements[i],
+                                elevation_weights[k]*azimuth_weight,
+                                cell);
+  }
+  return cell;
+}
+  
+  
+Signal KemarMic::Blend(const std::vector<std::vector<Signal> >& hrtf_database,
+                       const DirectionGrid::Cell& cell) noexcept {
+  Int length = 0;
+  for (Int i=0; i<cell.num_neighbours; ++i) {
+    const DirectionGrid::Neighbour& neighbour = cell.neighbours[i];
+    length = std::max(length, (Int) hrtf_database[neighbour.row_id][neighbour.column_id].size());
+  }
+  
+  Signal brir(length, 0.0);
+  for (Int i=0; i<cell.num_neighbours; ++i) {
+    const DirectionGrid::Neighbour& neighbour = cell.neighbours[i];
+    const Signal& hrir = hrtf_database[neighbour.row_id][neighbour.column_id];
+    mcl::MultiplyAdd(hrir.data(), neighbour.weight, brir.data(), hrir.size(),
+                     brir.data());
+  }
+  return brir;
+}
+  
+  
+Int KemarMic::GetCellId(const Point& point) const noexcept {
+  // The direction grid is in the standard reference system
+  const Point standard_point =
+      (reference_orientation_ == HeadRefOrientation::y_z) ?
+      Point(point.y(), -point.x(), point.z()) : point;
+  return direction_grid_.GetCellId(standard_point);
+}
+  
+
 Signal KemarMic::GetBrir(const Ear ear, const Point& point) noexcept {
+  const std::vector<std::vector<Signal> >& hrtf_database =
+      (ear == kLeftEar) ? hrtf_database_left_ : hrtf_database_right_;
+  
+  if (interpolation_) {
+    const Int cell_id = GetCellId(point);
+    if (! blended_brir_cache_) {
+      return Blend(hrtf_database, direction_grid_.cell(cell_id));
+    }
+    
+    std::vector<Signal>& blended_brirs = (ear == kLeftEar) ?
+        blended_brirs_left_ : blended_brirs_right_;
+    if (blended_brirs.empty()) { blended_brirs.resize(direction_grid_.num_cells()); }
+    if (blended_brirs[cell_id].empty()) {
+      blended_brirs[cell_id] = Blend(hrtf_database, direction_grid_.cell(cell_id));
+    }
+    return blended_brirs[cell_id];
+  }
+  
+  Int elevation_index;
+  Int azimuth_index;
+  FindNearestIndices(point, elevation_index, azimuth_index);
+  return hrtf_database[elevation_index][azimuth_index];
+}
+  
+  
+Time KemarMic::GetBrirDelay(const Ear ear, const Point& point) noexcept {
+  const std::vector<std::vector<Signal> >& hrtf_delays =
+      (ear == kLeftEar) ? hrtf_delays_left_ : hrtf_delays_right_;
+  if (hrtf_delays.empty()) { return 0.0; }
+  
+  if (interpolation_) {
+    // Interpolating the delays (rather than the responses) does not smear
+    // the interaural time difference.
+    return Blend(hrtf_delays, direction_grid_.cell(GetCellId(point)))[0];
+  }
+  
+  Int elevation_index;
+  Int azimuth_index;
+  FindNearestIndices(point, elevation_index, azimuth_index);
+  return hrtf_delays[elevation_index][azimuth_index][0];
+}
+  
+  
+void KemarMic::FindNearestIndices(const Point& point, Int& elevation_index,
+                                  Int& azimuth_index) noexcept {
   // For forward looking direction, Azimuth = 0 and elevation =0
   Point norm_point = Normalized(point);
   Angle elevation = (asin((double) norm_point.z())) / PI * 180.0;
@@ -373,14 +604,8 @@ Signal KemarMic::GetBrir(const Ear ear, const Point& point) noexcept {
   ASSERT((elevation >= (-90.0-VERY_SMALL)) & (elevation <= (90.0+VERY_SMALL)));
   ASSERT((azimuth >= (0.0-VERY_SMALL)) & (azimuth <= (360.0+VERY_SMALL)));
   
-  Int elevation_index = FindElevationIndex(elevation);
-  Int azimuth_index = FindAzimuthIndex(azimuth, elevation_index);
-  
-  if (ear == kLeftEar) {
-    return hrtf_database_left_[elevation_index][azimuth_index];
-  } else {
-    return hrtf_database_right_[elevation_index][azimuth_index];
-  }
+  elevation_index = FindElevationIndex(elevation);
+  azimuth_index = FindAzimuthIndex(azimuth, elevation_index);
 }
   
 } // namespace sal
@@ -0,0 +1,276 @@
+/*
+ partitionedconvolver.cpp
+ Spatial Audio Library (SAL)
+ Copyright (c) 2015, Enzo De Sena
+ All rights reserved.
+
+ Authors: Enzo De Sena, enzodesena@gmail.com
+
+ */
+
+#include "partitionedconvolver.h"
+#include "salconstants.h"
+#include <algorithm>
+#include <cmath>
+
+namespace sal {
+
+// Number of partitions of each length, except the longest
+static const Int kNumPartitionsPerLevel = 3;
+
+// Ratio between the lengths of the partitions of consecutive levels
+static const Int kLevelRatio = 4;
+
+
+static bool IsPowerOfTwo(const Int value) noexcept {
+  return value > 0 && (value & (value-1)) == 0;
+}
+
+
+static Int NextPowerOfTwo(const Int value) noexcept {
+  Int power = 1;
+  while (power < value) { power *= 2; }
+  return power;
+}
+
+
+PartitionedConvolver::PartitionedConvolver(const std::vector<Sample>& filter,
+                                           const Int head_length,
+                                           const Int max_partition_length) :
+        filter_length_(filter.size()), head_length_(head_length),
+        head_filter_(head_length, 0.0),
+        head_buffer_(2*head_length-1, 0.0), time_(0) {
+  ASSERT(IsPowerOfTwo(head_length) && IsPowerOfTwo(max_partition_length));
+  ASSERT(max_partition_length >= head_length);
+
+  Int offset = head_length;
+  Int partition_length = head_length;
+  Int max_level_end = 1;
+  while (offset < filter_length_) {
+    const Int num_remaining = (filter_length_-offset+partition_length-1) /
+                              partition_length;
+    const Int num_partitions = (partition_length == max_partition_length) ?
+        num_remaining : std::min(kNumPartitionsPerLevel, num_remaining);
+    Level level;
+    level.partition_length = partition_length;
+    level.offset = offset;
+    level.plan = CreateFftPlan(2*partition_length);
+    level.filter_spectra.assign(num_partitions,
+                                std::vector<Complex>(2*partition_length));
+    level.input_spectra.assign(num_partitions,
+                               std::vector<Complex>(2*partition_length));
+    level.latest = 0;
+    level.is_partition_zero.assign(num_partitions, true);
+    level.is_zero = true;
+    levels_.push_back(level);
+
+    offset += num_partitions*partition_length;
+    max_level_end = std::max(max_level_end, offset+partition_length);
+    // The next level starts at a multiple of (and at least one) partition
+    partition_length = std::min(kLevelRatio*partition_length,
+                                max_partition_length);
+  }
+
+  const Int max_length = levels_.empty() ? 1 :
+                         levels_.back().partition_length;
+  input_ring_.assign(NextPowerOfTwo(2*max_length), 0.0);
+  input_mask_ = input_ring_.size()-1;
+  output_ring_.assign(NextPowerOfTwo(max_level_end), 0.0);
+  output_mask_ = output_ring_.size()-1;
+  accumulator_.assign(2*max_length, Complex(0.0, 0.0));
+
+  SetFilter(filter);
+}
+
+
+PartitionedConvolver::FftPlan
+PartitionedConvolver::CreateFftPlan(const Int size) {
+  FftPlan plan;
+  plan.size = size;
+  plan.bit_reversal.resize(size);
+  Int num_bits = 0;
+  while ((((Int) 1) << num_bits) < size) { ++num_bits; }
+  for (Int i=0; i<size; ++i) {
+    Int reversed = 0;
+    for (Int bit=0; bit<num_bits; ++bit) {
+      if (i & (((Int) 1) << bit)) { reversed |= ((Int) 1) << (num_bits-1-bit); }
+    }
+    plan.bit_reversal[i] = reversed;
+  }
+  plan.twiddles.resize(size/2);
+  for (Int k=0; k<size/2; ++k) {
+    const Sample angle = -2.0*PI*((Sample) k)/((Sample) size);
+    plan.twiddles[k] = Complex(cos(angle), sin(angle));
+  }
+  return plan;
+}
+
+
+void PartitionedConvolver::Transform(const FftPlan& plan, const bool inverse,
+                                     Complex* data) noexcept {
+  const Int size = plan.size;
+  for (Int i=0; i<size; ++i) {
+    const Int j = plan.bit_reversal[i];
+    if (i < j) { std::swap(data[i], data[j]); }
+  }
+  const Sample sign = inverse ? -1.0 : 1.0;
+  for (Int length=2; length<=size; length*=2) {
+    const Int half = length/2;
+    const Int step = size/length;
+    for (Int start=0; start<size; start+=length) {
+      for (Int k=0; k<half; ++k) {
+        const Complex& twiddle = plan.twiddles[k*step];
+        const Sample w_real = twiddle.real();
+        const Sample w_imag = sign*twiddle.imag();
+        // The products are written out, since std::complex checks for
+        // infinities and NaNs
+        const Complex b = data[start+k+half];
+        const Sample product_real = b.real()*w_real - b.imag()*w_imag;
+        const Sample product_imag = b.real()*w_imag + b.imag()*w_real;
+        const Complex a = data[start+k];
+        data[start+k] = Complex(a.real()+product_real, a.imag()+product_imag);
+        data[start+k+half] = Complex(a.real()-product_real,
+                                     a.imag()-product_imag);
+      }
+    }
+  }
+}
+
+
+void PartitionedConvolver::SetFilter(const std::vector<Sample>& filter) noexcept {
+  ASSERT((Int) filter.size() <= filter_length_);
+  const Int length = filter.size();
+  is_head_zero_ = true;
+  for (Int i=0; i<head_length_; ++i) {
+    head_filter_[i] = (i < length) ? filter[i] : 0.0;
+    if (head_filter_[i] != 0.0) { is_head_zero_ = false; }
+  }
+  for (Int level_id=0; level_id<(Int) levels_.size(); ++level_id) {
+    Level& level = levels_[level_id];
+    const Int partition_length = level.partition_length;
+    level.is_zero = true;
+    for (Int j=0; j<(Int) level.filter_spectra.size(); ++j) {
+      Complex* spectrum = level.filter_spectra[j].data();
+      const Int begin = level.offset+j*partition_length;
+      bool is_partition_zero = true;
+      for (Int i=0; i<partition_length; ++i) {
+        const Sample tap = (begin+i < length) ? filter[begin+i] : 0.0;
+        if (tap != 0.0) { is_partition_zero = false; }
+        spectrum[i] = Complex(tap, 0.0);
+        spectrum[partition_length+i] = Complex(0.0, 0.0);
+      }
+      level.is_partition_zero[j] = is_partition_zero;
+      if (! is_partition_zero) { level.is_zero = false; }
+      Transform(level.plan, false, spectrum);
+      // Includes the scaling of the inverse transform
+      const Sample scaling = 1.0/((Sample) (2*partition_length));
+      for (Int i=0; i<2*partition_length; ++i) { spectrum[i] *= scaling; }
+    }
+  }
+}
+
+
+void PartitionedConvolver::Filter(const Sample* input_data,
+                                  const Int num_samples,
+                                  Sample* output_data) noexcept {
+  Int done = 0;
+  while (done < num_samples) {
+    // Blocks end where the levels may have to run, which is at multiples of
+    // head_length_ (the shortest partition)
+    const Int block_length = std::min(num_samples-done,
+                                      head_length_-(time_ % head_length_));
+    const Sample* input = input_data+done;
+    Sample* output = output_data+done;
+
+    Sample* buffer = head_buffer_.data();
+    const Sample* head_filter = head_filter_.data();
+    for (Int i=0; i<block_length; ++i) {
+      buffer[head_length_-1+i] = input[i];
+    }
+    for (Int i=0; i<block_length; ++i) {
+      const Sample* last_input = buffer+head_length_-1+i;
+      Sample sum = 0.0;
+      if (! is_head_zero_) {
+        for (Int k=0; k<head_length_; ++k) {
+          sum += head_filter[k]*last_input[-k];
+        }
+      }
+      const Int output_id = (time_+i) & output_mask_;
+      output[i] = sum + output_ring_[output_id];
+      output_ring_[output_id] = 0.0;
+      input_ring_[(time_+i) & input_mask_] = input[i];
+    }
+    for (Int i=0; i<head_length_-1; ++i) { buffer[i] = buffer[block_length+i]; }
+
+    time_ += block_length;
+    done += block_length;
+    for (Int level_id=0; level_id<(Int) levels_.size(); ++level_id) {
+      if (time_ % levels_[level_id].partition_length == 0) {
+        ProcessLevel(levels_[level_id]);
+      }
+    }
+  }
+}
+
+
+void PartitionedConvolver::ProcessLevel(Level& level) noexcept {
+  const Int partition_length = level.partition_length;
+  const Int fft_length = 2*partition_length;
+  const Int num_partitions = level.filter_spectra.size();
+
+  // Overlap-save: the transform of the last 2*partition_length inputs
+  level.latest = (level.latest+1) % num_partitions;
+  Complex* input_spectrum = level.input_spectra[level.latest].data();
+  for (Int i=0; i<fft_length; ++i) {
+    input_spectrum[i] = Complex(input_ring_[(time_-fft_length+i) & input_mask_],
+                                0.0);
+  }
+  Transform(level.plan, false, input_spectrum);
+  // The input spectrum is kept even when the filter is zero, in case the
+  // filter is changed by SetFilter
+  if (level.is_zero) { return; }
+
+  Complex* accumulator = accumulator_.data();
+  for (Int i=0; i<fft_length; ++i) { accumulator[i] = Complex(0.0, 0.0); }
+  for (Int j=0; j<num_partitions; ++j) {
+    if (level.is_partition_zero[j]) { continue; }
+    const Complex* input = level.input_spectra[(level.latest-j+num_partitions) %
+                                               num_partitions].data();
+    const Complex* filter = level.filter_spectra[j].data();
+    for (Int i=0; i<fft_length; ++i) {
+      accumulator[i] = Complex(accumulator[i].real() +
+                                   input[i].real()*filter[i].real() -
+                                   input[i].imag()*filter[i].imag(),
+                               accumulator[i].imag() +
+                                   input[i].real()*filter[i].imag() +
+                                   input[i].imag()*filter[i].real());
+    }
+  }
+  Transform(level.plan, true, accumulator);
+
+  // The second half is the convolution for the last partition_length inputs,
+  // which goes level.offset later in the output
+  const Int output_start = time_-partition_length+level.offset;
+  for (Int i=0; i<partition_length; ++i) {
+    output_ring_[(output_start+i) & output_mask_] +=
+        accumulator[partition_length+i].real();
+  }
+}
+
+
+void PartitionedConvolver::Reset() noexcept {
+  std::fill(head_buffer_.begin(), head_buffer_.end(), 0.0);
+  std::fill(input_ring_.begin(), input_ring_.end(), 0.0);
+  std::fill(output_ring_.begin(), output_ring_.end(), 0.0);
+  for (Int level_id=0; level_id<(Int) levels_.size(); ++level_id) {
+    Level& level = levels_[level_id];
+    for (Int j=0; j<(Int) level.input_spectra.size(); ++j) {
+      std::fill(level.input_spectra[j].begin(), level.input_spectra[j].end(),
+                Complex(0.0, 0.0));
+    }
+    level.latest = 0;
+  }
+  time_ = 0;
+}
+
+} // namespace sal
@@ -0,0 +1,117 @@
+/*
+ resampler.cpp
+ Spatial Audio Library (SAL)
+ Copyright (c) 2015, Enzo De Sena
+ All rights reserved.
+
+ Authors: Enzo De Sena, enzodesena@gmail.com
+
+ */
+
+#include "resampler.h"
+#include "salconstants.h"
+#include <cmath>
+#include <algorithm>
+
+namespace sal {
+
+// Kaiser window parameter, giving about 85 dB of stopband attenuation
+static const Sample kKaiserBeta = 8.6;
+
+
+Resampler::Resampler(const Time input_sampling_frequency,
+                     const Time output_sampling_frequency,
+                     const Int num_zero_crossings,
+                     const Sample rolloff) {
+  ASSERT(input_sampling_frequency > 0.0 && output_sampling_frequency > 0.0);
+  ASSERT(num_zero_crossings > 0 && rolloff > 0.0 && rolloff <= 1.0);
+
+  const Int input_rate = mcl::RoundToInt(input_sampling_frequency);
+  const Int output_rate = mcl::RoundToInt(output_sampling_frequency);
+  if (! mcl::IsEqual((Time) input_rate, input_sampling_frequency) ||
+      ! mcl::IsEqual((Time) output_rate, output_sampling_frequency)) {
+    mcl::Logger::GetInstance().LogError("The resampler only supports integer "
+                                        "sampling frequencies. Resampling from "
+                                        "%d to %d instead.",
+                                        (int) input_rate, (int) output_rate);
+  }
+
+  Int greatest_common_divisor = input_rate;
+  Int remainder = output_rate;
+  while (remainder != 0) {
+    const Int temp = greatest_common_divisor % remainder;
+    greatest_common_divisor = remainder;
+    remainder = temp;
+  }
+  up_factor_ = output_rate/greatest_common_divisor;
+  down_factor_ = input_rate/greatest_common_divisor;
+
+  if (up_factor_ == down_factor_) {
+    half_length_ = 0;
+    return;
+  }
+
+  // Cutoff relative to the Nyquist frequency of the input
+  const Sample cutoff = rolloff*std::min(1.0, ((Sample) up_factor_) /
+                                              ((Sample) down_factor_));
+  half_length_ = (Int) ceil(((Sample) num_zero_crossings)/cutoff);
+
+  const Sample normalisation = BesselI0(kKaiserBeta);
+  coefficients_.assign(up_factor_, std::vector<Sample>(2*half_length_));
+  for (Int phase=0; phase<up_factor_; ++phase) {
+    const Sample fraction = ((Sample) phase)/((Sample) up_factor_);
+    for (Int tap=0; tap<2*half_length_; ++tap) {
+      // Distance between the output sample and the input sample
+      const Sample distance = fraction - ((Sample) (tap-half_length_+1));
+      const Sample argument = PI*cutoff*distance;
+      const Sample sinc = (distance == 0.0) ? 1.0 : sin(argument)/argument;
+      const Sample ratio = distance/((Sample) half_length_);
+      const Sample window = (std::abs(ratio) >= 1.0) ? 0.0 :
+          BesselI0(kKaiserBeta*sqrt(1.0-ratio*ratio))/normalisation;
+      coefficients_[phase][tap] = cutoff*sinc*window;
+    }
+  }
+}
+
+
+Int Resampler::GetOutputLength(const Int input_length) const noexcept {
+  return (input_length*up_factor_ + down_factor_ - 1)/down_factor_;
+}
+
+
+Signal Resampler::Run(const Signal& input) const noexcept {
+  if (up_factor_ == down_factor_) { return input; }
+
+  const Int input_length = input.size();
+  const Int output_length = GetOutputLength(input_length);
+  Signal output(output_length, 0.0);
+  for (Int i=0; i<output_length; ++i) {
+    const Int position = i*down_factor_;
+    const Int base = position/up_factor_;
+    const std::vector<Sample>& coefficients = coefficients_[position%up_factor_];
+    const Int first_id = base-half_length_+1;
+    const Int start_tap = std::max((Int) 0, -first_id);
+    const Int end_tap = std::min(2*half_length_, input_length-first_id);
+    Sample sum = 0.0;
+    for (Int tap=start_tap; tap<end_tap; ++tap) {
+      sum += input[first_id+tap]*coefficients[tap];
+    }
+    output[i] = sum;
+  }
+  return output;
+}
+
+
+Sample Resampler::BesselI0(const Sample x) noexcept {
+  Sample sum = 1.0;
+  Sample term = 1.0;
+  const Sample half_x = x/2.0;
+  for (Int k=1; k<50; ++k) {
+    term *= half_x/((Sample) k);
+    sum += term*term;
+    if (term*term < sum*1.0E-16) { break; }
+  }
+  return sum;
+}
+
+} // namespace sal
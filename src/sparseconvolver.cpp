@@ -0,0 +1,80 @@
+/*
+ sparseconvolver.cpp
+ Spatial Audio Library (SAL)
+ Copyright (c) 2015, Enzo De Sena
+ All rights reserved.
+
+ Authors: Enzo De Sena, enzodesena@gmail.com
+
+ */
+
+#include "sparseconvolver.h"
+#include "salconstants.h"
+#include <algorithm>
+
+namespace sal {
+
+SparseConvolver::SparseConvolver(const Int max_delay,
+                                 const Int max_num_taps) :
+        max_delay_(max_delay), time_(0) {
+  ASSERT(max_delay >= 0 && max_num_taps >= 0);
+  delays_.reserve(max_num_taps);
+  gains_.reserve(max_num_taps);
+  // At least twice the longest delay, so that the blocks between the
+  // delays are at least as long
+  Int ring_length = 1;
+  while (ring_length < 2*(max_delay+1)) { ring_length *= 2; }
+  input_ring_.assign(ring_length, 0.0);
+  input_mask_ = ring_length-1;
+}
+
+
+void SparseConvolver::SetTaps(const std::vector<Int>& delays,
+                              const std::vector<Sample>& gains) noexcept {
+  ASSERT(delays.size() == gains.size());
+  ASSERT(delays.size() <= delays_.capacity());
+  delays_.assign(delays.begin(), delays.end());
+  gains_.assign(gains.begin(), gains.end());
+  for (Int j=0; j<(Int) delays_.size(); ++j) {
+    ASSERT(delays_[j] >= 0 && delays_[j] <= max_delay_);
+  }
+}
+
+
+void SparseConvolver::Filter(const Sample* input_data,
+                             const Int num_samples,
+                             Sample* output_data) noexcept {
+  // The blocks are short enough that their inputs do not overwrite the
+  // inputs that are still read at the longest delay
+  const Int max_block_length = (Int) input_ring_.size()-max_delay_;
+  const Int num_taps = delays_.size();
+  Sample* ring = input_ring_.data();
+  Int done = 0;
+  while (done < num_samples) {
+    const Int block_length = std::min(num_samples-done, max_block_length);
+    const Sample* input = input_data+done;
+    Sample* output = output_data+done;
+    for (Int i=0; i<block_length; ++i) {
+      ring[(time_+i) & input_mask_] = input[i];
+      output[i] = 0.0;
+    }
+    // Tap by tap, so that each tap reads a contiguous part of the ring
+    for (Int j=0; j<num_taps; ++j) {
+      const Sample gain = gains_[j];
+      const Int begin = time_-delays_[j];
+      for (Int i=0; i<block_length; ++i) {
+        output[i] += gain*ring[(begin+i) & input_mask_];
+      }
+    }
+    time_ += block_length;
+    done += block_length;
+  }
+}
+
+
+void SparseConvolver::Reset() noexcept {
+  std::fill(input_ring_.begin(), input_ring_.end(), 0.0);
+  time_ = 0;
+}
+
+} // namespace sal
@@ -12,6 +12,7 @@
 #include "salconstants.h"
 #include "vectorop.h"
 #include <cmath>
+#include <algorithm>
 #include "transformop.h"
 
 using mcl::Point;
@@ -110,13 +111,107 @@ mcl::Complex SphericalHeadMic::Sphere(Length a, Length r,
 }
   
 Signal SphericalHeadMic::GetBrir(const Ear ear, const Point& point) noexcept {
-  return GenerateImpulseResponse(sphere_radius_,
-                                 point.norm(), // point distance
-                                 GetTheta(point, ears_angle_, ear),
-                                 sound_speed_,
-                                 alg_threshold_,
-                                 impulse_response_length_,
-                                 sampling_frequency_);
+  if (! hrir_table_) {
+    return GenerateImpulseResponse(sphere_radius_,
+                                   point.norm(), // point distance
+                                   GetTheta(point, ears_angle_, ear),
+                                   sound_speed_,
+                                   alg_threshold_,
+                                   impulse_response_length_,
+                                   sampling_frequency_);
+  }
+  
+  const std::vector<Length>& distances = hrir_table_->distances;
+  const Int num_distances = distances.size();
+  const Int num_thetas = hrir_table_->num_thetas;
+  
+  // Fractional position in the grid of angles (GetTheta is in [0, PI])
+  const Angle theta_position = std::min(std::max(
+      GetTheta(point, ears_angle_, ear)/PI*((Angle) (num_thetas-1)), 0.0),
+      (Angle) (num_thetas-1));
+  const Int theta_id = std::min((Int) theta_position, num_thetas-2);
+  const Sample theta_weight = theta_position - ((Angle) theta_id);
+  
+  // Fractional position in the (logarithmic) grid of distances
+  Int distance_id = 0;
+  Sample distance_weight = 0.0;
+  if (num_distances > 1) {
+    const Length distance = std::min(std::max(point.norm(), distances.front()),
+                                     distances.back());
+    const Sample distance_position = log(distance/distances.front()) /
+        log(distances.back()/distances.front())*((Sample) (num_distances-1));
+    distance_id = std::min((Int) distance_position, num_distances-2);
+    distance_weight = distance_position - ((Sample) distance_id);
+  }
+  
+  Signal hrir(impulse_response_length_, 0.0);
+  for (Int i=0; i<2; ++i) {
+    const Sample weight_d = (i == 0) ? 1.0-distance_weight : distance_weight;
+    if (weight_d == 0.0) { continue; }
+    for (Int j=0; j<2; ++j) {
+      const Sample weight = weight_d*((j == 0) ? 1.0-theta_weight : theta_weight);
+      if (weight == 0.0) { continue; }
+      const Signal& entry = GetTableHrir(distance_id+i, theta_id+j);
+      for (Int k=0; k<impulse_response_length_; ++k) {
+        hrir[k] += weight*entry[k];
+      }
+    }
+  }
+  return hrir;
+}
+  
+  
+void SphericalHeadMic::SetHrirTable(const Int num_thetas,
+                                    const Length min_distance,
+                                    const Length max_distance,
+                                    const Int num_distances,
+                                    const bool precompute) {
+  ASSERT(num_thetas >= 2 && num_distances >= 1);
+  ASSERT(min_distance > sphere_radius_ && max_distance >= min_distance);
+  
+  std::shared_ptr<HrirTable> table(new HrirTable());
+  table->num_thetas = num_thetas;
+  table->distances.resize(num_distances, min_distance);
+  for (Int i=1; i<num_distances; ++i) {
+    const Length exponent = ((Length) i)/((Length) (num_distances-1));
+    table->distances[i] = min_distance*pow(max_distance/min_distance, exponent);
+  }
+  table->hrirs.resize(num_distances*num_thetas);
+  table->filled.reset(new std::atomic<bool>[num_distances*num_thetas]);
+  for (Int i=0; i<num_distances*num_thetas; ++i) {
+    table->filled[i].store(false);
+  }
+  hrir_table_ = table;
+  
+  if (precompute) {
+    for (Int i=0; i<num_distances; ++i) {
+      for (Int j=0; j<num_thetas; ++j) { GetTableHrir(i, j); }
+    }
+  }
+}
+  
+  
+const Signal& SphericalHeadMic::GetTableHrir(const Int distance_id,
+                                             const Int theta_id) noexcept {
+  HrirTable& table = *hrir_table_;
+  const Int id = distance_id*table.num_thetas + theta_id;
+  // An entry is never modified after it is flagged as filled, so that it can
+  // be read without locking.
+  if (! table.filled[id].load(std::memory_order_acquire)) {
+    std::lock_guard<std::mutex> lock(table.mutex);
+    if (! table.filled[id].load(std::memory_order_relaxed)) {
+      const Angle theta = PI*((Angle) theta_id)/((Angle) (table.num_thetas-1));
+      table.hrirs[id] = GenerateImpulseResponse(sphere_radius_,
+                                                table.distances[distance_id],
+                                                theta,
+                                                sound_speed_,
+                                                alg_threshold_,
+                                                impulse_response_length_,
+                                                sampling_frequency_);
+      table.filled[id].store(true, std::memory_order_release);
+    }
+  }
+  return table.hrirs[id];
 }
   
   
@@ -0,0 +1,162 @@
+/*
+ structuralheadmic.cpp
+ Spatial Audio Library (SAL)
+ Copyright (c) 2015, Enzo De Sena
+ All rights reserved.
+
+ Authors: Enzo De Sena, enzodesena@gmail.com
+
+ */
+
+#include "structuralheadmic.h"
+#include "point.h"
+#include <cmath>
+
+using mcl::Point;
+using mcl::Quaternion;
+
+namespace sal {
+
+// Parameters of the head-shadow filter as suggested in Brown and Duda's article
+static const Sample kAlphaMin = 0.1;
+static const Angle kThetaMin = 150.0/180.0*PI;
+
+
+StructuralHeadMic::StructuralHeadMic(const Point& position,
+                                     const Quaternion& orientation,
+                                     const Angle ears_angle,
+                                     const Length sphere_radius,
+                                     const Time sampling_frequency,
+                                     const Length sound_speed) :
+        StereoMicrophone(position, orientation), ears_angle_(ears_angle),
+        sphere_radius_(sphere_radius), sampling_frequency_(sampling_frequency),
+        sound_speed_(sound_speed) {
+  ASSERT(sphere_radius > 0.0 && sampling_frequency > 0.0 && sound_speed > 0.0);
+  const Sample beta = 2.0*sound_speed/sphere_radius;
+  const Sample k = 2.0*sampling_frequency; // Bilinear transform
+  a1_ = (beta-k)/(beta+k);
+  b0_offset_ = beta/(beta+k);
+  b0_slope_ = k/(beta+k);
+  b1_offset_ = beta/(beta+k);
+  b1_slope_ = -k/(beta+k);
+}
+
+
+Sample StructuralHeadMic::GetShadowCoefficient(const Angle theta) noexcept {
+  return (1.0+kAlphaMin/2.0) + (1.0-kAlphaMin/2.0)*cos(theta/kThetaMin*PI);
+}
+
+
+Time StructuralHeadMic::GetWoodworthDelay(const Angle theta,
+                                          const Length sphere_radius,
+                                          const Length sound_speed) noexcept {
+  const Angle abs_theta = std::abs(theta);
+  if (abs_theta < PI/2.0) {
+    return sphere_radius/sound_speed*(1.0-cos(abs_theta));
+  } else {
+    return sphere_radius/sound_speed*(1.0+abs_theta-PI/2.0);
+  }
+}
+
+
+Angle StructuralHeadMic::GetTheta(const Point& point,
+                                  const Ear ear) const noexcept {
+  const Length norm = point.norm();
+  if (norm == 0.0) { return ears_angle_; } // Conventionally in front
+  const Sample side = (ear == kLeftEar) ? 1.0 : -1.0;
+  Sample cos_theta = (point.x()*cos(ears_angle_) +
+                      side*point.y()*sin(ears_angle_))/norm;
+  cos_theta = std::min(std::max(cos_theta, -1.0), 1.0);
+  return acos(cos_theta);
+}
+
+
+void StructuralHeadMic::CreateInstanceIfNotExist(const Int wave_id) noexcept {
+  if (instances_.count(wave_id) == 0) {
+    const Time max_delay = GetWoodworthDelay(PI, sphere_radius_, sound_speed_);
+    Instance instance = {
+      DelayFilter(0, (Int) ceil(max_delay*sampling_frequency_)+1),
+      {{0.0, 0.0, 0.0, 0.0}, {0.0, 0.0, 0.0, 0.0}},
+      false
+    };
+    instances_.insert(std::make_pair(wave_id, instance));
+  }
+}
+
+
+void StructuralHeadMic::AddPlaneWaveRelative(const Sample* input_data,
+                                             const Int num_samples,
+                                             const Point& point,
+                                             const Int wave_id,
+                                             Buffer& output_buffer) noexcept {
+  CreateInstanceIfNotExist(wave_id);
+  Instance& instance = instances_.at(wave_id);
+
+  Sample target_alphas[2];
+  Time target_delays[2];
+  for (Int ear_id=0; ear_id<2; ++ear_id) {
+    const Angle theta = GetTheta(point, (ear_id == 0) ? kLeftEar : kRightEar);
+    target_alphas[ear_id] = GetShadowCoefficient(theta);
+    target_delays[ear_id] = GetWoodworthDelay(theta, sphere_radius_,
+                                              sound_speed_)*sampling_frequency_;
+  }
+  if (! instance.initialised) {
+    // Start from the right parameters rather than ramping from zero
+    for (Int ear_id=0; ear_id<2; ++ear_id) {
+      instance.ears[ear_id].alpha = target_alphas[ear_id];
+      instance.ears[ear_id].delay = target_delays[ear_id];
+    }
+    instance.initialised = true;
+  }
+
+  Sample alpha_steps[2];
+  Time delay_steps[2];
+  for (Int ear_id=0; ear_id<2; ++ear_id) {
+    alpha_steps[ear_id] = (target_alphas[ear_id]-instance.ears[ear_id].alpha) /
+        ((Sample) num_samples);
+    delay_steps[ear_id] = (target_delays[ear_id]-instance.ears[ear_id].delay) /
+        ((Time) num_samples);
+  }
+
+  Sample* output_data[2] = {
+    output_buffer.GetWritePointer(Buffer::kLeftChannel),
+    output_buffer.GetWritePointer(Buffer::kRightChannel)
+  };
+  for (Int i=0; i<num_samples; ++i) {
+    instance.delay_filter.Write(input_data[i]);
+    for (Int ear_id=0; ear_id<2; ++ear_id) {
+      EarState& ear = instance.ears[ear_id];
+      ear.alpha += alpha_steps[ear_id];
+      ear.delay += delay_steps[ear_id];
+      const Sample input = instance.delay_filter.FractionalReadAt(ear.delay);
+      const Sample output = (b0_offset_+b0_slope_*ear.alpha)*input +
+          (b1_offset_+b1_slope_*ear.alpha)*ear.previous_input -
+          a1_*ear.previous_output;
+      ear.previous_input = input;
+      ear.previous_output = output;
+      output_data[ear_id][i] += output;
+    }
+    instance.delay_filter.Tick();
+  }
+
+  // Avoid the accumulation of round-off errors
+  for (Int ear_id=0; ear_id<2; ++ear_id) {
+    instance.ears[ear_id].alpha = target_alphas[ear_id];
+    instance.ears[ear_id].delay = target_delays[ear_id];
+  }
+}
+
+
+void StructuralHeadMic::Reset() noexcept {
+  for (auto iterator = instances_.begin();
+       iterator != instances_.end();
+       ++iterator) {
+    iterator->second.delay_filter.Reset();
+    for (Int ear_id=0; ear_id<2; ++ear_id) {
+      iterator->second.ears[ear_id].previous_input = 0.0;
+      iterator->second.ears[ear_id].previous_output = 0.0;
+    }
+  }
+}
+
+} // namespace sal
@@ -10,6 +10,10 @@
 
 #include "ambisonics.h"
 #include "microphone.h"
+#include "kemarmic.h"
+#include <iostream>
+#include <ctime>
+#include <cstdlib>
 
 using mcl::Point;
 using mcl::Quaternion;
@@ -67,10 +71,7 @@ bool AmbisonicsMic::Test() {
   ASSERT(IsEqual(buffer_a.GetSample(2, 1, 0), sample*(-1.414213562373095)));
   ASSERT(IsEqual(buffer_a.GetSample(2, -1, 0), sample*0.0));
   
-#if MCL_LOAD_BOOST
-  std::cout<<"Running Boost-dependent Ambisonics tests"<<std::endl;
-    
-  // Testing Ambisonics encoding
+  // Testing 3D Ambisonics encoding
   const Int N_b = 3; // Ambisonics order
   AmbisonicsMic mic_b(Point(0.0,0.0,0.0), mcl::AxAng2Quat(0,0,1,PI/2.0), N_b, HoaNormalisation::N3d, HoaOrdering::Acn);
   
@@ -135,12 +136,510 @@ bool AmbisonicsMic::Test() {
   ASSERT(IsEqual(buffer_b.GetSample(2, 1, 0), sample*sqrt(15.0)/2.0/sqrt(5.0)*sin(2.0*phi)*cos(theta)));
   ASSERT(IsEqual(buffer_b.GetSample(3, 3, 0), sample*mcl::Sqrt(35.0/8.0)/sqrt(7.0)*pow(cos(phi),3.0)*cos(3.0*theta)));
   
-#endif  
+  // Addition theorem: the sum over the degrees of the products of the
+  // harmonics in two directions is (2n+1) times the Legendre polynomial of
+  // the cosine of the angle between them.
+  const Int N_d = 10;
+  std::vector<Sample> harmonics_p(HoaBuffer::GetNumChannels(N_d));
+  std::vector<Sample> harmonics_q(HoaBuffer::GetNumChannels(N_d));
+  const Point point_p(0.3, -0.8, 0.5);
+  const Point point_q(-0.6, -0.1, 0.9);
+  GetSphericalHarmonics(N_d, point_p, N3d, harmonics_p.data());
+  GetSphericalHarmonics(N_d, point_q, N3d, harmonics_q.data());
+  const Sample cos_angle = mcl::DotProduct(mcl::Normalized(point_p),
+                                           mcl::Normalized(point_q));
+  Sample legendre_previous = 1.0;
+  Sample legendre = cos_angle;
+  for (Int n=0; n<=N_d; ++n) {
+    if (n >= 2) { // Bonnet's recursion
+      const Sample legendre_next = ((2.0*n-1.0)*cos_angle*legendre -
+                                    (n-1.0)*legendre_previous)/((Sample) n);
+      legendre_previous = legendre;
+      legendre = legendre_next;
+    }
+    Sample sum = 0.0;
+    for (Int m=-n; m<=n; ++m) {
+      sum += harmonics_p[n*n+n+m]*harmonics_q[n*n+n+m];
+    }
+    ASSERT(IsEqual(sum, (2.0*n+1.0)*((n == 0) ? 1.0 : legendre)));
+  }
+  
+  // Encoding a rotated direction is the same as rotating the encoding
+  const Int N_e = 7;
+  const Quaternion rotation = mcl::AxAng2Quat(0.4, 0.1, -0.7, 0.9);
+  std::vector<Sample> harmonics(HoaBuffer::GetNumChannels(N_e));
+  std::vector<Sample> harmonics_rotated(HoaBuffer::GetNumChannels(N_e));
+  GetSphericalHarmonics(N_e, point_p, N3d, harmonics.data());
+  GetSphericalHarmonics(N_e, mcl::QuatRotate(rotation, point_p), N3d,
+                        harmonics_rotated.data());
+  ASSERT(IsEqual(mcl::Multiply(AmbisonicsRotator::GetRotationMatrix(N_e,
+                                                                    rotation),
+                               harmonics), harmonics_rotated));
+  
+  // The fused kernel handles a number of channels that is not a multiple
+  // of four, and longer blocks
+  AmbisonicsMic mic_e(Point(0.0,0.0,0.0), Quaternion::Identity(), N_e,
+                      HoaNormalisation::N3d);
+  const Int num_samples_e = 5;
+  HoaBuffer buffer_e(N_e, num_samples_e);
+  MonoBuffer input_e(num_samples_e);
+  for (Int i=0; i<num_samples_e; ++i) { input_e.SetSample(i, 0.1*i-0.2); }
+  mic_e.AddPlaneWave(input_e, point_p, buffer_e);
+  for (Int j=0; j<HoaBuffer::GetNumChannels(N_e); ++j) {
+    for (Int i=0; i<num_samples_e; ++i) {
+      ASSERT(IsEqual(buffer_e.Buffer::GetSample(j, i),
+                     harmonics[j]*(0.1*i-0.2)));
+    }
+  }
+  
+  // Level of detail
+  ASSERT(GetLevelOfDetailOrder(5, 1, 2.0, 1.0) == 5);
+  ASSERT(GetLevelOfDetailOrder(5, 1, 2.0, 3.9) == 5);
+  ASSERT(GetLevelOfDetailOrder(5, 1, 2.0, 4.0) == 4);
+  ASSERT(GetLevelOfDetailOrder(5, 1, 2.0, 16.0) == 2);
+  ASSERT(GetLevelOfDetailOrder(5, 1, 2.0, 1000.0) == 1);
+  
+  const Int N_h = 4;
+  const Int num_channels_h = HoaBuffer::GetNumChannels(N_h);
+  AmbisonicsMic mic_h(Point(0.0,0.0,0.0), Quaternion::Identity(), N_h, N3d);
+  mic_h.SetWaveOrder(1, 2);
+  std::vector<Sample> harmonics_h(num_channels_h);
+  GetSphericalHarmonics(N_h, point_p, N3d, harmonics_h.data());
+  HoaBuffer buffer_h(N_h, num_samples_e);
+  // A wave with a lower level of detail only writes its first channels, and
+  // the other waves are not affected
+  mic_h.AddPlaneWave(input_e, point_p, 1, buffer_h);
+  for (Int j=0; j<num_channels_h; ++j) {
+    for (Int i=0; i<num_samples_e; ++i) {
+      ASSERT(IsEqual(buffer_h.Buffer::GetSample(j, i),
+                     (j < 9) ? harmonics_h[j]*input_e.GetSample(i) : 0.0));
+    }
+  }
+  buffer_h.Reset();
+  mic_h.AddPlaneWave(input_e, point_p, 2, buffer_h);
+  for (Int j=0; j<num_channels_h; ++j) {
+    for (Int i=0; i<num_samples_e; ++i) {
+      ASSERT(IsEqual(buffer_h.Buffer::GetSample(j, i),
+                     harmonics_h[j]*input_e.GetSample(i)));
+    }
+  }
+  // When the order is raised, the new components are faded in across the
+  // next block
+  mic_h.ClearWaveOrder(1);
+  buffer_h.Reset();
+  mic_h.AddPlaneWave(input_e, point_p, 1, buffer_h);
+  for (Int j=0; j<num_channels_h; ++j) {
+    for (Int i=0; i<num_samples_e; ++i) {
+      const Sample weight = (j < 9) ? 1.0 : ((Sample) (i+1))/num_samples_e;
+      ASSERT(IsEqual(buffer_h.Buffer::GetSample(j, i),
+                     weight*harmonics_h[j]*input_e.GetSample(i)));
+    }
+  }
+  // The order is chosen from the distance (4.5 m is two doublings from 1 m)
+  mic_h.SetLevelOfDetail(1.0);
+  buffer_h.Reset();
+  mic_h.Reset();
+  mic_h.AddPlaneWave(input_e, mcl::Multiply(mcl::Normalized(point_p), 4.5), 3,
+                     buffer_h);
+  for (Int j=0; j<num_channels_h; ++j) {
+    for (Int i=0; i<num_samples_e; ++i) {
+      ASSERT(IsEqual(buffer_h.Buffer::GetSample(j, i),
+                     (j < 9) ? harmonics_h[j]*input_e.GetSample(i) : 0.0));
+    }
+  }
+  // When the order is lowered, the components are faded out
+  buffer_h.Reset();
+  mic_h.AddPlaneWave(input_e, mcl::Multiply(mcl::Normalized(point_p), 9.0), 3,
+                     buffer_h);
+  for (Int j=0; j<num_channels_h; ++j) {
+    for (Int i=0; i<num_samples_e; ++i) {
+      const Sample weight = (j < 4) ? 1.0 : ((j < 9) ?
+          1.0-((Sample) (i+1))/num_samples_e : 0.0);
+      ASSERT(IsEqual(buffer_h.Buffer::GetSample(j, i),
+                     weight*harmonics_h[j]*input_e.GetSample(i)));
+    }
+  }
+  
+  // The compile-time channel map is the same as the runtime one
+  static_assert(FixedOrderHoaBuffer<3>::GetChannelId(2, -1) == 5,
+                "Wrong ACN channel map");
+  static_assert(FixedOrderHoaBuffer<3, HoaOrdering::Fuma>::
+                GetChannelId(1, 0) == 3, "Wrong FuMa channel map");
+  static_assert(FixedOrderHoaBuffer<5>::GetOrderFromAcn(24) == 4,
+                "Wrong order from ACN index");
+  typedef FixedOrderHoaBuffer<5, HoaOrdering::Acn> AcnBuffer;
+  typedef FixedOrderHoaBuffer<5, HoaOrdering::Fuma> FumaBuffer;
+  for (Int n=0; n<=5; ++n) {
+    for (Int m=-n; m<=n; ++m) {
+      ASSERT(AcnBuffer::GetChannelId(n, m) ==
+             HoaBuffer::GetChannelId(n, m, HoaOrdering::Acn));
+      ASSERT(FumaBuffer::GetChannelId(n, m) ==
+             HoaBuffer::GetChannelId(n, m, HoaOrdering::Fuma));
+      ASSERT(FumaBuffer::GetChannelIdFromAcn(n*n+n+m) ==
+             HoaBuffer::GetChannelId(n, m, HoaOrdering::Fuma));
+    }
+  }
+  
+  // The compile-time-order microphone gives the same output as the
+  // runtime-order one
+  FixedOrderAmbisonicsMic<3, HoaOrdering::Fuma>
+      mic_f(Point(0.0,0.0,0.0), mcl::AxAng2Quat(0,0,1,PI/2.0), Sn3d);
+  AmbisonicsMic mic_g(Point(0.0,0.0,0.0), mcl::AxAng2Quat(0,0,1,PI/2.0), 3,
+                      Sn3d, HoaOrdering::Fuma);
+  ASSERT(mic_f.num_channels() == mic_g.num_channels());
+  FixedOrderHoaBuffer<3, HoaOrdering::Fuma> buffer_f(num_samples_e);
+  HoaBuffer buffer_g(3, num_samples_e, HoaOrdering::Fuma);
+  mic_f.AddPlaneWave(input_e, point_q, buffer_f);
+  mic_g.AddPlaneWave(input_e, point_q, buffer_g);
+  mic_f.AddPlaneWave(input_e, point_p, buffer_f);
+  mic_g.AddPlaneWave(input_e, point_p, buffer_g);
+  for (Int n=0; n<=3; ++n) {
+    for (Int m=-n; m<=n; ++m) {
+      for (Int i=0; i<num_samples_e; ++i) {
+        ASSERT(IsEqual(buffer_f.GetSample(n, m, i),
+                       buffer_g.GetSample(n, m, i)));
+      }
+    }
+  }
 
   return true;
 }
 
   
+template<Int Order>
+static void PrintEncodingTime(const MonoBuffer& input, const Int num_blocks) {
+  const Int num_sources = 16;
+  AmbisonicsMic mic(Point(0.0,0.0,0.0), Quaternion::Identity(), Order, N3d);
+  FixedOrderAmbisonicsMic<Order> fixed_mic(Point(0.0,0.0,0.0),
+                                           Quaternion::Identity(), N3d);
+  Microphone* mics[2] = {&mic, &fixed_mic};
+  FixedOrderHoaBuffer<Order> output(input.num_samples());
+  for (Int mic_id=0; mic_id<2; ++mic_id) {
+    clock_t launch = clock();
+    for (Int i=0; i<num_blocks; ++i) {
+      output.Reset();
+      for (Int source_id=0; source_id<num_sources; ++source_id) {
+        const Angle angle = 2.0*PI*((Angle) (i+source_id))/((Angle) num_blocks);
+        mics[mic_id]->AddPlaneWave(input, Point(cos(angle), sin(angle), 0.3),
+                                   source_id, output);
+      }
+    }
+    clock_t done = clock();
+    std::cout<<((mic_id == 0) ? "Runtime" : "Compile-time")<<"-order "
+             <<"Ambisonics mic, order "<<Order
+             <<" (one minute of "<<num_sources<<" moving sources): "
+             <<(done - launch) / ((sal::Time) CLOCKS_PER_SEC)<<" s\n";
+  }
+}
+  
+  
+bool AmbisonicsMic::SimulationTime() {
+  const Time sampling_frequency = 44100.0;
+  const Int block_length = 512;
+  const Int num_blocks = (Int) (60.0*sampling_frequency)/block_length;
+  
+  MonoBuffer input(block_length);
+  srand(0);
+  for (Int i=0; i<block_length; ++i) {
+    input.SetSample(i, ((Sample) rand())/((Sample) RAND_MAX)-0.5);
+  }
+  
+  PrintEncodingTime<1>(input, num_blocks);
+  PrintEncodingTime<3>(input, num_blocks);
+  PrintEncodingTime<5>(input, num_blocks);
+  
+  // Level of detail, with 16 sources at distances between 1 and 16 m
+  const Int order = 5;
+  const Int num_sources = 16;
+  HoaBuffer output(order, block_length);
+  for (Int level_of_detail=0; level_of_detail<2; ++level_of_detail) {
+    AmbisonicsMic mic(Point(0.0,0.0,0.0), Quaternion::Identity(), order, N3d);
+    if (level_of_detail == 1) { mic.SetLevelOfDetail(2.0); }
+    clock_t launch = clock();
+    for (Int i=0; i<num_blocks; ++i) {
+      output.Reset();
+      for (Int source_id=0; source_id<num_sources; ++source_id) {
+        const Angle angle = 2.0*PI*((Angle) (i+source_id))/((Angle) num_blocks);
+        const Length distance = (Length) (source_id+1);
+        mic.AddPlaneWave(input, Point(distance*cos(angle),
+                                      distance*sin(angle), 0.3),
+                         source_id, output);
+      }
+    }
+    clock_t done = clock();
+    std::cout<<"Ambisonics mic, order "<<order
+             <<((level_of_detail == 1) ? ", with" : ", without")
+             <<" level of detail (one minute of "<<num_sources
+             <<" sources between 1 and 16 m): "
+             <<(done - launch) / ((sal::Time) CLOCKS_PER_SEC)<<" s\n";
+  }
+  
+  return true;
+}
+  
+  
+/** Returns the angle [rad] between the energy vector of `gains` and `point`. */
+static Angle EnergyVectorError(const std::vector<Point>& loudspeakers,
+                               const std::vector<Sample>& gains,
+                               const Point& point) {
+  Point energy_vector(0.0, 0.0, 0.0);
+  for (Int i=0; i<(Int) loudspeakers.size(); ++i) {
+    energy_vector = mcl::Sum(energy_vector,
+                             mcl::Multiply(mcl::Normalized(loudspeakers[i]),
+                                           gains[i]*gains[i]));
+  }
+  return mcl::AngleBetweenPoints(energy_vector, point);
+}
+  
+  
+bool Ambisonics3dDec::Test() {
+  using mcl::IsEqual;
+  
+  // Max-rE weights
+  const Int order = 3;
+  const std::vector<Sample> weights = MaxEnergyWeights(order);
+  ASSERT(IsEqual(weights[1]/weights[0], cos(137.9/180.0*PI/4.51)));
+  Sample energy = 0.0;
+  for (Int n=0; n<=order; ++n) { energy += (2.0*n+1.0)*weights[n]*weights[n]; }
+  ASSERT(IsEqual(energy, 16.0));
+  
+  // Quasi-uniform layout of 50 loudspeakers on the sphere
+  std::vector<Point> sphere;
+  for (Int i=0; i<50; ++i) {
+    const Sample z = 1.0-(2.0*i+1.0)/50.0;
+    sphere.push_back(Point(sqrt(1.0-z*z)*cos(2.4*i), sqrt(1.0-z*z)*sin(2.4*i),
+                           z));
+  }
+  const Int num_components = HoaBuffer::GetNumChannels(order);
+  
+  // The pseudo-inverse decoder followed by the encoding of the loudspeakers
+  // gives back the original components
+  const mcl::Matrix<Sample> matrix_a = PseudoInverseDec(order, sphere);
+  ASSERT(matrix_a.num_rows() == 50 && matrix_a.num_columns() == num_components);
+  mcl::Matrix<Sample> encoding(num_components, 50);
+  std::vector<Sample> harmonics(num_components);
+  for (Int i=0; i<50; ++i) {
+    AmbisonicsMic::GetSphericalHarmonics(order, sphere[i], N3d,
+                                         harmonics.data());
+    encoding.SetColumn(i, harmonics);
+  }
+  const mcl::Matrix<Sample> product = mcl::Multiply(encoding, matrix_a);
+  for (Int j=0; j<num_components; ++j) {
+    for (Int k=0; k<num_components; ++k) {
+      ASSERT(IsEqual(product.GetElement(j, k), (j == k) ? 1.0 : 0.0, 1.0E-6));
+    }
+  }
+  
+  // AllRAD on a dome (no loudspeakers below the horizon): the energy vector
+  // points towards the sources in the upper hemisphere, and a source in the
+  // direction of a loudspeaker is loudest in that loudspeaker.
+  std::vector<Point> dome;
+  const Angle elevations[3] = {0.0, PI/6.0, PI/3.0};
+  const Int num_per_ring[3] = {8, 8, 4};
+  for (Int ring=0; ring<3; ++ring) {
+    for (Int i=0; i<num_per_ring[ring]; ++i) {
+      const Angle azimuth = 2.0*PI*i/num_per_ring[ring] + ring*PI/8.0;
+      dome.push_back(Point(3.0*cos(elevations[ring])*cos(azimuth),
+                           3.0*cos(elevations[ring])*sin(azimuth),
+                           3.0*sin(elevations[ring])));
+    }
+  }
+  dome.push_back(Point(0.0, 0.0, 2.5));
+  const Int num_dome = dome.size();
+  const Ambisonics3dDec decoder_b(order, dome, HoaDecodingMethod::AllRad);
+  const mcl::Matrix<Sample> matrix_b = decoder_b.decoding_matrix();
+  const Point sources[4] = {Point(1.0,0.2,0.1), Point(-0.3,0.8,0.5),
+                            Point(0.1,-0.2,1.0), Point(-1.0,-1.0,0.4)};
+  for (Int source_id=0; source_id<4; ++source_id) {
+    AmbisonicsMic::GetSphericalHarmonics(order, sources[source_id], N3d,
+                                         harmonics.data());
+    const std::vector<Sample> gains = mcl::Multiply(matrix_b, harmonics);
+    ASSERT(EnergyVectorError(dome, gains, sources[source_id]) < PI/18.0);
+  }
+  AmbisonicsMic::GetSphericalHarmonics(order, dome[10], N3d, harmonics.data());
+  const std::vector<Sample> gains_b = mcl::Multiply(matrix_b, harmonics);
+  for (Int i=0; i<num_dome; ++i) {
+    if (i != 10) { ASSERT(gains_b[i] < gains_b[10]); }
+  }
+  
+  // Decoding a buffer with Sn3d normalisation and FuMa ordering gives the
+  // same output as with N3d and ACN, also when the loudspeakers are split
+  // across threads, and with max-rE decoding.
+  Ambisonics3dDec decoder_c(order, dome, HoaDecodingMethod::AllRad, true,
+                            700.0, 44100.0, N3d, HoaOrdering::Acn, 1);
+  Ambisonics3dDec decoder_d(order, dome, HoaDecodingMethod::AllRad, true,
+                            700.0, 44100.0, Sn3d, HoaOrdering::Fuma, 3);
+  AmbisonicsMic mic_c(Point(0.0,0.0,0.0), Quaternion::Identity(), order, N3d);
+  AmbisonicsMic mic_d(Point(0.0,0.0,0.0), Quaternion::Identity(), order, Sn3d,
+                      HoaOrdering::Fuma);
+  const Int num_samples = 20;
+  MonoBuffer input(num_samples);
+  for (Int i=0; i<num_samples; ++i) { input.SetSample(i, sin(0.3*i)); }
+  for (Int block_id=0; block_id<2; ++block_id) {
+    HoaBuffer stream_c(order, num_samples);
+    HoaBuffer stream_d(order, num_samples, HoaOrdering::Fuma);
+    mic_c.AddPlaneWave(input, sources[block_id], stream_c);
+    mic_d.AddPlaneWave(input, sources[block_id], stream_d);
+    Buffer output_c(num_dome, num_samples);
+    Buffer output_d(num_dome, num_samples);
+    decoder_c.Decode(stream_c, output_c);
+    decoder_d.Decode(stream_d, output_d);
+    for (Int i=0; i<num_dome; ++i) {
+      ASSERT(IsEqual(output_c.GetReadPointer(i), output_d.GetReadPointer(i),
+                     num_samples));
+    }
+  }
+  
+  // Without max-rE decoding, the output is the product with the matrix
+  Ambisonics3dDec decoder_e(order, sphere, HoaDecodingMethod::PseudoInverse);
+  HoaBuffer stream_e(order, 1);
+  AmbisonicsMic::GetSphericalHarmonics(order, sources[1], N3d,
+                                       harmonics.data());
+  for (Int j=0; j<num_components; ++j) {
+    stream_e.Buffer::SetSample(j, 0, harmonics[j]);
+  }
+  Buffer output_e(50, 1);
+  decoder_e.Decode(stream_e, output_e);
+  const std::vector<Sample> gains_e = mcl::Multiply(matrix_a, harmonics);
+  for (Int i=0; i<50; ++i) {
+    ASSERT(IsEqual(output_e.GetSample(i, 0), gains_e[i]));
+  }
+  
+  return true;
+}
+  
+  
+bool AmbisonicsBatchEncoder::Test() {
+  using mcl::IsEqual;
+  
+  const Int order = 3;
+  const Int num_sources = 5;
+  const Int num_samples = 150; // Not a multiple of the tile length
+  const Point directions[num_sources] = {
+    Point(1.0,0.0,0.0), Point(0.2,-0.7,0.4), Point(-0.3,0.1,-0.9),
+    Point(0.0,0.0,1.0), Point(-0.5,0.5,0.1)
+  };
+  
+  Buffer input(num_sources, num_samples);
+  srand(1);
+  for (Int source_id=0; source_id<num_sources; ++source_id) {
+    for (Int i=0; i<num_samples; ++i) {
+      input.SetSample(source_id, i, ((Sample) rand())/((Sample) RAND_MAX)-0.5);
+    }
+  }
+  
+  // Static sources give the same output as one AmbisonicsMic per source
+  AmbisonicsBatchEncoder encoder_a(order, num_sources, Sn3d, HoaOrdering::Fuma);
+  ASSERT(encoder_a.num_channels() == 16);
+  AmbisonicsMic mic(Point(0.0,0.0,0.0), Quaternion::Identity(), order, Sn3d,
+                    HoaOrdering::Fuma);
+  HoaBuffer output_a(order, num_samples, HoaOrdering::Fuma);
+  HoaBuffer output_b(order, num_samples, HoaOrdering::Fuma);
+  for (Int source_id=0; source_id<num_sources; ++source_id) {
+    encoder_a.SetSourceDirection(source_id, directions[source_id]);
+    mic.AddPlaneWave(input.GetReadPointer(source_id), num_samples,
+                     directions[source_id], source_id, output_b);
+  }
+  encoder_a.Encode(input, output_a);
+  for (Int j=0; j<encoder_a.num_channels(); ++j) {
+    ASSERT(IsEqual(output_a.GetReadPointer(j), output_b.GetReadPointer(j),
+                   num_samples));
+  }
+  
+  // The encoder adds to the output
+  encoder_a.Encode(input, output_a);
+  for (Int j=0; j<encoder_a.num_channels(); ++j) {
+    for (Int i=0; i<num_samples; ++i) {
+      ASSERT(IsEqual(output_a.Buffer::GetSample(j, i),
+                     2.0*output_b.Buffer::GetSample(j, i)));
+    }
+  }
+  
+  // A moving source is ramped linearly, and reaches the new gains at the
+  // end of the block
+  const Int order_c = 2;
+  AmbisonicsBatchEncoder encoder_c(order_c, 1);
+  Buffer ones(1, num_samples);
+  for (Int i=0; i<num_samples; ++i) { ones.SetSample(0, i, 1.0); }
+  std::vector<Sample> gains_from(HoaBuffer::GetNumChannels(order_c));
+  std::vector<Sample> gains_to(HoaBuffer::GetNumChannels(order_c));
+  AmbisonicsMic::GetSphericalHarmonics(order_c, directions[1], N3d,
+                                       gains_from.data());
+  AmbisonicsMic::GetSphericalHarmonics(order_c, directions[2], N3d,
+                                       gains_to.data());
+  encoder_c.SetSourceDirection(0, directions[1]);
+  encoder_c.SetSourceDirection(0, directions[2]);
+  HoaBuffer output_c(order_c, num_samples);
+  encoder_c.Encode(ones, output_c);
+  for (Int j=0; j<encoder_c.num_channels(); ++j) {
+    for (Int i=0; i<num_samples; ++i) {
+      const Sample weight = ((Sample) (i+1))/((Sample) num_samples);
+      ASSERT(IsEqual(output_c.Buffer::GetSample(j, i),
+                     (1.0-weight)*gains_from[j] + weight*gains_to[j]));
+    }
+  }
+  output_c.Reset();
+  encoder_c.Encode(ones, output_c);
+  for (Int j=0; j<encoder_c.num_channels(); ++j) {
+    for (Int i=0; i<num_samples; ++i) {
+      ASSERT(IsEqual(output_c.Buffer::GetSample(j, i), gains_to[j]));
+    }
+  }
+  
+  return true;
+}
+  
+  
+bool AmbisonicsBatchEncoder::SimulationTime() {
+  const Int order = 3;
+  const Int num_sources = 32;
+  const Int block_length = 512;
+  const Int num_blocks = 1000;
+  
+  Buffer input(num_sources, block_length);
+  srand(0);
+  for (Int source_id=0; source_id<num_sources; ++source_id) {
+    for (Int i=0; i<block_length; ++i) {
+      input.SetSample(source_id, i, ((Sample) rand())/((Sample) RAND_MAX)-0.5);
+    }
+  }
+  HoaBuffer output(order, block_length);
+  AmbisonicsMic mic(Point(0.0,0.0,0.0), Quaternion::Identity(), order, N3d);
+  AmbisonicsBatchEncoder encoder(order, num_sources);
+  const Sample num_source_channels = (Sample) (num_sources*num_blocks*
+      block_length*HoaBuffer::GetNumChannels(order));
+  
+  // Method 0 is the per-wave path (which does not ramp the gains), method 1
+  // is the batch encoder with static sources and method 2 with moving ones.
+  const char* method_names[3] = {"Per-wave", "Batch (static sources)",
+                                 "Batch (moving sources)"};
+  for (Int method_id=0; method_id<3; ++method_id) {
+    clock_t launch = clock();
+    for (Int i=0; i<num_blocks; ++i) {
+      output.Reset();
+      for (Int source_id=0; source_id<num_sources; ++source_id) {
+        const Angle angle = 2.0*PI*((Angle) (i+source_id))/((Angle) num_blocks);
+        const Point direction(cos(angle), sin(angle), 0.3);
+        if (method_id == 0) {
+          mic.AddPlaneWave(input.GetReadPointer(source_id), block_length,
+                           direction, source_id, output);
+        } else if (method_id == 2 || i == 0) {
+          encoder.SetSourceDirection(source_id, direction);
+        }
+      }
+      if (method_id > 0) { encoder.Encode(input, output); }
+    }
+    clock_t done = clock();
+    const Time time = (done - launch) / ((sal::Time) CLOCKS_PER_SEC);
+    std::cout<<method_names[method_id]<<" Ambisonics encoding, order "<<order
+             <<", "<<num_sources<<" sources: "
+             <<num_source_channels/time<<" source-channels/s\n";
+  }
+  
+  return true;
+}
+  
+  
 bool AmbisonicsHorizDec::Test() {
   
   using mcl::IsEqual;
@@ -366,6 +865,205 @@ bool AmbisonicsHorizDec::Test() {
   ASSERT(IsEqual(output_b.GetReadPointer(3), output_3_cmp));
   ASSERT(IsEqual(output_b.GetReadPointer(4), output_4_cmp));
   
+  // Decoding in blocks of different lengths gives the same output (the
+  // filters keep their state across blocks)
+  AmbisonicsHorizDec decoder_c(order, true, 1200, loudspeaker_angles, true,
+                               2.0, 44100, SOUND_SPEED);
+  const Int block_lengths[3] = {1, 3, 0};
+  Int from_sample = 0;
+  for (Int block_id=0; block_id<3; ++block_id) {
+    const Int block_length = block_lengths[block_id];
+    HoaBuffer stream_c(order, block_length);
+    Buffer output_c(loudspeaker_angles.size(), block_length);
+    for (Int j=0; j<stream_b.num_channels(); ++j) {
+      for (Int i=0; i<block_length; ++i) {
+        stream_c.Buffer::SetSample(j, i,
+                                   stream_b.Buffer::GetSample(j, from_sample+i));
+      }
+    }
+    decoder_c.Decode(stream_c, output_c);
+    for (Int j=0; j<(Int) loudspeaker_angles.size(); ++j) {
+      ASSERT(IsEqual(output_c.GetReadPointer(j),
+                     output_b.GetReadPointer(j)+from_sample, block_length));
+    }
+    from_sample += block_length;
+  }
+  
+  return true;
+}
+  
+  
+// Real spherical harmonics up to the second order (N3d normalisation, ACN
+// ordering) in the direction of `point`
+static std::vector<Sample> SphericalHarmonicsOrder2(const Point& point) {
+  const Point p = mcl::Normalized(point);
+  const Sample x = p.x();
+  const Sample y = p.y();
+  const Sample z = p.z();
+  std::vector<Sample> output(9);
+  output[0] = 1.0;
+  output[1] = sqrt(3.0)*y;
+  output[2] = sqrt(3.0)*z;
+  output[3] = sqrt(3.0)*x;
+  output[4] = sqrt(15.0)*x*y;
+  output[5] = sqrt(15.0)*y*z;
+  output[6] = sqrt(5.0)/2.0*(3.0*z*z-1.0);
+  output[7] = sqrt(15.0)*x*z;
+  output[8] = sqrt(15.0)/2.0*(x*x-y*y);
+  return output;
+}
+  
+  
+bool AmbisonicsRotator::Test() {
+  using mcl::IsEqual;
+  using mcl::Matrix;
+  
+  ASSERT(IsEqual(GetRotationMatrix(1, Quaternion::Identity()),
+                 Matrix<Sample>({{1.0, 0.0, 0.0, 0.0}, {0.0, 1.0, 0.0, 0.0},
+                                 {0.0, 0.0, 1.0, 0.0}, {0.0, 0.0, 0.0, 1.0}})));
+  
+  // Rotating a plane wave rotates its direction
+  const Quaternion rotation_a = mcl::AxAng2Quat(0.3, -0.5, 0.8, 1.1);
+  const Quaternion rotation_b = mcl::AxAng2Quat(-0.9, 0.2, 0.1, -2.3);
+  const Point points[3] = {Point(1.0,0.0,0.0), Point(0.2,-0.7,0.4),
+                           Point(-0.3,0.1,-0.9)};
+  const Matrix<Sample> matrix_a = GetRotationMatrix(2, rotation_a);
+  for (Int i=0; i<3; ++i) {
+    ASSERT(IsEqual(mcl::Multiply(matrix_a, SphericalHarmonicsOrder2(points[i])),
+                   SphericalHarmonicsOrder2(mcl::QuatRotate(rotation_a,
+                                                            points[i]))));
+  }
+  
+  // At higher orders, the matrices are orthogonal and compose like the
+  // rotations
+  const Int high_order = 7;
+  const Matrix<Sample> matrix_high_a = GetRotationMatrix(high_order, rotation_a);
+  const Matrix<Sample> matrix_high_b = GetRotationMatrix(high_order, rotation_b);
+  const Matrix<Sample> identity = mcl::Multiply(matrix_high_a,
+                                                mcl::Transpose(matrix_high_a));
+  for (Int i=0; i<identity.num_rows(); ++i) {
+    for (Int j=0; j<identity.num_columns(); ++j) {
+      ASSERT(IsEqual(identity.GetElement(i, j), (i == j) ? 1.0 : 0.0));
+    }
+  }
+  ASSERT(IsEqual(mcl::Multiply(matrix_high_a, matrix_high_b),
+                 GetRotationMatrix(high_order,
+                                   mcl::QuatMultiply(rotation_a, rotation_b))));
+  
+  // The rotation is interpolated across the first block, and is then
+  // constant. Rotating in place is allowed.
+  const Int num_samples = 4;
+  const Point point(0.2,-0.7,0.4);
+  const std::vector<Sample> harmonics = SphericalHarmonicsOrder2(point);
+  const std::vector<Sample> rotated_harmonics =
+      SphericalHarmonicsOrder2(mcl::QuatRotate(rotation_a, point));
+  HoaBuffer buffer(2, num_samples);
+  for (Int i=0; i<num_samples; ++i) {
+    for (Int j=0; j<9; ++j) { buffer.Buffer::SetSample(j, i, harmonics[j]); }
+  }
+  AmbisonicsRotator rotator(2);
+  rotator.SetRotation(rotation_a);
+  rotator.Rotate(buffer, buffer);
+  for (Int i=0; i<num_samples; ++i) {
+    const Sample weight = ((Sample) (i+1))/((Sample) num_samples);
+    for (Int j=0; j<9; ++j) {
+      ASSERT(IsEqual(buffer.Buffer::GetSample(j, i),
+                     (1.0-weight)*harmonics[j] + weight*rotated_harmonics[j]));
+    }
+  }
+  HoaBuffer buffer_b(2, num_samples);
+  for (Int i=0; i<num_samples; ++i) {
+    for (Int j=0; j<9; ++j) { buffer_b.Buffer::SetSample(j, i, harmonics[j]); }
+  }
+  HoaBuffer output_b(2, num_samples);
+  rotator.Rotate(buffer_b, output_b);
+  for (Int j=0; j<9; ++j) {
+    ASSERT(IsEqual(output_b.Buffer::GetSample(j, 0), rotated_harmonics[j]));
+  }
+  
+  return true;
+}
+  
+  
+bool AmbisonicsBinauralDec::Test() {
+  using mcl::IsEqual;
+  
+  const Int order = 2;
+  const Int num_samples = 256;
+  KemarMic kemar_mic(Point(0.0,0.0,0.0), Quaternion::Identity(),
+                     KemarMic::kCompactDataset);
+  
+  // (order+1)^2 loudspeakers on a Fibonacci grid
+  const Int num_loudspeakers = (order+1)*(order+1);
+  std::vector<Point> loudspeaker_positions;
+  for (Int i=0; i<num_loudspeakers; ++i) {
+    const Sample z = 1.0-(2.0*i+1.0)/((Sample) num_loudspeakers);
+    const Angle azimuth = PI*(3.0-sqrt(5.0))*((Angle) i);
+    loudspeaker_positions.push_back(Point(sqrt(1.0-z*z)*cos(azimuth),
+                                          sqrt(1.0-z*z)*sin(azimuth), z));
+  }
+  
+  // The microphone is only read: the response of a wave that is being
+  // rendered carries on across the construction of the decoder.
+  KemarMic kemar_mic_cmp(Point(0.0,0.0,0.0), Quaternion::Identity(),
+                         KemarMic::kCompactDataset);
+  MonoBuffer late_impulse(num_samples);
+  late_impulse.SetSample(num_samples-1, 1.0);
+  StereoBuffer tail(num_samples);
+  StereoBuffer tail_cmp(num_samples);
+  kemar_mic.AddPlaneWave(late_impulse, Point(0.0,1.0,0.0), 0, tail);
+  kemar_mic_cmp.AddPlaneWave(late_impulse, Point(0.0,1.0,0.0), 0, tail_cmp);
+  
+  AmbisonicsBinauralDec decoder(order, loudspeaker_positions, kemar_mic,
+                                COMPACT_LENGTH_KEMAR);
+  ASSERT((Int) decoder.filters_left_.size() == num_loudspeakers);
+  ASSERT((Int) decoder.filters_right_.size() == num_loudspeakers);
+  
+  MonoBuffer silence(num_samples);
+  tail.Reset();
+  tail_cmp.Reset();
+  kemar_mic.AddPlaneWave(silence, Point(0.0,1.0,0.0), 0, tail);
+  kemar_mic_cmp.AddPlaneWave(silence, Point(0.0,1.0,0.0), 0, tail_cmp);
+  Sample tail_energy = 0.0;
+  for (Int i=0; i<num_samples; ++i) {
+    ASSERT(IsEqual(tail.GetLeftReadPointer()[i],
+                   tail_cmp.GetLeftReadPointer()[i]));
+    tail_energy += pow(tail.GetLeftReadPointer()[i], 2.0);
+  }
+  ASSERT(tail_energy > 0.0);
+  
+  // With (order+1)^2 loudspeakers, a plane wave from the direction of a
+  // loudspeaker (here, an elevated one) is decoded only to that
+  // loudspeaker, hence the output is given by its HRIRs.
+  MonoBuffer impulse(num_samples);
+  impulse.SetSample(0, 1.0);
+  const Point point = loudspeaker_positions[1];
+  ASSERT(point.z() > 0.5);
+  
+  AmbisonicsMic ambisonics_mic(Point(0.0,0.0,0.0), Quaternion::Identity(),
+                               order, N3d);
+  HoaBuffer hoa_buffer(order, num_samples);
+  ambisonics_mic.AddPlaneWave(impulse, point, hoa_buffer);
+  StereoBuffer output(num_samples);
+  decoder.Decode(hoa_buffer, output);
+  
+  StereoBuffer output_cmp(num_samples);
+  kemar_mic.AddPlaneWave(impulse, point, 1, output_cmp);
+  for (Int i=0; i<num_samples; ++i) {
+    ASSERT(IsEqual(output.GetLeftReadPointer()[i],
+                   output_cmp.GetLeftReadPointer()[i], 1.0E-6));
+    ASSERT(IsEqual(output.GetRightReadPointer()[i],
+                   output_cmp.GetRightReadPointer()[i], 1.0E-6));
+  }
+  
+  // The output buffer is overwritten (the filters' tails are over)
+  hoa_buffer.Reset();
+  decoder.Decode(hoa_buffer, output);
+  for (Int i=0; i<num_samples; ++i) {
+    ASSERT(IsEqual(output.GetLeftReadPointer()[i], 0.0));
+    ASSERT(IsEqual(output.GetRightReadPointer()[i], 0.0));
+  }
+  
   return true;
 }
   
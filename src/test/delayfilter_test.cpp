@@ -323,7 +323,22 @@ bool DelayFilter::Test() {
     delay_filter_h.Tick(stride);
   }
   
-  
+  // Third-order Lagrange interpolation is exact on polynomials up to the
+  // third order, and falls back to linear interpolation below one sample.
+  DelayFilter delay_filter_i(0, 10);
+  for (Int i=0; i<8; ++i) {
+    const Sample t = (Sample) i;
+    delay_filter_i.Write(t*t*t-2.0*t);
+    if (i < 7) { delay_filter_i.Tick(); }
+  }
+  for (Time delay=1.0; delay<=6.0; delay+=0.25) {
+    const Time t = 7.0-delay;
+    ASSERT(IsEqual(delay_filter_i.LagrangeReadAt(delay), t*t*t-2.0*t));
+  }
+  ASSERT(IsEqual(delay_filter_i.LagrangeReadAt(0.5),
+                 delay_filter_i.FractionalReadAt(0.5)));
+  ASSERT(IsEqual(delay_filter_i.LagrangeReadAt(3.0),
+                 delay_filter_i.ReadAt(3)));
   
   return true;
 }
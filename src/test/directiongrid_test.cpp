@@ -0,0 +1,104 @@
+/*
+ directiongrid_test.cpp
+ Spatial Audio Library (SAL)
+ Copyright (c) 2015, Enzo De Sena
+ All rights reserved.
+
+ Authors: Enzo De Sena, enzodesena@gmail.com
+
+ */
+
+#include "directiongrid.h"
+#include "comparisonop.h"
+#include "salconstants.h"
+#include <algorithm>
+
+using mcl::Point;
+
+namespace sal {
+
+// Stores the direction of the centre of each cell (offset by 100 degrees,
+// so that it is never zero) into the weights of its neighbours, so that the
+// test can check what the grid passes on.
+static DirectionGrid::Cell TestNeighbours(const Angle elevation,
+                                          const Angle azimuth) {
+  DirectionGrid::Cell cell;
+  cell.num_neighbours = 0;
+  DirectionGrid::AddNeighbour(0, 0, elevation+100.0, cell);
+  DirectionGrid::AddNeighbour(0, 1, azimuth+100.0, cell);
+  return cell;
+}
+
+
+bool DirectionGrid::Test() {
+  using mcl::IsEqual;
+
+  const Int num_cells_per_side = 9;
+  DirectionGrid grid(num_cells_per_side, TestNeighbours);
+  ASSERT(! grid.IsEmpty());
+  ASSERT(grid.num_cells() == 6*num_cells_per_side*num_cells_per_side);
+  ASSERT(DirectionGrid().IsEmpty());
+
+  // With an odd number of cells per side, the axes are at cell centres
+  ASSERT(IsEqual(grid.GetCellCentre(grid.GetCellId(Point(1.0,0.0,0.0))),
+                 Point(1.0,0.0,0.0)));
+  ASSERT(IsEqual(grid.GetCellCentre(grid.GetCellId(Point(-2.0,0.0,0.0))),
+                 Point(-1.0,0.0,0.0)));
+  ASSERT(IsEqual(grid.GetCellCentre(grid.GetCellId(Point(0.0,0.5,0.0))),
+                 Point(0.0,1.0,0.0)));
+  ASSERT(IsEqual(grid.GetCellCentre(grid.GetCellId(Point(0.0,-0.5,0.0))),
+                 Point(0.0,-1.0,0.0)));
+  ASSERT(IsEqual(grid.GetCellCentre(grid.GetCellId(Point(0.0,0.0,3.0))),
+                 Point(0.0,0.0,1.0)));
+  ASSERT(IsEqual(grid.GetCellCentre(grid.GetCellId(Point(0.0,0.0,-3.0))),
+                 Point(0.0,0.0,-1.0)));
+
+  // The origin is mapped to the front
+  ASSERT(grid.GetCellId(Point(0.0,0.0,0.0)) ==
+         grid.GetCellId(Point(1.0,0.0,0.0)));
+
+  // Elevation and azimuth of the cell centres
+  const Cell& front = grid.cell(grid.GetCellId(Point(1.0,0.0,0.0)));
+  ASSERT(front.num_neighbours == 2);
+  ASSERT(IsEqual(front.neighbours[0].weight, 100.0));
+  ASSERT(IsEqual(front.neighbours[1].weight, 100.0));
+  const Cell& left = grid.cell(grid.GetCellId(Point(0.0,1.0,0.0)));
+  ASSERT(left.num_neighbours == 2);
+  ASSERT(IsEqual(left.neighbours[0].weight, 100.0));
+  ASSERT(IsEqual(left.neighbours[1].weight, 190.0));
+  const Cell& right = grid.cell(grid.GetCellId(Point(0.0,-1.0,0.0)));
+  ASSERT(IsEqual(right.neighbours[1].weight, 370.0));
+  const Cell& up = grid.cell(grid.GetCellId(Point(0.0,0.0,1.0)));
+  ASSERT(IsEqual(up.neighbours[0].weight, 190.0));
+
+  // Every direction falls in the cell whose centre is closest to it (within
+  // the largest distance between a cell centre and its corners).
+  const Angle max_angle = 3.0*PI/4.0/((Angle) num_cells_per_side);
+  for (Int i=0; i<50; ++i) {
+    for (Int j=0; j<50; ++j) {
+      const Angle theta = PI*((Angle) i)/49.0;
+      const Angle phi = 2.0*PI*((Angle) j)/50.0;
+      const Point point(sin(theta)*cos(phi), sin(theta)*sin(phi), cos(theta));
+      const Int cell_id = grid.GetCellId(point);
+      ASSERT(cell_id >= 0 && cell_id < grid.num_cells());
+      const Point centre = grid.GetCellCentre(cell_id);
+      ASSERT(acos(std::min(DotProduct(point, centre), 1.0)) < max_angle);
+    }
+  }
+
+  // Neighbours are merged and zero weights are discarded
+  Cell cell;
+  cell.num_neighbours = 0;
+  AddNeighbour(2, 3, 0.25, cell);
+  AddNeighbour(2, 4, 0.0, cell);
+  AddNeighbour(2, 3, 0.25, cell);
+  AddNeighbour(1, 3, 0.5, cell);
+  ASSERT(cell.num_neighbours == 2);
+  ASSERT(cell.neighbours[0].row_id == 2 && cell.neighbours[0].column_id == 3);
+  ASSERT(IsEqual(cell.neighbours[0].weight, 0.5));
+  ASSERT(cell.neighbours[1].row_id == 1 && cell.neighbours[1].column_id == 3);
+
+  return true;
+}
+
+} // namespace sal
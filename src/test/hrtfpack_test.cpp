@@ -0,0 +1,102 @@
+/*
+ hrtfpack_test.cpp
+ Spatial Audio Library (SAL)
+ Copyright (c) 2015, Enzo De Sena
+ All rights reserved.
+ 
+ Authors: Enzo De Sena, enzodesena@gmail.com
+ 
+ */
+
+#include "hrtfpack.h"
+#include "mcltypes.h"
+#include "comparisonop.h"
+#include <cstdio>
+
+namespace sal {
+  
+bool HrtfPack::Test() {
+  using mcl::IsEqual;
+  
+  // A jagged grid with two rows of different length, as in the Kemar database
+  std::vector<std::vector<Signal> > database_left(2);
+  std::vector<std::vector<Signal> > database_right(2);
+  database_left[0].push_back({1.0, 0.5, -0.25});
+  database_right[0].push_back({-1.0, 0.0, 0.25});
+  database_left[1].push_back({0.125, 0.75});
+  database_right[1].push_back({0.375, -0.5, 0.0625});
+  database_left[1].push_back({2.0, -2.0, 1.0});
+  database_right[1].push_back({-2.0, 2.0, -1.0});
+  
+  std::vector<HrtfPackDirection> directions;
+  for (Int i=0; i<(Int)database_left.size(); ++i) {
+    for (Int j=0; j<(Int)database_left[i].size(); ++j) {
+      HrtfPackDirection direction;
+      direction.row_id = (std::int32_t) i;
+      direction.column_id = (std::int32_t) j;
+      direction.elevation = (float) (10.0*i);
+      direction.azimuth = (float) (90.0*j);
+      directions.push_back(direction);
+    }
+  }
+  
+  const std::string file_path = "sal_hrtfpack_test.salhrtf";
+  
+  for (Int format_id=0; format_id<2; ++format_id) {
+    SampleFormat sample_format = (format_id == 0) ? kFloat32 : kFloat64;
+    ASSERT(Write(file_path, directions, database_left, database_right,
+                 48000.0, sample_format));
+    
+    HrtfPack pack;
+    ASSERT(! pack.IsOpen());
+    ASSERT(pack.Open(file_path));
+    ASSERT(pack.IsOpen());
+    ASSERT(pack.num_rows() == 2);
+    ASSERT(pack.num_directions() == 3);
+    ASSERT(pack.num_samples() == 3);
+    ASSERT(pack.sample_format() == sample_format);
+    ASSERT(IsEqual(pack.sampling_frequency(), 48000.0));
+    ASSERT(pack.direction(2).row_id == 1);
+    ASSERT(pack.direction(2).column_id == 1);
+    ASSERT(IsEqual(pack.direction(2).elevation, 10.0));
+    ASSERT(IsEqual(pack.direction(2).azimuth, 90.0));
+    
+    // HRIRs have to be aligned so that they can be used in place
+    for (Int i=0; i<pack.num_directions(); ++i) {
+      ASSERT(((std::uintptr_t) pack.GetRawHrir(kLeftEar, i)) % kAlignment == 0);
+      ASSERT(((std::uintptr_t) pack.GetRawHrir(kRightEar, i)) % kAlignment == 0);
+    }
+    
+    std::vector<std::vector<Signal> > loaded_left = pack.GetDatabase(kLeftEar);
+    std::vector<std::vector<Signal> > loaded_right = pack.GetDatabase(kRightEar);
+    ASSERT(loaded_left.size() == 2);
+    ASSERT(loaded_left[0].size() == 1);
+    ASSERT(loaded_left[1].size() == 2);
+    ASSERT(IsEqual(loaded_left[0][0], database_left[0][0]));
+    ASSERT(IsEqual(loaded_right[0][0], database_right[0][0]));
+    // Shorter responses are zero padded
+    ASSERT(IsEqual(loaded_left[1][0], Signal({0.125, 0.75, 0.0})));
+    ASSERT(IsEqual(loaded_right[1][0], database_right[1][0]));
+    ASSERT(IsEqual(loaded_left[1][1], database_left[1][1]));
+    ASSERT(IsEqual(loaded_right[1][1], database_right[1][1]));
+    
+    pack.Close();
+    ASSERT(! pack.IsOpen());
+  }
+  
+  // Invalid files are rejected
+  FILE* file = fopen(file_path.c_str(), "wb");
+  const char garbage[128] = "This is not a valid pack";
+  fwrite(garbage, 1, sizeof(garbage), file);
+  fclose(file);
+  HrtfPack invalid_pack;
+  ASSERT(! invalid_pack.Open(file_path));
+  ASSERT(! invalid_pack.IsOpen());
+  
+  std::remove(file_path.c_str());
+  ASSERT(! invalid_pack.Open(file_path));
+  
+  return true;
+}
+
+} // namespace sal
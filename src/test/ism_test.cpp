@@ -12,7 +12,12 @@
 #include "salconstants.h"
 #include "microphone.h"
 #include "monomics.h"
+#include "structuralheadmic.h"
 #include "source.h"
+#include <iostream>
+#include <chrono>
+#include <ctime>
+#include <cstdlib>
 
 using mcl::IsEqual;
 using sal::Time;
@@ -25,6 +30,7 @@ using sal::Microphone;
 using mcl::Point;
 using sal::Sample;
 using sal::OmniMic;
+using sal::TrigMic;
 using sal::Length;
 using mcl::GainFilter;
 
@@ -182,11 +188,525 @@ bool Ism::Test() {
   //  ism_b.Run();
   //  mcl::Print(mic.stream()->PullAll());
   
+  // Testing that the RIR does not depend on the number of threads
+  CuboidRoom room_large(4.1, 3.3, 2.7, GainFilter(0.8));
+  OmniMic mic_large(Point(1.2, 1.9, 1.5));
+  Source source_large(Point(3.1, 0.8, 1.1));
+  const IsmInterpolation interpolations[2] = {none, peterson};
+  for (Int i=0; i<2; ++i) {
+    Ism ism_serial(&room_large, &source_large, &mic_large, interpolations[i],
+                   2000, sampling_frequency);
+    ism_serial.CalculateLattice();
+    ism_serial.CalculateRir();
+    for (Int num_threads=2; num_threads<=5; ++num_threads) {
+      Ism ism_parallel(&room_large, &source_large, &mic_large,
+                       interpolations[i], 2000, sampling_frequency);
+      ism_parallel.SetNumThreads(num_threads);
+      ism_parallel.CalculateLattice();
+      ism_parallel.CalculateRir();
+      ASSERT(ism_parallel.rir_ == ism_serial.rir_);
+      ASSERT(ism_parallel.lattice_.delays == ism_serial.lattice_.delays);
+    }
+  }
+  
+  // Testing the images against the direct formulas
+  Ism ism_images(&room_large, &source_large, &mic_large, none, 2000,
+                 sampling_frequency);
+  ism_images.CalculateLattice();
+  ism_images.CalculateRir();
+  ASSERT(ism_images.images_delay().size() > 100);
+  for (Int i=0; i<(Int) ism_images.lattice_.x.size(); ++i) {
+    Point image(ism_images.lattice_.x[i], ism_images.lattice_.y[i],
+                ism_images.lattice_.z[i]);
+    ASSERT(IsEqual(ism_images.lattice_.delays[i],
+                   mcl::Subtract(image, mic_large.position()).norm() /
+                   SOUND_SPEED));
+  }
+  ImageAxis axis = CalculateImageAxis(3, 4.1, 3.1, 0.7, 0.4);
+  for (Int m=-3; m<=3; ++m) {
+    for (Int p=0; p<=1; ++p) {
+      const Int id = 2*(m+3)+p;
+      Point image = room_large.ImageSourcePosition(source_large.position(),
+                                                   m, 0, 0, p, 0, 0);
+      ASSERT(IsEqual(axis.coordinates[id], image.x()));
+      ASSERT(IsEqual(axis.room_distances[id],
+                     (image.x() < 0.0) ? -image.x() :
+                     ((image.x() > 4.1) ? image.x()-4.1 : 0.0)));
+      ASSERT(IsEqual(axis.gains[id], pow(0.7, std::abs(m-p))*pow(0.4, std::abs(m))));
+    }
+  }
+  
+  for (Int q=1; q<(Int) axis.sorted_ids.size(); ++q) {
+    ASSERT(axis.orders[axis.sorted_ids[q]] >= axis.orders[axis.sorted_ids[q-1]]);
+    ASSERT(axis.max_gains[q] <= axis.max_gains[q-1]);
+    ASSERT(axis.min_room_distances[q] >= axis.min_room_distances[q-1]);
+  }
+  
+  // Testing that the shell-by-shell enumeration finds the same images as
+  // visiting the whole lattice
+  const Length max_distance = 2000.0/sampling_frequency*SOUND_SPEED;
+  const Length room_lengths[3] = {4.1, 3.3, 2.7};
+  Int num_images = 0;
+  for (Int mx=-10; mx<=10; ++mx) {
+    for (Int my=-10; my<=10; ++my) {
+      for (Int mz=-10; mz<=10; ++mz) {
+        for (Int p=0; p<8; ++p) {
+          Point image = room_large.ImageSourcePosition(source_large.position(),
+                                                       mx, my, mz, p/4,
+                                                       (p/2)%2, p%2);
+          const Length coordinates[3] = {image.x(), image.y(), image.z()};
+          Length distance_2 = 0.0;
+          for (Int i=0; i<3; ++i) {
+            const Length distance = std::max(0.0,
+                std::max(-coordinates[i], coordinates[i]-room_lengths[i]));
+            distance_2 += distance*distance;
+          }
+          if (distance_2 <= max_distance*max_distance) { num_images++; }
+        }
+      }
+    }
+  }
+  ASSERT(num_images == (Int) ism_images.lattice_.x.size());
+  
+  // Testing the maximum reflection order
+  Ism ism_order(&room_large, &source_large, &mic_large, none, 2000,
+                sampling_frequency);
+  const Int max_order_num_images[3] = {1, 7, 25};
+  for (Int order=0; order<3; ++order) {
+    ism_order.SetMaxReflectionOrder(order);
+    ism_order.CalculateLattice();
+    ASSERT((Int) ism_order.lattice_.x.size() == max_order_num_images[order]);
+  }
+  
+  // Testing the amplitude threshold in a damped room
+  CuboidRoom room_damped(4.1, 3.3, 2.7, GainFilter(0.3));
+  Ism ism_full(&room_damped, &source_large, &mic_large, none, 20000,
+               sampling_frequency);
+  ism_full.CalculateLattice();
+  ism_full.CalculateRir();
+  Ism ism_threshold(&room_damped, &source_large, &mic_large, none, 20000,
+                    sampling_frequency);
+  ism_threshold.SetAmplitudeThreshold(1.0E-7);
+  ism_threshold.CalculateLattice();
+  ism_threshold.CalculateRir();
+  ASSERT(ism_threshold.lattice_.x.size()*100 < ism_full.lattice_.x.size());
+  ASSERT(IsEqual(ism_threshold.rir_, ism_full.rir_, 1.0E-6));
+  
+  // Testing the table of Peterson's kernel against the direct formula, also
+  // at the edges of the RIR
+  Ism ism_peterson(&room_large, &source_large, &mic_large, peterson, 400,
+                   sampling_frequency);
+  ism_peterson.CalculatePetersonTable();
+  const Time peterson_delays[5] = {0.0, 50.3/sampling_frequency,
+    123.75/sampling_frequency, 200.0/sampling_frequency,
+    398.6/sampling_frequency};
+  for (Int i=0; i<5; ++i) {
+    std::vector<Sample> rir(400, 0.0);
+    ism_peterson.WriteSample(peterson_delays[i], 0.5, rir);
+    const Time window = 0.004;
+    const Time f_c = 0.9*sampling_frequency/2.0;
+    for (Int n=0; n<400; ++n) {
+      const Time t = ((Time) n)/sampling_frequency - peterson_delays[i];
+      Sample expected = 0.0;
+      if (std::abs(t) < window/2.0) {
+        expected = (t == 0.0) ? 0.5 :
+            0.5/2.0*(1.0+cos(2.0*PI*t/window))*sin(2.0*PI*f_c*t)/(2.0*PI*f_c*t);
+      }
+      ASSERT(IsEqual(rir[n], expected, 2.0E-5));
+    }
+  }
+  
+  // Testing that when the microphone moves only the RIR is recalculated,
+  // and that it is the same as that of a new Ism
+  OmniMic mic_moving(Point(1.2, 1.9, 1.5));
+  Ism ism_moving(&room_large, &source_large, &mic_moving, peterson, 2000,
+                 sampling_frequency);
+  MonoBuffer output_moving(impulse.num_samples());
+  ism_moving.Run(impulse.GetReadPointer(), impulse.num_samples(),
+                 output_moving);
+  const Sample first_gain = ism_moving.lattice_.gains[0];
+  ism_moving.lattice_.gains[0] = 2.0; // Marks the lattice
+  mic_moving.SetPosition(Point(3.8, 0.2, 2.6));
+  ism_moving.Run(impulse.GetReadPointer(), impulse.num_samples(),
+                 output_moving);
+  ASSERT(IsEqual(ism_moving.lattice_.gains[0], 2.0));
+  ism_moving.lattice_.gains[0] = first_gain;
+  ism_moving.CalculateRir();
+  
+  Ism ism_moved(&room_large, &source_large, &mic_moving, peterson, 2000,
+                sampling_frequency);
+  ism_moved.CalculateLattice();
+  ism_moved.CalculateRir();
+  ASSERT(ism_moving.rir_ == ism_moved.rir_);
+  ASSERT(ism_moving.lattice_.delays == ism_moved.lattice_.delays);
+  
+  // Moving the source instead recalculates the lattice
+  source_large.SetPosition(Point(0.5, 2.8, 0.4));
+  ism_moving.Run(impulse.GetReadPointer(), impulse.num_samples(),
+                 output_moving);
+  Ism ism_source_moved(&room_large, &source_large, &mic_moving, peterson,
+                       2000, sampling_frequency);
+  ism_source_moved.CalculateLattice();
+  ism_source_moved.CalculateRir();
+  ASSERT(ism_moving.rir_ == ism_source_moved.rir_);
+  
+  // Testing multiple receivers against one Ism per receiver
+  std::vector<Point> receivers;
+  receivers.push_back(Point(1.2, 1.9, 1.5));
+  receivers.push_back(Point(3.8, 0.2, 2.6));
+  receivers.push_back(Point(0.1, 3.2, 0.3));
+  for (Int num_threads=1; num_threads<=4; ++num_threads) {
+    Ism ism_receivers(&room_large, &source_large, &mic_moving, peterson, 2000,
+                      sampling_frequency);
+    ism_receivers.SetNumThreads(num_threads);
+    std::vector<std::vector<Sample> > rirs =
+        ism_receivers.CalculateRirs(receivers);
+    ASSERT(rirs.size() == receivers.size());
+    for (Int i=0; i<(Int) receivers.size(); ++i) {
+      OmniMic mic_receiver(receivers[i]);
+      Ism ism_receiver(&room_large, &source_large, &mic_receiver, peterson,
+                       2000, sampling_frequency);
+      ism_receiver.CalculateLattice();
+      ism_receiver.CalculateRir();
+      ASSERT(IsEqual(rirs[i], ism_receiver.rir_));
+    }
+  }
+  
+  // Microphones that are not omnidirectional. An omnidirectional TrigMic,
+  // which is not flagged as omni, gives the same output as OmniMic, with
+  // the early images rendered one by one and the late ones by direction.
+  CuboidRoom room_spatial(3.0, 4.0, 5.0, GainFilter(0.7));
+  Source source_spatial(Point(1.0, 1.5, 2.0));
+  OmniMic mic_omni(Point(2.0, 2.5, 1.0));
+  TrigMic mic_trig(Point(2.0, 2.5, 1.0), mcl::Quaternion::Identity(),
+                   std::vector<Sample>(1, 1.0));
+  Ism ism_omni(&room_spatial, &source_spatial, &mic_omni, none, 2000,
+               sampling_frequency);
+  Ism ism_trig(&room_spatial, &source_spatial, &mic_trig, none, 2000,
+               sampling_frequency);
+  const Int spatial_block_length = 100;
+  MonoBuffer input_spatial(spatial_block_length);
+  MonoBuffer output_omni(spatial_block_length);
+  MonoBuffer output_trig(spatial_block_length);
+  // When the microphone moves, the early images change delay immediately,
+  // while the convolver keeps the output of the previous RIR for the past
+  // inputs, so that the outputs are the same again only after a RIR length
+  for (Int block_id=0; block_id<40; ++block_id) {
+    for (Int i=0; i<spatial_block_length; ++i) {
+      input_spatial.SetSample(i, sin(0.1*((Sample) (block_id*100+i))));
+    }
+    if (block_id == 15) {
+      mic_omni.SetPosition(Point(1.5, 3.0, 4.0));
+      mic_trig.SetPosition(Point(1.5, 3.0, 4.0));
+    }
+    output_omni.Reset();
+    output_trig.Reset();
+    ism_omni.Run(input_spatial.GetReadPointer(), spatial_block_length,
+                 output_omni);
+    ism_trig.Run(input_spatial.GetReadPointer(), spatial_block_length,
+                 output_trig);
+    if (block_id >= 15 && block_id < 35) { continue; }
+    for (Int i=0; i<spatial_block_length; ++i) {
+      ASSERT(IsEqual(output_omni.GetSample(i), output_trig.GetSample(i),
+                     1.0E-10));
+    }
+  }
+  ASSERT(ism_trig.early_ids_.size() == 25);
+  ASSERT(ism_trig.late_convolvers_.size() == 6);
+  ism_trig.SetLateDirectionResolution(2);
+  ism_trig.Run(input_spatial.GetReadPointer(), spatial_block_length,
+               output_trig);
+  ASSERT(ism_trig.late_convolvers_.size() == 24);
+  
+  // The early images keep their wave_ids when the source moves and the
+  // lattice is calculated again, and the wave_ids are bounded
+  const ImageKey direct_key = {{0, 0, 0}};
+  const Int direct_slot_id = ism_trig.early_slots_.at(direct_key);
+  for (Int i=0; i<10; ++i) {
+    source_spatial.SetPosition(Point(1.0+0.1*((Length) i), 1.5, 2.0));
+    ism_trig.Run(input_spatial.GetReadPointer(), spatial_block_length,
+                 output_trig);
+    ASSERT(ism_trig.early_slots_.at(direct_key) == direct_slot_id);
+    for (Int j=0; j<(Int) ism_trig.early_slot_ids_.size(); ++j) {
+      ASSERT(ism_trig.early_slot_ids_[j] < 25);
+    }
+  }
+  source_spatial.SetPosition(Point(1.0, 1.5, 2.0));
+  
+  // A figure-of-eight microphone, with all the images rendered one by one,
+  // weighs each image by the cosine of its angle with the x-axis
+  TrigMic mic_eight(Point(2.0, 2.5, 1.0), mcl::Quaternion::Identity(),
+                    {0.0, 1.0});
+  const Int eight_length = 1000;
+  Ism ism_eight(&room_spatial, &source_spatial, &mic_eight, none, eight_length,
+                sampling_frequency);
+  ism_eight.SetEarlyReflections(-1, -1.0);
+  MonoBuffer impulse_eight(eight_length);
+  impulse_eight.SetSample(0, 1.0);
+  MonoBuffer output_eight(eight_length);
+  ism_eight.Run(impulse_eight.GetReadPointer(), eight_length,
+                output_eight);
+  ASSERT(ism_eight.early_ids_.size() > 25);
+  std::vector<Sample> cmp_eight(eight_length, 0.0);
+  for (Int i=0; i<(Int) ism_eight.lattice_.x.size(); ++i) {
+    const Time delay = ism_eight.lattice_.delays[i];
+    if (! ism_eight.IsInRir(delay)) { continue; }
+    const Length dx = ism_eight.lattice_.x[i]-2.0;
+    const Length dy = ism_eight.lattice_.y[i]-2.5;
+    const Length dz = ism_eight.lattice_.z[i]-1.0;
+    cmp_eight[mcl::RoundToInt(delay*sampling_frequency)] +=
+        ism_eight.lattice_.gains[i]/(delay*sampling_frequency) *
+        dx/sqrt(dx*dx+dy*dy+dz*dz);
+  }
+  for (Int i=0; i<eight_length; ++i) {
+    ASSERT(IsEqual(output_eight.GetSample(i), cmp_eight[i], 1.0E-10));
+  }
+  
+  // Testing the streaming mode against the images of the lattice, with the
+  // same maximum order and linear interpolation of the delays
+  const Int streaming_length = 2000;
+  OmniMic mic_streaming(Point(2.0, 2.5, 1.0));
+  Source source_streaming(Point(1.0, 1.5, 2.0));
+  Ism ism_streaming(&room_spatial, &source_streaming, &mic_streaming, none,
+                    streaming_length, sampling_frequency);
+  ism_streaming.SetStreamingOrder(2);
+  MonoBuffer impulse_streaming(streaming_length);
+  impulse_streaming.SetSample(0, 1.0);
+  MonoBuffer output_streaming(streaming_length);
+  ism_streaming.Run(impulse_streaming.GetReadPointer(), streaming_length,
+                    output_streaming);
+  Ism ism_lattice_order(&room_spatial, &source_streaming, &mic_streaming,
+                        none, streaming_length, sampling_frequency);
+  ism_lattice_order.SetMaxReflectionOrder(2);
+  ism_lattice_order.CalculateLattice();
+  ism_lattice_order.CalculateRir();
+  ASSERT(ism_streaming.streaming_gains_.size() == 25);
+  ASSERT(ism_lattice_order.lattice_.x.size() == 25);
+  std::vector<Sample> cmp_streaming(streaming_length, 0.0);
+  for (Int i=0; i<(Int) ism_lattice_order.lattice_.x.size(); ++i) {
+    const Time delay_norm = ism_lattice_order.lattice_.delays[i]*sampling_frequency;
+    const Int tap = (Int) floor(delay_norm);
+    const Sample fraction = delay_norm-((Time) tap);
+    const Sample attenuation = ism_lattice_order.lattice_.gains[i]/delay_norm;
+    cmp_streaming[tap] += attenuation*(1.0-fraction);
+    cmp_streaming[tap+1] += attenuation*fraction;
+  }
+  for (Int i=0; i<streaming_length; ++i) {
+    ASSERT(IsEqual(output_streaming.GetSample(i), cmp_streaming[i], 1.0E-10));
+  }
+  
+  // The streaming mode and the RIRs are recalculated independently
+  Ism ism_paths(&room_spatial, &source_streaming, &mic_streaming, none,
+                streaming_length, sampling_frequency);
+  ism_paths.SetStreamingOrder(2);
+  ism_paths.CalculateRirs(std::vector<Point>(1, Point(2.0, 2.5, 1.0)));
+  output_streaming.Reset();
+  ism_paths.Run(impulse_streaming.GetReadPointer(), streaming_length,
+                output_streaming);
+  ASSERT(ism_paths.streaming_gains_.size() == 25);
+  ism_paths.Update();
+  ism_paths.Run(impulse_streaming.GetReadPointer(), streaming_length,
+                output_streaming);
+  ism_paths.CalculateRirs(std::vector<Point>(1, Point(2.0, 2.5, 1.0)));
+  ASSERT(ism_paths.lattice_.x.size() > 25);
+  
+  // When the source moves, the gains are ramped linearly across the block.
+  // With a constant input longer than the delays, the output is the sum of
+  // the attenuations, which goes linearly from the old to the new position.
+  const Int ramp_length = 500;
+  MonoBuffer ones(streaming_length);
+  for (Int i=0; i<streaming_length; ++i) { ones.SetSample(i, 1.0); }
+  output_streaming.Reset();
+  ism_streaming.Run(ones.GetReadPointer(), streaming_length, output_streaming);
+  Sample old_sum = 0.0;
+  for (Int j=0; j<(Int) ism_streaming.streaming_gains_.size(); ++j) {
+    old_sum += ism_streaming.streaming_attenuations_[j];
+  }
+  ASSERT(IsEqual(output_streaming.GetSample(streaming_length-1), old_sum));
+  source_streaming.SetPosition(Point(1.1, 1.4, 2.1));
+  output_streaming.Reset();
+  ism_streaming.Run(ones.GetReadPointer(), ramp_length, output_streaming);
+  Sample new_sum = 0.0;
+  for (Int j=0; j<(Int) ism_streaming.streaming_gains_.size(); ++j) {
+    new_sum += ism_streaming.streaming_attenuations_[j];
+  }
+  ASSERT(! IsEqual(old_sum, new_sum));
+  for (Int i=0; i<ramp_length; ++i) {
+    ASSERT(IsEqual(output_streaming.GetSample(i),
+                   old_sum+(new_sum-old_sum)*((Sample) (i+1)) /
+                   ((Sample) ramp_length), 1.0E-10));
+  }
+  
+  // Convolving the early part of the RIR as a list of taps gives the same
+  // output as convolving the whole RIR with FFTs
+  OmniMic mic_sparse(Point(2.0, 2.5, 1.0));
+  Ism ism_dense(&room_spatial, &source_spatial, &mic_sparse, none, 4000,
+                sampling_frequency);
+  Ism ism_sparse(&room_spatial, &source_spatial, &mic_sparse, none, 4000,
+                 sampling_frequency);
+  const Time crossover = 0.03;
+  ism_sparse.SetSparseCrossover(crossover);
+  MonoBuffer output_dense(spatial_block_length);
+  MonoBuffer output_sparse(spatial_block_length);
+  for (Int block_id=0; block_id<60; ++block_id) {
+    for (Int i=0; i<spatial_block_length; ++i) {
+      input_spatial.SetSample(i, sin(0.1*((Sample) (block_id*100+i))));
+    }
+    output_dense.Reset();
+    output_sparse.Reset();
+    ism_dense.Run(input_spatial.GetReadPointer(), spatial_block_length,
+                  output_dense);
+    ism_sparse.Run(input_spatial.GetReadPointer(), spatial_block_length,
+                   output_sparse);
+    for (Int i=0; i<spatial_block_length; ++i) {
+      ASSERT(IsEqual(output_dense.GetSample(i), output_sparse.GetSample(i),
+                     1.0E-10));
+    }
+  }
+  const std::vector<Int> tap_delays = ism_sparse.early_tap_delays();
+  const std::vector<Sample> tap_gains = ism_sparse.early_tap_gains();
+  ASSERT(tap_delays.size() > 0 && tap_delays.size() == tap_gains.size());
+  ASSERT(ism_dense.early_tap_delays().size() == 0);
+  std::vector<Sample> rir_sparse = ism_sparse.dense_rir_;
+  for (Int j=0; j<(Int) tap_delays.size(); ++j) {
+    ASSERT(tap_delays[j] < mcl::RoundToInt(crossover*sampling_frequency));
+    rir_sparse[tap_delays[j]] += tap_gains[j];
+  }
+  ASSERT(rir_sparse == ism_sparse.rir());
+  
   return true;
 }
   
   
-  
+bool Ism::SimulationTime() {
+  const Time sampling_frequency = 44100;
+  const Int rir_length = (Int) (0.5*sampling_frequency);
+  CuboidRoom room(5.1, 4.3, 2.9, GainFilter(0.9));
+  OmniMic mic(Point(1.2, 1.9, 1.5));
+  Source source(Point(3.1, 0.8, 1.1));
+  
+  const Int num_threads[2] = {1, 4};
+  for (Int i=0; i<2; ++i) {
+    Ism ism(&room, &source, &mic, none, rir_length, sampling_frequency);
+    ism.SetNumThreads(num_threads[i]);
+    // The wall clock, since clock() adds up the time of all threads
+    std::chrono::steady_clock::time_point launch =
+        std::chrono::steady_clock::now();
+    ism.CalculateLattice();
+    std::chrono::steady_clock::time_point lattice_done =
+        std::chrono::steady_clock::now();
+    ism.CalculateRir();
+    std::chrono::steady_clock::time_point done =
+        std::chrono::steady_clock::now();
+    const Time elapsed = std::chrono::duration<Time>(done-launch).count();
+    const Time rir_elapsed =
+        std::chrono::duration<Time>(done-lattice_done).count();
+    
+    std::cout<<"ISM ("<<num_threads[i]<<" threads): "
+             <<((Time) ism.lattice_.x.size())/elapsed<<" images/s; "
+             <<"latency after a source move: "<<elapsed<<" s, "
+             <<"after a microphone move: "<<rir_elapsed<<" s\n";
+  }
+  
+  Ism ism_peterson(&room, &source, &mic, peterson, rir_length,
+                   sampling_frequency);
+  ism_peterson.CalculateLattice();
+  clock_t peterson_launch = clock();
+  ism_peterson.CalculateRir();
+  clock_t peterson_done = clock();
+  std::cout<<"ISM (Peterson, microphone move): "
+           <<(peterson_done-peterson_launch)/((Time) CLOCKS_PER_SEC)<<" s\n";
+  
+  CuboidRoom room_damped(5.1, 4.3, 2.9, GainFilter(0.3));
+  const Sample thresholds[2] = {0.0, 1.0E-7};
+  for (Int i=0; i<2; ++i) {
+    Ism ism(&room_damped, &source, &mic, none, rir_length, sampling_frequency);
+    ism.SetAmplitudeThreshold(thresholds[i]);
+    clock_t launch = clock();
+    ism.CalculateLattice();
+    ism.CalculateRir();
+    clock_t done = clock();
+    std::cout<<"ISM (damped room, threshold "<<thresholds[i]<<"): "
+             <<(done-launch)/((Time) CLOCKS_PER_SEC)<<" s\n";
+  }
+  
+  // Rendering with a 2 s RIR, in blocks of 64 samples
+  const Int long_rir_length = (Int) (2.0*sampling_frequency);
+  const Int block_length = 64;
+  const Int num_blocks = (Int) (10.0*sampling_frequency)/block_length;
+  Ism ism_render(&room_damped, &source, &mic, none, long_rir_length,
+                 sampling_frequency);
+  ism_render.SetAmplitudeThreshold(1.0E-7);
+  MonoBuffer input(block_length);
+  for (Int i=0; i<block_length; ++i) {
+    input.SetSample(i, ((Sample) rand())/((Sample) RAND_MAX)-0.5);
+  }
+  MonoBuffer output(block_length);
+  ism_render.Run(input.GetReadPointer(), block_length, output);
+  clock_t render_launch = clock();
+  for (Int i=0; i<num_blocks; ++i) {
+    output.Reset();
+    ism_render.Run(input.GetReadPointer(), block_length, output);
+  }
+  clock_t render_done = clock();
+  std::cout<<"ISM (rendering 10 s with a 2 s RIR): "
+           <<(render_done-render_launch)/((Time) CLOCKS_PER_SEC)<<" s\n";
+  
+  // Same, with a binaural microphone (early images up to the second order
+  // and six directions of late images)
+  StructuralHeadMic mic_binaural(mic.position(), mcl::Quaternion::Identity());
+  Ism ism_binaural(&room_damped, &source, &mic_binaural, none,
+                   long_rir_length, sampling_frequency);
+  ism_binaural.SetAmplitudeThreshold(1.0E-7);
+  StereoBuffer output_binaural(block_length);
+  ism_binaural.Run(input.GetReadPointer(), block_length, output_binaural);
+  clock_t binaural_launch = clock();
+  for (Int i=0; i<num_blocks; ++i) {
+    output_binaural.Reset();
+    ism_binaural.Run(input.GetReadPointer(), block_length, output_binaural);
+  }
+  clock_t binaural_done = clock();
+  std::cout<<"ISM (rendering 10 s binaurally with a 2 s RIR): "
+           <<(binaural_done-binaural_launch)/((Time) CLOCKS_PER_SEC)<<" s\n";
+  
+  // Streaming the early reflections (up to the third order) of a source
+  // moving around the room
+  Source source_streaming(source.position());
+  Ism ism_streaming(&room, &source_streaming, &mic_binaural, none,
+                    rir_length, sampling_frequency);
+  ism_streaming.SetStreamingOrder(3);
+  clock_t streaming_launch = clock();
+  for (Int i=0; i<num_blocks; ++i) {
+    const Angle angle = 2.0*PI*((Angle) i)/((Angle) num_blocks);
+    source_streaming.SetPosition(Point(2.5+cos(angle), 2.1+sin(angle), 1.1));
+    output_binaural.Reset();
+    ism_streaming.Run(input.GetReadPointer(), block_length, output_binaural);
+  }
+  clock_t streaming_done = clock();
+  std::cout<<"ISM (streaming 10 s binaurally, "
+           <<ism_streaming.streaming_gains_.size()<<" images): "
+           <<(streaming_done-streaming_launch)/((Time) CLOCKS_PER_SEC)<<" s\n";
+  
+  std::vector<Point> receivers;
+  for (Int i=0; i<16; ++i) {
+    receivers.push_back(Point(1.0+0.2*((Length) i), 1.9, 1.5));
+  }
+  Ism ism(&room, &source, &mic, none, rir_length, sampling_frequency);
+  clock_t launch = clock();
+  for (Int i=0; i<(Int) receivers.size(); ++i) {
+    mic.SetPosition(receivers[i]);
+    ism.CalculateLattice();
+    ism.CalculateRir();
+  }
+  clock_t single_done = clock();
+  ism.CalculateRirs(receivers);
+  clock_t multiple_done = clock();
+  std::cout<<"ISM (16 receivers): "
+           <<(single_done-launch)/((Time) CLOCKS_PER_SEC)<<" s one at a time, "
+           <<(multiple_done-single_done)/((Time) CLOCKS_PER_SEC)
+           <<" s all together\n";
+  return true;
+}
   
 } // namespace sal
   
@@ -12,6 +12,8 @@
 #include "microphone.h"
 #include "salconstants.h"
 #include "vectorop.h"
+#include "resampler.h"
+#include <cstdio>
 
 using mcl::Point;
 using mcl::Quaternion;
@@ -361,6 +363,296 @@ bool KemarMic::Test() {
   ASSERT(IsEqual(buffer_full.GetLeftReadPointer(), mcl::Multiply(cmp_full_elevation_40_azimuth_77_right_ear, normalising_value)));
   ASSERT(IsEqual(buffer_full.GetRightReadPointer(), mcl::Multiply(cmp_full_elevation_40_azimuth_77_left_ear, normalising_value)));
   
+  
+  // Testing binary pack
+  const std::string pack_file_path = "sal_kemarmic_test.salhrtf";
+  ASSERT(WritePack(pack_file_path, "", kCompactDataset));
+  ASSERT(IsDatabaseAvailable(pack_file_path, kPackFile));
+  KemarMic mic_pack(Point(0.0,0.0,0.0), mcl::Quaternion::Identity(),
+                    kPackFile, kFullBrirLength, 0,
+                    HeadRefOrientation::standard, 44100.0, pack_file_path);
+  StereoBuffer buffer_pack(impulse_response_length);
+  mic_pack.AddPlaneWave(impulse, Point(1.0,0.0,0.0), buffer_pack);
+  ASSERT(IsEqual(cmp_imp_front_left, buffer_pack.GetLeftReadPointer()));
+  ASSERT(IsEqual(cmp_imp_front_left, buffer_pack.GetRightReadPointer()));
+  
+  mic_pack.Reset();
+  buffer_pack.Reset();
+  mic_pack.AddPlaneWave(impulse, Point(0.0,0.0,1.0), buffer_pack);
+  ASSERT(IsEqual(buffer_pack.GetLeftReadPointer(), mcl::Multiply(cmp_compact_up_left_ear, normalising_value)));
+  std::remove(pack_file_path.c_str());
+  ASSERT(! IsDatabaseAvailable(pack_file_path, kPackFile));
+  
+  
+  // Testing interpolation neighbours
+  DirectionGrid::Cell cell = GetNeighbours(0.0, 2.5);
+  ASSERT(cell.num_neighbours == 2);
+  ASSERT(cell.neighbours[0].row_id == 4 && cell.neighbours[0].column_id == 0);
+  ASSERT(cell.neighbours[1].row_id == 4 && cell.neighbours[1].column_id == 1);
+  ASSERT(IsEqual(cell.neighbours[0].weight, 0.5));
+  ASSERT(IsEqual(cell.neighbours[1].weight, 0.5));
+  
+  cell = GetNeighbours(45.0, 0.0);
+  ASSERT(cell.num_neighbours == 2);
+  ASSERT(cell.neighbours[0].row_id == 8 && cell.neighbours[0].column_id == 0);
+  ASSERT(cell.neighbours[1].row_id == 9 && cell.neighbours[1].column_id == 0);
+  ASSERT(IsEqual(cell.neighbours[0].weight, 0.5));
+  
+  cell = GetNeighbours(85.0, 105.0); // Between two azimuths and the pole
+  ASSERT(cell.num_neighbours == 3);
+  ASSERT(cell.neighbours[0].row_id == 12 && cell.neighbours[0].column_id == 3);
+  ASSERT(cell.neighbours[1].row_id == 12 && cell.neighbours[1].column_id == 4);
+  ASSERT(cell.neighbours[2].row_id == 13 && cell.neighbours[2].column_id == 0);
+  ASSERT(IsEqual(cell.neighbours[0].weight, 0.25));
+  ASSERT(IsEqual(cell.neighbours[1].weight, 0.25));
+  ASSERT(IsEqual(cell.neighbours[2].weight, 0.5));
+  
+  cell = GetNeighbours(-60.0, 359.0); // Below the lowest ring and wrapping
+  ASSERT(cell.num_neighbours == 2);
+  ASSERT(cell.neighbours[0].row_id == 0 && cell.neighbours[0].column_id == 55);
+  ASSERT(cell.neighbours[1].row_id == 0 && cell.neighbours[1].column_id == 0);
+  
+  cell = GetNeighbours(10.0, 10.0); // On a measurement
+  ASSERT(cell.num_neighbours == 1);
+  ASSERT(cell.neighbours[0].row_id == 5 && cell.neighbours[0].column_id == 2);
+  
+  
+  // Testing interpolated BRIRs
+  KemarMic mic_int(Point(0.0,0.0,0.0), mcl::Quaternion::Identity(),
+                   kCompactDataset);
+  mic_int.SetInterpolation(true);
+  for (Int i=0; i<mic_int.direction_grid_.num_cells(); ++i) {
+    const DirectionGrid::Cell& grid_cell = mic_int.direction_grid_.cell(i);
+    Sample sum_weights = 0.0;
+    for (Int j=0; j<grid_cell.num_neighbours; ++j) {
+      sum_weights += grid_cell.neighbours[j].weight;
+    }
+    ASSERT(IsEqual(sum_weights, 1.0));
+  }
+  
+  // The axes are at the centres of the cells, hence the measurements
+  // are returned without blending
+  StereoBuffer buffer_int(impulse_response_length);
+  mic_int.AddPlaneWave(impulse, Point(1.0,0.0,0.0), buffer_int);
+  ASSERT(IsEqual(cmp_imp_front_left, buffer_int.GetLeftReadPointer()));
+  ASSERT(IsEqual(cmp_imp_front_left, buffer_int.GetRightReadPointer()));
+  ASSERT(IsEqual(mic_int.GetBrir(kLeftEar, Point(0.0,0.0,1.0)),
+                 mcl::Multiply(cmp_compact_up_left_ear,
+                               1.0/NORMALISING_VALUE_KEMAR)));
+  
+  // Between two measurements
+  const Point point_int(cos(2.5/180.0*PI), sin(2.5/180.0*PI), 0.0);
+  const Int cell_id = mic_int.direction_grid_.GetCellId(point_int);
+  const DirectionGrid::Cell& cell_int = mic_int.direction_grid_.cell(cell_id);
+  ASSERT(cell_int.num_neighbours == 2);
+  Signal cmp_brir_int(impulse_response_length, 0.0);
+  for (Int i=0; i<cell_int.num_neighbours; ++i) {
+    const DirectionGrid::Neighbour& neighbour = cell_int.neighbours[i];
+    ASSERT(neighbour.row_id == 4);
+    ASSERT(neighbour.column_id == 0 || neighbour.column_id == 1);
+    cmp_brir_int = mcl::Add(cmp_brir_int,
+        mcl::Multiply(mic_int.hrtf_database_left_[4][neighbour.column_id],
+                      neighbour.weight));
+  }
+  ASSERT(IsEqual(mic_int.GetBrir(kLeftEar, point_int), cmp_brir_int));
+  
+  // The cache returns the same BRIRs
+  mic_int.SetBlendedBrirCache(true);
+  ASSERT(IsEqual(mic_int.GetBrir(kLeftEar, point_int), cmp_brir_int));
+  ASSERT(IsEqual(mic_int.GetBrir(kLeftEar, point_int), cmp_brir_int));
+  ASSERT(! mic_int.blended_brirs_left_[cell_id].empty());
+  ASSERT(mic_int.blended_brirs_right_.empty());
+  mic_int.SetBlendedBrirCache(false);
+  ASSERT(mic_int.blended_brirs_left_.empty());
+  
+  
+  // Testing resampling
+  ClearResampledDatabaseCache();
+  KemarMic mic_48(Point(0.0,0.0,0.0), mcl::Quaternion::Identity(),
+                  kCompactDataset, kFullBrirLength, 0,
+                  HeadRefOrientation::standard, 48000.0);
+  const Signal brir_44 = mcl::Multiply(cmp_imp_front_left, 1.0/sample);
+  const Signal brir_48 = mic_48.GetBrir(kLeftEar, Point(1.0,0.0,0.0));
+  ASSERT(brir_48.size() == 140);
+  ASSERT(IsEqual(brir_48, mcl::Multiply(Resampler(44100.0, 48000.0).Run(brir_44),
+                                        44100.0/48000.0)));
+  // The frequency response is unchanged, hence the energy scales with
+  // the ratio of the sampling frequencies
+  Sample energy_44 = 0.0;
+  Sample energy_48 = 0.0;
+  for (Int i=0; i<(Int)brir_44.size(); ++i) { energy_44 += brir_44[i]*brir_44[i]; }
+  for (Int i=0; i<(Int)brir_48.size(); ++i) { energy_48 += brir_48[i]*brir_48[i]; }
+  ASSERT(IsEqual(energy_48/energy_44, 44100.0/48000.0, 2.0E-2));
+  
+  // The second microphone uses the cached database
+  KemarMic mic_48_b(Point(0.0,0.0,0.0), mcl::Quaternion::Identity(),
+                    kCompactDataset, kFullBrirLength, 0,
+                    HeadRefOrientation::standard, 48000.0);
+  ASSERT(IsEqual(mic_48_b.GetBrir(kLeftEar, Point(1.0,0.0,0.0)), brir_48));
+  ClearResampledDatabaseCache();
+  
+  // Resampled packs
+  const std::string pack_48_file_path = "sal_kemarmic_test_48.salhrtf";
+  ASSERT(WritePack(pack_48_file_path, "", kCompactDataset, HrtfPack::kFloat64,
+                   48000.0));
+  KemarMic mic_pack_48(Point(0.0,0.0,0.0), mcl::Quaternion::Identity(),
+                       kPackFile, kFullBrirLength, 0,
+                       HeadRefOrientation::standard, 48000.0, pack_48_file_path);
+  ASSERT(IsEqual(mic_pack_48.GetBrir(kLeftEar, Point(1.0,0.0,0.0)), brir_48));
+  KemarMic mic_pack_44(Point(0.0,0.0,0.0), mcl::Quaternion::Identity(),
+                       kPackFile, kFullBrirLength, 0,
+                       HeadRefOrientation::standard, 44100.0, pack_48_file_path);
+  ASSERT(mic_pack_44.GetBrir(kLeftEar, Point(1.0,0.0,0.0)).size() == 129);
+  std::remove(pack_48_file_path.c_str());
+  ClearResampledDatabaseCache();
+  
+  
+  // Testing minimum-phase responses with separate delays
+  const Point front_point(1.0, 0.0, 0.0);
+  const Point left_point(0.0, 1.0, 0.0);
+  const Point right_point(0.0, -1.0, 0.0);
+  KemarMic mic_mp(Point(0.0,0.0,0.0), mcl::Quaternion::Identity(),
+                  kCompactDataset);
+  const Signal brir_front = mic_mp.GetBrir(kLeftEar, front_point);
+  ASSERT(IsEqual(mic_mp.GetBrirDelay(kLeftEar, front_point), 0.0));
+  
+  mic_mp.SplitMinimumPhase(32);
+  ASSERT(mic_mp.GetBrir(kLeftEar, front_point).size() == 32);
+  ASSERT(mic_mp.GetBrir(kRightEar, left_point).size() == 32);
+  ASSERT(IsEqual(GetOnset(mic_mp.GetBrir(kLeftEar, front_point)) +
+                 mic_mp.GetBrirDelay(kLeftEar, front_point),
+                 GetOnset(brir_front)));
+  
+  // The frontal direction has no interaural time difference, while
+  // lateral directions have about 0.7 ms, with opposite signs.
+  ASSERT(IsEqual(mic_mp.GetBrirDelay(kLeftEar, front_point),
+                 mic_mp.GetBrirDelay(kRightEar, front_point)));
+  const Time itd_left = mic_mp.GetBrirDelay(kRightEar, left_point) -
+                        mic_mp.GetBrirDelay(kLeftEar, left_point);
+  const Time itd_right = mic_mp.GetBrirDelay(kRightEar, right_point) -
+                         mic_mp.GetBrirDelay(kLeftEar, right_point);
+  ASSERT(std::abs(itd_left) > 0.5E-3*44100.0 &&
+         std::abs(itd_left) < 0.9E-3*44100.0);
+  ASSERT(IsEqual(itd_left, -itd_right, 1.0));
+  
+  // The rendered response starts (within the accuracy of the onset
+  // detection) when the original one does, and has about the same energy
+  StereoBuffer buffer_mp(impulse_response_length);
+  mic_mp.AddPlaneWave(impulse, front_point, buffer_mp);
+  const Signal output_mp(buffer_mp.GetLeftReadPointer(),
+                         buffer_mp.GetLeftReadPointer()+impulse_response_length);
+  ASSERT(std::abs(GetOnset(output_mp) - GetOnset(brir_front)) < 2.0);
+  Sample energy_mp = 0.0;
+  Sample energy_front = 0.0;
+  for (Int i=0; i<impulse_response_length; ++i) {
+    energy_mp += output_mp[i]*output_mp[i];
+    energy_front += brir_front[i]*brir_front[i]*sample*sample;
+  }
+  // Some energy is lost in the truncation to 32 taps and, at high
+  // frequencies, in the fractional delay interpolation.
+  ASSERT(energy_mp/energy_front > 0.8 && energy_mp/energy_front < 1.05);
+  
+  // The delay lines are sized for the largest delay, so that a source can
+  // move to any direction without them being reallocated.
+  StereoBuffer buffer_moving(impulse_response_length);
+  mic_mp.AddPlaneWave(impulse, front_point, 1, buffer_moving);
+  mic_mp.AddPlaneWave(impulse, left_point, 1, buffer_moving);
+  mic_mp.AddPlaneWave(impulse, right_point, 1, buffer_moving);
+  
+  // The blended BRIRs cached before the split are discarded
+  KemarMic mic_mp_cache(Point(0.0,0.0,0.0), mcl::Quaternion::Identity(),
+                        kCompactDataset);
+  mic_mp_cache.SetInterpolation(true);
+  mic_mp_cache.SetBlendedBrirCache(true);
+  ASSERT(mic_mp_cache.GetBrir(kLeftEar, front_point).size() > 32);
+  mic_mp_cache.SplitMinimumPhase(32);
+  ASSERT(mic_mp_cache.GetBrir(kLeftEar, front_point).size() == 32);
+  
+  // Principal components of vectors spanning three dimensions: the
+  // first is their normalised mean, and three components span them exactly
+  std::vector<Signal> pca_data(4, Signal(5, 0.0));
+  pca_data[0][0] = 1.0; pca_data[0][1] = 1.0;
+  pca_data[1][0] = 1.0; pca_data[1][1] = -1.0;
+  pca_data[2][2] = 2.0;
+  pca_data[3][0] = 2.0; pca_data[3][2] = -2.0;
+  const std::vector<Signal> pca = GetPrincipalComponents(pca_data, 5);
+  ASSERT(pca.size() == 3);
+  ASSERT(IsEqual(pca[0], mcl::Multiply(Signal({4.0, 0.0, 0.0, 0.0, 0.0}),
+                                       0.25)));
+  for (Int k=0; k<3; ++k) {
+    for (Int l=0; l<3; ++l) {
+      Sample dot_product = 0.0;
+      for (Int i=0; i<5; ++i) { dot_product += pca[k][i]*pca[l][i]; }
+      ASSERT(IsEqual(dot_product, (k == l) ? 1.0 : 0.0));
+    }
+  }
+  
+  // Rendering through principal components. The error decreases with the
+  // number of components, and the rendering of a few sources is close to
+  // the one with direct convolution.
+  KemarMic mic_pca(Point(0.0,0.0,0.0), mcl::Quaternion::Identity(),
+                   kCompactDataset);
+  mic_pca.SetPrincipalComponents(4);
+  ASSERT(mic_pca.num_principal_components() == 4);
+  const Sample error_4 = mic_pca.principal_components_error();
+  mic_pca.SetPrincipalComponents(24);
+  ASSERT(mic_pca.num_principal_components() == 24);
+  const Sample error_24 = mic_pca.principal_components_error();
+  ASSERT(error_24 < error_4 && error_24 > 0.0 && error_4 < 1.0);
+  
+  KemarMic mic_direct(Point(0.0,0.0,0.0), mcl::Quaternion::Identity(),
+                      kCompactDataset);
+  const Int pca_block_length = 256;
+  MonoBuffer pca_input(pca_block_length);
+  for (Int i=0; i<pca_block_length; ++i) {
+    pca_input.SetSample(i, sin(0.1*((Sample) i)) + cos(1.7*((Sample) i)));
+  }
+  const Point pca_points[3] = {Point(1.0,0.3,0.0), Point(-0.2,1.0,0.5),
+                               Point(0.3,-1.0,-0.2)};
+  StereoBuffer output_pca(pca_block_length);
+  StereoBuffer output_direct(pca_block_length);
+  for (Int i=0; i<3; ++i) {
+    mic_pca.AddPlaneWave(pca_input, pca_points[i], i, output_pca);
+    mic_direct.AddPlaneWave(pca_input, pca_points[i], i, output_direct);
+  }
+  // Nothing is rendered until the buses are convolved
+  ASSERT(IsEqual(output_pca.GetLeftReadPointer()[pca_block_length-1], 0.0));
+  mic_pca.RenderComponents(output_pca);
+  Sample pca_error_energy = 0.0;
+  Sample direct_energy = 0.0;
+  for (Int i=0; i<pca_block_length; ++i) {
+    for (Int channel_id=0; channel_id<2; ++channel_id) {
+      const Sample direct_sample = output_direct.GetSample(channel_id, i);
+      pca_error_energy += pow(output_pca.GetSample(channel_id, i) -
+                              direct_sample, 2.0);
+      direct_energy += pow(direct_sample, 2.0);
+    }
+  }
+  ASSERT(pca_error_energy/direct_energy < 10.0*error_24);
+  
+  // With separate delays, the delay lines of each source are sized for the
+  // largest delay, so that it can move to any direction.
+  KemarMic mic_pca_mp(Point(0.0,0.0,0.0), mcl::Quaternion::Identity(),
+                      kCompactDataset);
+  mic_pca_mp.SplitMinimumPhase(32);
+  mic_pca_mp.SetPrincipalComponents(8);
+  StereoBuffer output_pca_mp(pca_block_length);
+  for (Int i=0; i<3; ++i) {
+    mic_pca_mp.AddPlaneWave(pca_input, pca_points[i], 0, output_pca_mp);
+    mic_pca_mp.RenderComponents(output_pca_mp);
+  }
+  
+  // Going back to direct convolution
+  mic_pca.SetPrincipalComponents(0);
+  mic_pca.Reset();
+  mic_direct.Reset();
+  output_pca.Reset();
+  output_direct.Reset();
+  mic_pca.AddPlaneWave(pca_input, pca_points[0], output_pca);
+  mic_direct.AddPlaneWave(pca_input, pca_points[0], output_direct);
+  ASSERT(IsEqual(output_pca.GetLeftReadPointer(),
+                 output_direct.GetLeftReadPointer(), pca_block_length));
+  
   return true;
 }
   
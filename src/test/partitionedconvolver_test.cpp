@@ -0,0 +1,104 @@
+/*
+ partitionedconvolver_test.cpp
+ Spatial Audio Library (SAL)
+ Copyright (c) 2015, Enzo De Sena
+ All rights reserved.
+
+ Authors: Enzo De Sena, enzodesena@gmail.com
+
+ */
+
+#include "partitionedconvolver.h"
+#include "comparisonop.h"
+#include <cstdlib>
+
+namespace sal {
+
+static Signal RandomSignal(const Int length) {
+  Signal output(length);
+  for (Int i=0; i<length; ++i) {
+    output[i] = ((Sample) rand())/((Sample) RAND_MAX)-0.5;
+  }
+  return output;
+}
+
+
+static Signal Convolve(const Signal& input, const Signal& filter) {
+  Signal output(input.size(), 0.0);
+  for (Int i=0; i<(Int) input.size(); ++i) {
+    for (Int k=0; k<(Int) filter.size() && k<=i; ++k) {
+      output[i] += filter[k]*input[i-k];
+    }
+  }
+  return output;
+}
+
+
+bool PartitionedConvolver::Test() {
+  using mcl::IsEqual;
+
+  srand(0);
+  const Int input_length = 6000;
+  const Signal input = RandomSignal(input_length);
+
+  // Filters shorter than the head, within the first levels, and with
+  // several partitions of the longest length
+  const Int filter_lengths[4] = {5, 100, 1000, 5000};
+  // Blocks of different lengths, also across the partitions
+  const Int block_lengths[5] = {1, 7, 16, 50, 333};
+  for (Int i=0; i<4; ++i) {
+    const Signal filter = RandomSignal(filter_lengths[i]);
+    const Signal expected = Convolve(input, filter);
+
+    PartitionedConvolver convolver(filter, 16, 256);
+    Signal output(input_length);
+    Int done = 0;
+    Int block_id = 0;
+    while (done < input_length) {
+      const Int block_length = std::min(block_lengths[block_id++ % 5],
+                                        input_length-done);
+      convolver.Filter(&input[done], block_length, &output[done]);
+      done += block_length;
+    }
+    ASSERT(IsEqual(output, expected, 1.0E-10));
+
+    // After a reset, the output is the same again
+    convolver.Reset();
+    Signal output_reset(input_length);
+    convolver.Filter(input.data(), input_length, output_reset.data());
+    ASSERT(IsEqual(output_reset, expected, 1.0E-10));
+  }
+
+  // Setting a (shorter) filter gives the same output as a new convolver
+  const Signal filter_a = RandomSignal(3000);
+  const Signal filter_b = RandomSignal(2000);
+  PartitionedConvolver convolver_a(filter_a, 64, 1024);
+  convolver_a.SetFilter(filter_b);
+  Signal output_a(input_length);
+  convolver_a.Filter(input.data(), input_length, output_a.data());
+  ASSERT(IsEqual(output_a, Convolve(input, filter_b), 1.0E-10));
+
+  // The zero partitions are skipped, also when they become non-zero
+  Signal filter_c = RandomSignal(5000);
+  for (Int i=0; i<1500; ++i) { filter_c[i] = 0.0; }
+  for (Int i=2500; i<4000; ++i) { filter_c[i] = 0.0; }
+  PartitionedConvolver convolver_c(filter_c, 16, 256);
+  Signal output_c(input_length);
+  convolver_c.Filter(input.data(), input_length, output_c.data());
+  ASSERT(IsEqual(output_c, Convolve(input, filter_c), 1.0E-10));
+  convolver_c.Reset();
+  convolver_c.SetFilter(Signal(5000, 0.0));
+  convolver_c.Filter(input.data(), input_length/2, output_c.data());
+  convolver_c.SetFilter(filter_c);
+  // The first 256 samples after the change are still from the zero filter
+  convolver_c.Filter(&input[input_length/2], input_length/2,
+                     &output_c[input_length/2]);
+  const Signal expected_c = Convolve(input, filter_c);
+  for (Int i=input_length/2+256; i<input_length; ++i) {
+    ASSERT(IsEqual(output_c[i], expected_c[i], 1.0E-10));
+  }
+
+  return true;
+}
+
+} // namespace sal
@@ -0,0 +1,88 @@
+/*
+ resampler_test.cpp
+ Spatial Audio Library (SAL)
+ Copyright (c) 2015, Enzo De Sena
+ All rights reserved.
+
+ Authors: Enzo De Sena, enzodesena@gmail.com
+
+ */
+
+#include "resampler.h"
+#include "comparisonop.h"
+#include "salconstants.h"
+
+namespace sal {
+
+static Signal Sinusoid(const Time frequency, const Time sampling_frequency,
+                       const Int length) {
+  Signal output(length);
+  for (Int i=0; i<length; ++i) {
+    output[i] = sin(2.0*PI*frequency*((Time) i)/sampling_frequency);
+  }
+  return output;
+}
+
+
+bool Resampler::Test() {
+  using mcl::IsEqual;
+
+  Resampler resampler_a(44100.0, 48000.0);
+  ASSERT(resampler_a.up_factor() == 160);
+  ASSERT(resampler_a.down_factor() == 147);
+  ASSERT(resampler_a.GetOutputLength(147) == 160);
+  ASSERT(resampler_a.GetOutputLength(128) == 140);
+
+  Resampler resampler_b(48000.0, 16000.0);
+  ASSERT(resampler_b.up_factor() == 1);
+  ASSERT(resampler_b.down_factor() == 3);
+  ASSERT(resampler_b.GetOutputLength(9) == 3);
+  ASSERT(resampler_b.GetOutputLength(10) == 4);
+
+  // Same sampling frequency: no processing
+  Resampler resampler_c(44100.0, 44100.0);
+  const Signal signal_c = {1.0, -2.0, 3.0};
+  ASSERT(IsEqual(resampler_c.Run(signal_c), signal_c));
+
+  // Sinusoids well below cutoff are preserved (away from the edges)
+  const Int length = 2000;
+  const Time frequencies[] = {100.0, 1000.0, 7000.0};
+  for (Int k=0; k<3; ++k) {
+    const Signal output_a = resampler_a.Run(Sinusoid(frequencies[k], 44100.0,
+                                                      length));
+    const Signal cmp_output_a = Sinusoid(frequencies[k], 48000.0,
+                                         resampler_a.GetOutputLength(length));
+    ASSERT((Int) output_a.size() == resampler_a.GetOutputLength(length));
+    for (Int i=200; i<(Int)output_a.size()-200; ++i) {
+      ASSERT(IsEqual(output_a[i], cmp_output_a[i], 1.0E-3));
+    }
+
+    const Signal output_b = resampler_b.Run(Sinusoid(frequencies[k], 48000.0,
+                                                      length));
+    const Signal cmp_output_b = Sinusoid(frequencies[k], 16000.0,
+                                         resampler_b.GetOutputLength(length));
+    for (Int i=100; i<(Int)output_b.size()-100; ++i) {
+      ASSERT(IsEqual(output_b[i], cmp_output_b[i], 1.0E-3));
+    }
+  }
+
+  // Components above the output Nyquist frequency are removed
+  const Signal output_d = resampler_b.Run(Sinusoid(10000.0, 48000.0, length));
+  for (Int i=100; i<(Int)output_d.size()-100; ++i) {
+    ASSERT(std::abs(output_d[i]) < 1.0E-3);
+  }
+
+  // The delay of the filter is compensated
+  Signal impulse(100, 0.0);
+  impulse[21] = 1.0;
+  const Signal output_e = Resampler(44100.0, 88200.0).Run(impulse);
+  ASSERT(output_e.size() == 200);
+  ASSERT(IsEqual(output_e[42], 0.95, 1.0E-2));
+  for (Int i=0; i<(Int)output_e.size(); ++i) {
+    ASSERT(std::abs(output_e[i]) <= std::abs(output_e[42]));
+  }
+
+  return true;
+}
+
+} // namespace sal
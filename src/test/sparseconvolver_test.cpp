@@ -0,0 +1,139 @@
+/*
+ sparseconvolver_test.cpp
+ Spatial Audio Library (SAL)
+ Copyright (c) 2015, Enzo De Sena
+ All rights reserved.
+
+ Authors: Enzo De Sena, enzodesena@gmail.com
+
+ */
+
+#include "sparseconvolver.h"
+#include "partitionedconvolver.h"
+#include "comparisonop.h"
+#include <iostream>
+#include <ctime>
+#include <cstdlib>
+
+namespace sal {
+
+static Signal RandomSignal(const Int length) {
+  Signal output(length);
+  for (Int i=0; i<length; ++i) {
+    output[i] = ((Sample) rand())/((Sample) RAND_MAX)-0.5;
+  }
+  return output;
+}
+
+
+/** Returns the dense filter of length `length` with the given taps */
+static Signal DenseFilter(const std::vector<Int>& delays,
+                          const std::vector<Sample>& gains,
+                          const Int length) {
+  Signal filter(length, 0.0);
+  for (Int j=0; j<(Int) delays.size(); ++j) { filter[delays[j]] += gains[j]; }
+  return filter;
+}
+
+
+bool SparseConvolver::Test() {
+  using mcl::IsEqual;
+
+  srand(0);
+  const Int input_length = 5000;
+  const Signal input = RandomSignal(input_length);
+  const Int max_delay = 1000;
+
+  // The taps include a delay of zero, the longest delay and a repeated delay
+  std::vector<Int> delays;
+  delays.push_back(0);
+  delays.push_back(max_delay);
+  delays.push_back(17);
+  delays.push_back(17);
+  for (Int j=0; j<20; ++j) { delays.push_back(rand() % (max_delay+1)); }
+  const std::vector<Sample> gains = RandomSignal(delays.size());
+  const Signal filter = DenseFilter(delays, gains, max_delay+1);
+  Signal expected(input_length, 0.0);
+  for (Int i=0; i<input_length; ++i) {
+    for (Int k=0; k<=max_delay && k<=i; ++k) {
+      expected[i] += filter[k]*input[i-k];
+    }
+  }
+
+  // Blocks of different lengths, also longer than the ring
+  const Int block_lengths[5] = {1, 7, 64, 500, 3000};
+  SparseConvolver convolver(max_delay, delays.size());
+  convolver.SetTaps(delays, gains);
+  ASSERT(convolver.num_taps() == (Int) delays.size());
+  Signal output(input_length);
+  Int done = 0;
+  Int block_id = 0;
+  while (done < input_length) {
+    const Int block_length = std::min(block_lengths[block_id++ % 5],
+                                      input_length-done);
+    convolver.Filter(&input[done], block_length, &output[done]);
+    done += block_length;
+  }
+  ASSERT(IsEqual(output, expected, 1.0E-10));
+
+  // After a reset, the output is the same again
+  convolver.Reset();
+  Signal output_reset(input_length);
+  convolver.Filter(input.data(), input_length, output_reset.data());
+  ASSERT(IsEqual(output_reset, expected, 1.0E-10));
+
+  // Without taps, the output is zero
+  convolver.SetTaps(std::vector<Int>(), std::vector<Sample>());
+  convolver.Filter(input.data(), input_length, output.data());
+  ASSERT(IsEqual(output, Signal(input_length, 0.0)));
+
+  return true;
+}
+
+
+bool SparseConvolver::SimulationTime() {
+  const Time sampling_frequency = 44100.0;
+  const Int filter_length = (Int) (0.1*sampling_frequency);
+  const Int block_length = 64;
+  const Int num_blocks = (Int) (10.0*sampling_frequency)/block_length;
+
+  srand(0);
+  const Signal input = RandomSignal(block_length);
+  Signal output(block_length);
+
+  // The early part of a RIR without interpolation has in the order of a
+  // hundred images in 100 ms
+  const Int num_taps[5] = {10, 100, 300, 1000, 3000};
+  for (Int i=0; i<5; ++i) {
+    std::vector<Int> delays(num_taps[i]);
+    for (Int j=0; j<num_taps[i]; ++j) { delays[j] = rand() % filter_length; }
+    const std::vector<Sample> gains = RandomSignal(num_taps[i]);
+
+    SparseConvolver sparse_convolver(filter_length-1, num_taps[i]);
+    sparse_convolver.SetTaps(delays, gains);
+    clock_t sparse_launch = clock();
+    for (Int k=0; k<num_blocks; ++k) {
+      sparse_convolver.Filter(input.data(), block_length, output.data());
+    }
+    clock_t sparse_done = clock();
+
+    PartitionedConvolver partitioned_convolver(DenseFilter(delays, gains,
+                                                           filter_length));
+    clock_t partitioned_launch = clock();
+    for (Int k=0; k<num_blocks; ++k) {
+      partitioned_convolver.Filter(input.data(), block_length, output.data());
+    }
+    clock_t partitioned_done = clock();
+
+    std::cout<<"Sparse convolver (10 s with 100 ms and "<<num_taps[i]
+             <<" taps): "
+             <<(sparse_done-sparse_launch)/((Time) CLOCKS_PER_SEC)<<" s; "
+             <<"partitioned convolver: "
+             <<(partitioned_done-partitioned_launch)/((Time) CLOCKS_PER_SEC)
+             <<" s\n";
+  }
+
+  return true;
+}
+
+} // namespace sal
@@ -151,6 +151,43 @@ bool SphericalHeadMic::Test() {
   ASSERT(IsEqual(stream_b.GetLeftReadPointer()[0], 0.0));
   ASSERT(IsEqual(stream_b.GetRightReadPointer()[0], 0.0));
   
+  // Testing the table of precomputed HRIRs. On the points of the grid
+  // (here 1 deg and 1, 2, 4 m) the HRIRs are the same as without table.
+  SphericalHeadMic mic_c(Point(0.0,0.0,0.0), mcl::Quaternion::Identity(),
+                         ears_angle, 0.09, 6, sampling_frequency);
+  mic_c.SetHrirTable(181, 1.0, 4.0, 3);
+  StereoBuffer stream_c(impulse.num_samples());
+  mic_c.AddPlaneWave(impulse, point_front, stream_c);
+  ASSERT(IsEqual(stream_c.GetLeftReadPointer(), output_frontal));
+  ASSERT(IsEqual(stream_c.GetRightReadPointer(), output_frontal));
+  
+  // Between the points of the grid the HRIRs are interpolated
+  const Int ir_length = 64;
+  SphericalHeadMic mic_d(Point(0.0,0.0,0.0), mcl::Quaternion::Identity(),
+                         ears_angle, 0.09, ir_length, 44100.0);
+  mic_d.SetHrirTable(181, 0.5, 8.0, 9, true);
+  SphericalHeadMic mic_e = mic_d;
+  mic_e.ClearHrirTable();
+  for (Int i=0; i<8; ++i) {
+    const Angle angle = 0.37+0.71*((Angle) i);
+    const Length point_distance = 0.6+1.3*((Length) i);
+    const Point point(point_distance*cos(angle), point_distance*sin(angle),
+                      0.3);
+    const Signal hrir_table = mic_d.GetBrir(kLeftEar, point);
+    const Signal hrir_exact = mic_e.GetBrir(kLeftEar, point);
+    Sample error = 0.0;
+    Sample energy = 0.0;
+    for (Int k=0; k<ir_length; ++k) {
+      error += pow(hrir_table[k]-hrir_exact[k], 2.0);
+      energy += pow(hrir_exact[k], 2.0);
+    }
+    ASSERT(error/energy < 1.0E-3);
+  }
+  
+  // Distances outside of the grid are clamped to it
+  ASSERT(IsEqual(mic_d.GetBrir(kRightEar, Point(20.0, 1.0, 0.0)),
+                 mic_d.GetBrir(kRightEar, Point(8.0, 0.4, 0.0))));
+  
   return true;
 }
   
@@ -0,0 +1,158 @@
+/*
+ structuralheadmic_test.cpp
+ Spatial Audio Library (SAL)
+ Copyright (c) 2015, Enzo De Sena
+ All rights reserved.
+
+ Authors: Enzo De Sena, enzodesena@gmail.com
+
+ */
+
+#include "structuralheadmic.h"
+#include "kemarmic.h"
+#include "audiobuffer.h"
+#include "comparisonop.h"
+#include <iostream>
+#include <ctime>
+#include <cstdlib>
+
+using mcl::Point;
+using mcl::Quaternion;
+
+namespace sal {
+
+bool StructuralHeadMic::Test() {
+  using mcl::IsEqual;
+
+  const Length radius = 0.09;
+  const Time sampling_frequency = 44100.0;
+
+  ASSERT(IsEqual(GetShadowCoefficient(0.0), 2.0));
+  ASSERT(IsEqual(GetShadowCoefficient(150.0/180.0*PI), 0.1));
+  ASSERT(GetShadowCoefficient(PI/2.0) < GetShadowCoefficient(PI/4.0));
+
+  ASSERT(IsEqual(GetWoodworthDelay(0.0, radius, 343.0), 0.0));
+  ASSERT(IsEqual(GetWoodworthDelay(PI/2.0, radius, 343.0), radius/343.0));
+  ASSERT(IsEqual(GetWoodworthDelay(PI, radius, 343.0),
+                 radius/343.0*(1.0+PI/2.0)));
+  // The delay is continuous at PI/2
+  ASSERT(IsEqual(GetWoodworthDelay(PI/2.0-1.0E-6, radius, 343.0),
+                 GetWoodworthDelay(PI/2.0+1.0E-6, radius, 343.0), 1.0E-8));
+
+  const Angle ears_angle = 100.0/180.0*PI;
+  const Int num_samples = 1000;
+  MonoBuffer impulse(num_samples);
+  impulse.SetSample(0, 1.0);
+
+  // A source in front gives the same output at the two ears
+  StructuralHeadMic mic_a(Point(0.0,0.0,0.0), Quaternion::Identity(),
+                          ears_angle, radius, sampling_frequency);
+  StereoBuffer output_a(num_samples);
+  mic_a.AddPlaneWave(impulse, Point(2.0,0.0,0.0), output_a);
+  ASSERT(IsEqual(output_a.GetLeftReadPointer(), output_a.GetRightReadPointer(),
+                 num_samples));
+
+  // A source on the line of the left ear reaches the left ear first, and
+  // with more high frequencies (a larger first sample). The head-shadow
+  // filter has unit gain at DC, so the sum of each response is one.
+  StructuralHeadMic mic_b(Point(0.0,0.0,0.0), Quaternion::Identity(),
+                          ears_angle, radius, sampling_frequency);
+  StereoBuffer output_b(num_samples);
+  mic_b.AddPlaneWave(impulse,
+                     Point(cos(ears_angle), sin(ears_angle), 0.0), output_b);
+  const Sample* left = output_b.GetLeftReadPointer();
+  const Sample* right = output_b.GetRightReadPointer();
+  ASSERT(IsEqual(left[0], GetShadowCoefficient(0.0)*mic_b.b0_slope_ +
+                          mic_b.b0_offset_));
+  // The angle between the two ears is 2*(PI-ears_angle)
+  const Int itd = (Int) (GetWoodworthDelay(2.0*(PI-ears_angle), radius,
+                                           SOUND_SPEED)*sampling_frequency);
+  for (Int i=0; i<itd; ++i) { ASSERT(IsEqual(right[i], 0.0)); }
+  ASSERT(! IsEqual(right[itd+1], 0.0));
+  Sample sum_left = 0.0;
+  Sample sum_right = 0.0;
+  for (Int i=0; i<num_samples; ++i) {
+    sum_left += left[i];
+    sum_right += right[i];
+  }
+  ASSERT(IsEqual(sum_left, 1.0));
+  ASSERT(IsEqual(sum_right, 1.0));
+
+  // When the source moves, the parameters are ramped across the block and
+  // reach the target at its end. Hence, a second block in the same
+  // position gives the same output as a microphone that has always been
+  // there, once the previous samples have left the delay line.
+  StructuralHeadMic mic_c(Point(0.0,0.0,0.0), Quaternion::Identity(),
+                          ears_angle, radius, sampling_frequency);
+  StructuralHeadMic mic_d(Point(0.0,0.0,0.0), Quaternion::Identity(),
+                          ears_angle, radius, sampling_frequency);
+  const Int block_length = 64;
+  MonoBuffer zeros(block_length);
+  MonoBuffer late_impulse(block_length);
+  late_impulse.SetSample(block_length/2, 1.0);
+  StereoBuffer output_c(block_length);
+  StereoBuffer output_d(block_length);
+  mic_c.AddPlaneWave(zeros, Point(0.0,1.0,0.0), output_c);
+  mic_c.AddPlaneWave(zeros, Point(0.0,-1.0,0.0), output_c);
+  mic_d.AddPlaneWave(zeros, Point(0.0,-1.0,0.0), output_d);
+  output_c.Reset();
+  output_d.Reset();
+  mic_c.AddPlaneWave(late_impulse, Point(0.0,-1.0,0.0), output_c);
+  mic_d.AddPlaneWave(late_impulse, Point(0.0,-1.0,0.0), output_d);
+  ASSERT(IsEqual(output_c.GetLeftReadPointer(), output_d.GetLeftReadPointer(),
+                 block_length));
+  ASSERT(IsEqual(output_c.GetRightReadPointer(),
+                 output_d.GetRightReadPointer(), block_length));
+
+  // Testing reset (from the direction of the left ear, which has no delay)
+  const Point left_point(cos(ears_angle), sin(ears_angle), 0.0);
+  StereoBuffer output_e(1);
+  mic_b.AddPlaneWave(MonoBuffer::Unary(1.0), left_point, output_e);
+  output_e.Reset();
+  mic_b.AddPlaneWave(MonoBuffer::Unary(0.0), left_point, output_e);
+  ASSERT(! IsEqual(output_e.GetLeftReadPointer()[0], 0.0));
+  output_e.Reset();
+  mic_b.Reset();
+  mic_b.AddPlaneWave(MonoBuffer::Unary(0.0), left_point, output_e);
+  ASSERT(IsEqual(output_e.GetLeftReadPointer()[0], 0.0));
+  ASSERT(IsEqual(output_e.GetRightReadPointer()[0], 0.0));
+
+  return true;
+}
+
+
+bool StructuralHeadMic::SimulationTime() {
+  const Time sampling_frequency = 44100.0;
+  const Int block_length = 512;
+  const Int num_blocks = (Int) (60.0*sampling_frequency)/block_length;
+
+  MonoBuffer input(block_length);
+  srand(0);
+  for (Int i=0; i<block_length; ++i) {
+    input.SetSample(i, ((Sample) rand())/((Sample) RAND_MAX)-0.5);
+  }
+  StereoBuffer output(block_length);
+
+  StructuralHeadMic structural_mic(Point(0.0,0.0,0.0), Quaternion::Identity());
+  KemarMic kemar_mic(Point(0.0,0.0,0.0), Quaternion::Identity());
+  Microphone* mics[2] = {&structural_mic, &kemar_mic};
+
+  for (Int mic_id=0; mic_id<2; ++mic_id) {
+    clock_t launch = clock();
+    for (Int i=0; i<num_blocks; ++i) {
+      // The source moves slowly around the head
+      const Angle angle = 2.0*PI*((Angle) i)/((Angle) num_blocks);
+      output.Reset();
+      mics[mic_id]->AddPlaneWave(input, Point(cos(angle), sin(angle), 0.0),
+                                 output);
+    }
+    clock_t done = clock();
+    std::cout<<((mic_id == 0) ? "Structural head" : "Kemar")
+             <<" mic (one minute of one moving source): "
+             <<(done - launch) / ((sal::Time) CLOCKS_PER_SEC)<<" s\n";
+  }
+
+  return true;
+}
+
+} // namespace sal